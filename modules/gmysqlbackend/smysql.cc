@@ -9,6 +9,8 @@
 #include "pdns/dns.hh"
 #include "pdns/namespaces.hh"
 #include "pdns/lock.hh"
+#include <errmsg.h>
+#include <mysqld_error.h>
 
 bool SMySQL::s_dolog;
 pthread_mutex_t SMySQL::s_myinitlock = PTHREAD_MUTEX_INITIALIZER;
@@ -96,6 +98,86 @@ int SMySQL::doQuery(const string &query, result_t &result)
   return result.size();
 }
 
+/** Sends all queries as one multi-statement string so they share one round trip, and collects the result
+    sets in order. Statements that return no result set (like the status of a CALL) are skipped. Multi-statements are
+    only switched on for the duration of this call, so an escaping mistake in any other query can not stack statements */
+void SMySQL::doQueries(const vector<string> &queries, vector<result_t> &results)
+{
+  results.clear();
+  if(queries.empty())
+    return;
+
+  if(d_rres)
+    throw SSqlException("Attempt to start new MySQL query while old one still in progress");
+
+  string query;
+  for(vector<string>::const_iterator i=queries.begin(); i!=queries.end(); ++i) {
+    string::size_type len=i->find_last_not_of("; \t\n");
+    if(len==string::npos)
+      throw SSqlException("MySQL refusing to execute empty query in batch");
+    query.append(*i, 0, len+1);
+    query.append(";");
+  }
+
+  if(s_dolog)
+    L<<Logger::Warning<<"Queries: "<<query<<endl;
+
+  if(mysql_set_server_option(&d_db, MYSQL_OPTION_MULTI_STATEMENTS_ON))
+    throw sPerrorException("Unable to enable MySQL multi-statements");
+
+  try {
+    runBatch(query, queries.size(), results);
+  }
+  catch(...) {
+    // the server wants every pending result read before it takes another command
+    while(mysql_next_result(&d_db) == 0) {
+      MYSQL_RES *res=mysql_store_result(&d_db);
+      if(res)
+        mysql_free_result(res);
+    }
+    mysql_set_server_option(&d_db, MYSQL_OPTION_MULTI_STATEMENTS_OFF);
+    throw;
+  }
+
+  if(mysql_set_server_option(&d_db, MYSQL_OPTION_MULTI_STATEMENTS_OFF))
+    throw sPerrorException("Unable to disable MySQL multi-statements");
+}
+
+void SMySQL::runBatch(const string &query, unsigned int count, vector<result_t> &results)
+{
+  int err;
+  if((err=mysql_real_query(&d_db, query.c_str(), query.size())))
+    throw sPerrorException("Failed to execute mysql_real_query, perhaps connection died? Err="+itoa(err));
+
+  row_t row;
+  for(;;) {
+    MYSQL_RES *res=mysql_store_result(&d_db);
+    if(res) {
+      results.push_back(result_t());
+      result_t& result=results.back();
+      MYSQL_ROW rrow;
+      unsigned int fields=mysql_num_fields(res);
+      while((rrow = mysql_fetch_row(res))) {
+        row.clear();
+        for(unsigned int i=0; i < fields; i++)
+          row.push_back(rrow[i] ?: "");
+        result.push_back(row);
+      }
+      mysql_free_result(res);
+    }
+    else if(mysql_field_count(&d_db))
+      throw sPerrorException("Failed on mysql_store_result");
+
+    if((err=mysql_next_result(&d_db)) > 0)
+      throw sPerrorException("Failed to execute batched MySQL query");
+    if(err < 0)
+      break;
+  }
+
+  if(results.size()!=count)
+    throw SSqlException("MySQL returned an unexpected number of results for batched queries");
+}
+
 bool SMySQL::getRow(row_t &row)
 {
   row.clear();
@@ -122,6 +204,189 @@ bool SMySQL::getRow(row_t &row)
   return false;
 }
 
+class SMySQLStatement : public SSqlStatement
+{
+public:
+  SMySQLStatement(MYSQL *db, const string &query, int nparams, const bool *dolog) : d_db(db), d_stmt(0), d_query(query), d_nparams(nparams), d_dolog(dolog)
+  {
+    try {
+      prepare();
+    }
+    catch(...) {
+      if(d_stmt)
+        mysql_stmt_close(d_stmt);
+      throw;
+    }
+  }
+
+  ~SMySQLStatement()
+  {
+    if(d_stmt)
+      mysql_stmt_close(d_stmt);
+  }
+
+  SSqlStatement* bind(const string &value)
+  {
+    Param p;
+    p.isInt=false;
+    p.str=value;
+    p.num=0;
+    d_params.push_back(p);
+    return this;
+  }
+
+  SSqlStatement* bind(long value)
+  {
+    Param p;
+    p.isInt=true;
+    p.num=value;
+    d_params.push_back(p);
+    return this;
+  }
+
+  SSqlStatement* execute()
+  {
+    mysql_stmt_free_result(d_stmt);
+    if((int)d_params.size()!=d_nparams) {
+      d_params.clear();
+      throw SSqlException("MySQL statement '"+d_query+"' needs "+itoa(d_nparams)+" parameters, got "+itoa(d_params.size()));
+    }
+    if(*d_dolog)
+      L<<Logger::Warning<<"Prepared query: "<<d_query<<endl;
+
+    vector<MYSQL_BIND> binds(d_nparams);
+    vector<unsigned long> lengths(d_nparams);
+    for(int n=0; n < d_nparams; ++n) {
+      memset(&binds[n], 0, sizeof(MYSQL_BIND));
+      if(d_params[n].isInt) {
+        binds[n].buffer_type=MYSQL_TYPE_LONGLONG;
+        binds[n].buffer=&d_params[n].num;
+      }
+      else {
+        lengths[n]=d_params[n].str.size();
+        binds[n].buffer_type=MYSQL_TYPE_STRING;
+        binds[n].buffer=(void*)d_params[n].str.c_str();
+        binds[n].buffer_length=lengths[n];
+        binds[n].length=&lengths[n];
+      }
+    }
+
+    for(int attempt=0; ; ++attempt) {
+      if(mysql_stmt_bind_param(d_stmt, binds.empty() ? 0 : &binds[0]) || mysql_stmt_execute(d_stmt)) {
+        unsigned int err=mysql_stmt_errno(d_stmt);
+        if(!attempt && (err==CR_SERVER_GONE_ERROR || err==CR_SERVER_LOST || err==ER_UNKNOWN_STMT_HANDLER)) {
+          prepare(); // our statement did not survive the reconnect
+          continue;
+        }
+        string error=mysql_stmt_error(d_stmt);
+        d_params.clear();
+        throw SSqlException("Failed to execute MySQL prepared statement: "+error);
+      }
+      break;
+    }
+    d_params.clear();
+
+    unsigned int fields=mysql_stmt_field_count(d_stmt);
+    if(!fields)
+      return this;
+
+    d_results.resize(fields);
+    d_resbinds.resize(fields);
+    for(unsigned int n=0; n < fields; ++n) {
+      if(d_results[n].buffer.empty())
+        d_results[n].buffer.resize(128);
+      memset(&d_resbinds[n], 0, sizeof(MYSQL_BIND));
+      d_resbinds[n].buffer_type=MYSQL_TYPE_STRING;
+      d_resbinds[n].buffer=&d_results[n].buffer[0];
+      d_resbinds[n].buffer_length=d_results[n].buffer.size();
+      d_resbinds[n].length=&d_results[n].length;
+      d_resbinds[n].is_null=&d_results[n].isNull;
+    }
+    if(mysql_stmt_bind_result(d_stmt, &d_resbinds[0]) || mysql_stmt_store_result(d_stmt))
+      throw SSqlException("Failed to retrieve MySQL prepared statement results: "+string(mysql_stmt_error(d_stmt)));
+    return this;
+  }
+
+  bool getRow(row_t &row)
+  {
+    row.clear();
+    if(!mysql_stmt_field_count(d_stmt))
+      return false;
+
+    int rc=mysql_stmt_fetch(d_stmt);
+    if(rc==MYSQL_NO_DATA) {
+      mysql_stmt_free_result(d_stmt);
+      return false;
+    }
+    if(rc==1) {
+      string error=mysql_stmt_error(d_stmt);
+      mysql_stmt_free_result(d_stmt);
+      throw SSqlException("Failed to fetch MySQL prepared statement row: "+error);
+    }
+
+    bool rebind=false;
+    for(unsigned int n=0; n < d_results.size(); ++n) {
+      Result& res=d_results[n];
+      if(res.isNull) {
+        row.push_back("");
+        continue;
+      }
+      if(res.length > res.buffer.size()) { // MYSQL_DATA_TRUNCATED, fetch this column again with room for all of it
+        res.buffer.resize(res.length);
+        d_resbinds[n].buffer=&res.buffer[0];
+        d_resbinds[n].buffer_length=res.buffer.size();
+        if(mysql_stmt_fetch_column(d_stmt, &d_resbinds[n], n, 0))
+          throw SSqlException("Failed to fetch MySQL prepared statement column: "+string(mysql_stmt_error(d_stmt)));
+        rebind=true;
+      }
+      row.push_back(string(&res.buffer[0], res.length));
+    }
+    if(rebind && mysql_stmt_bind_result(d_stmt, &d_resbinds[0]))
+      throw SSqlException("Failed to rebind MySQL prepared statement results: "+string(mysql_stmt_error(d_stmt)));
+    return true;
+  }
+
+private:
+  void prepare()
+  {
+    if(d_stmt)
+      mysql_stmt_close(d_stmt);
+    if(!(d_stmt=mysql_stmt_init(d_db)))
+      throw SSqlException("Failed to allocate MySQL statement: "+string(mysql_error(d_db)));
+    if(mysql_stmt_prepare(d_stmt, d_query.c_str(), d_query.size()))
+      throw SSqlException("Failed to prepare MySQL statement '"+d_query+"': "+string(mysql_stmt_error(d_stmt)));
+    if((int)mysql_stmt_param_count(d_stmt)!=d_nparams)
+      throw SSqlException("MySQL statement '"+d_query+"' has "+itoa(mysql_stmt_param_count(d_stmt))+" parameters, expected "+itoa(d_nparams));
+  }
+
+  struct Param
+  {
+    bool isInt;
+    string str;
+    long long num;
+  };
+  struct Result
+  {
+    vector<char> buffer;
+    unsigned long length;
+    my_bool isNull;
+  };
+
+  MYSQL *d_db;
+  MYSQL_STMT *d_stmt;
+  string d_query;
+  int d_nparams;
+  const bool *d_dolog;
+  vector<Param> d_params;
+  vector<Result> d_results;
+  vector<MYSQL_BIND> d_resbinds;
+};
+
+SSqlStatement* SMySQL::prepare(const string &query, int nparams)
+{
+  return new SMySQLStatement(&d_db, query, nparams, &s_dolog);
+}
+
 string SMySQL::escape(const string &name)
 {
   string a;
@@ -21,10 +21,14 @@ public:
   int doQuery(const string &query, result_t &result);
   int doQuery(const string &query);
   int doCommand(const string &query);
+  void doQueries(const vector<string> &queries, vector<result_t> &results);
   bool getRow(row_t &row);
+  SSqlStatement* prepare(const string &query, int nparams);
   string escape(const string &str);    
   void setLog(bool state);
 private:
+  void runBatch(const string &query, unsigned int count, vector<result_t> &results);
+
   MYSQL d_db;
   MYSQL_RES *d_rres;
   static bool s_dolog;
@@ -48,6 +48,7 @@ public:
     declare(suffix,"socket","Pdns backend socket to connect to","");
     declare(suffix,"password","Pdns backend password to connect with","");
     declare(suffix, "dnssec", "Assume DNSSEC Schema is in place","no");
+    declare(suffix,"insert-batch-size","Number of records sent in one insert statement when loading a zone","100");
 
     declare(suffix,"basic-query","Basic query","select content,ttl,prio,type,domain_id,name from records where type='%s' and name=E'%s'");
     declare(suffix,"id-query","Basic with ID query","select content,ttl,prio,type,domain_id,name from records where type='%s' and name=E'%s' and domain_id=%d");
@@ -5,6 +5,7 @@
 
 #include <iostream>
 #include "pdns/logger.hh"
+#include "pdns/misc.hh"
 #include "pdns/dns.hh"
 #include "pdns/namespaces.hh"
 
@@ -14,6 +15,8 @@ SPgSQL::SPgSQL(const string &database, const string &host, const string& port, c
                const string &password)
 {
   d_db=0;
+  d_generation=0;
+  d_nstatements=0;
 
   d_connectstr="dbname=";
   d_connectstr+=database;
@@ -56,6 +59,7 @@ void SPgSQL::ensureConnect()
   if(d_db)
     PQfinish(d_db);
   d_db=PQconnectdb(d_connectstr.c_str());
+  d_generation++;
 
   if (!d_db || PQstatus(d_db)==CONNECTION_BAD) {
     try {
@@ -155,6 +159,66 @@ int SPgSQL::doQuery(const string &query, result_t &result)
   return result.size();
 }
 
+/** Sends all queries as a single multi-statement string so they share one round trip, PostgreSQL
+    then hands back one result per statement, in order */
+void SPgSQL::doQueries(const vector<string> &queries, vector<result_t> &results)
+{
+  results.clear();
+  if(queries.empty())
+    return;
+
+  string query;
+  for(vector<string>::const_iterator i=queries.begin(); i!=queries.end(); ++i) {
+    string::size_type len=i->find_last_not_of("; \t\n");
+    if(len==string::npos)
+      throw SSqlException("PostgreSQL refusing to execute empty query in batch");
+    query.append(*i, 0, len+1);
+    query.append(";");
+  }
+
+  if(s_dolog)
+    L<<Logger::Warning<<"Queries: "<<query<<endl;
+
+  bool first = true;
+retry:
+  if(!PQsendQuery(d_db, query.c_str())) {
+    if(PQstatus(d_db)==CONNECTION_BAD) {
+      ensureConnect();
+      if(first) {
+        first = false;
+        goto retry;
+      }
+    }
+    throw sPerrorException("PostgreSQL failed to send queries");
+  }
+
+  string error;
+  row_t row;
+  while((d_result=PQgetResult(d_db))) { // always drain every result, or the connection stays busy
+    if(error.empty()) {
+      if(PQresultStatus(d_result)!=PGRES_TUPLES_OK)
+        error=PQresultErrorMessage(d_result);
+      else {
+        results.push_back(result_t());
+        result_t& result=results.back();
+        for(int n=0; n < PQntuples(d_result); ++n) {
+          row.clear();
+          for(int i=0; i < PQnfields(d_result); ++i)
+            row.push_back(PQgetvalue(d_result, n, i) ?: "");
+          result.push_back(row);
+        }
+      }
+    }
+    PQclear(d_result);
+  }
+  d_result=0;
+
+  if(!error.empty())
+    throw SSqlException("PostgreSQL failed to execute command: "+error);
+  if(results.size()!=queries.size())
+    throw SSqlException("PostgreSQL returned an unexpected number of results for batched queries");
+}
+
 bool SPgSQL::getRow(row_t &row)
 {
   row.clear();
@@ -170,6 +234,143 @@ bool SPgSQL::getRow(row_t &row)
   return true;
 }
 
+class SPgSQLStatement : public SSqlStatement
+{
+public:
+  SPgSQLStatement(SPgSQL *parent, const string &query, int nparams) : d_parent(parent), d_nparams(nparams), d_res(0), d_row(0), d_generation(0)
+  {
+    // PostgreSQL wants $1, $2.. instead of ?
+    bool quoted=false;
+    int param=0;
+    for(string::const_iterator i=query.begin(); i!=query.end(); ++i) {
+      if(*i=='\'')
+        quoted=!quoted;
+      if(*i=='?' && !quoted)
+        d_query+="$"+itoa(++param);
+      else
+        d_query+=*i;
+    }
+    d_name="pdns_stmt_"+itoa(d_parent->d_nstatements++);
+    prepare();
+  }
+
+  ~SPgSQLStatement()
+  {
+    if(d_res)
+      PQclear(d_res);
+    if(d_parent->d_db && d_generation==d_parent->d_generation && PQstatus(d_parent->d_db)==CONNECTION_OK)
+      PQclear(PQexec(d_parent->d_db, ("DEALLOCATE "+d_name).c_str()));
+  }
+
+  SSqlStatement* bind(const string &value)
+  {
+    d_params.push_back(value);
+    return this;
+  }
+
+  SSqlStatement* bind(long value)
+  {
+    char tmp[24];
+    snprintf(tmp, sizeof(tmp), "%ld", value);
+    d_params.push_back(tmp);
+    return this;
+  }
+
+  SSqlStatement* execute()
+  {
+    if(d_res) {
+      PQclear(d_res);
+      d_res=0;
+    }
+    if((int)d_params.size()!=d_nparams) {
+      d_params.clear();
+      throw SSqlException("PostgreSQL statement '"+d_query+"' needs "+itoa(d_nparams)+" parameters, got "+itoa(d_params.size()));
+    }
+    if(SPgSQL::s_dolog)
+      L<<Logger::Warning<<"Prepared query: "<<d_query<<endl;
+
+    vector<const char*> values;
+    for(vector<string>::const_iterator i=d_params.begin(); i!=d_params.end(); ++i)
+      values.push_back(i->c_str());
+
+    bool first = true;
+  retry:
+    if(d_generation!=d_parent->d_generation)
+      prepare();
+
+    d_res=PQexecPrepared(d_parent->d_db, d_name.c_str(), d_nparams, values.empty() ? 0 : &values[0], 0, 0, 0);
+    ExecStatusType status=d_res ? PQresultStatus(d_res) : PGRES_FATAL_ERROR;
+    if(status!=PGRES_TUPLES_OK && status!=PGRES_COMMAND_OK) {
+      string error("unknown reason");
+      if(d_res) {
+        error=PQresultErrorMessage(d_res);
+        PQclear(d_res);
+        d_res=0;
+      }
+      if(PQstatus(d_parent->d_db)==CONNECTION_BAD) {
+        d_parent->ensureConnect();
+        if(first) {
+          first = false;
+          goto retry;
+        }
+      }
+      d_params.clear();
+      throw SSqlException("PostgreSQL failed to execute prepared statement: "+error);
+    }
+    d_params.clear();
+    d_row=0;
+    return this;
+  }
+
+  bool getRow(row_t &row)
+  {
+    row.clear();
+    if(!d_res)
+      return false;
+
+    if(d_row >= PQntuples(d_res)) {
+      PQclear(d_res);
+      d_res=0;
+      return false;
+    }
+
+    for(int i=0;i<PQnfields(d_res);i++)
+      row.push_back(PQgetvalue(d_res,d_row,i) ?: "");
+    d_row++;
+    return true;
+  }
+
+private:
+  void prepare()
+  {
+    PGresult *res=PQprepare(d_parent->d_db, d_name.c_str(), d_query.c_str(), d_nparams, 0);
+    if(!res || PQresultStatus(res)!=PGRES_COMMAND_OK) {
+      string error("unknown reason");
+      if(res) {
+        error=PQresultErrorMessage(res);
+        PQclear(res);
+      }
+      throw SSqlException("PostgreSQL failed to prepare statement '"+d_query+"': "+error);
+    }
+    PQclear(res);
+    d_generation=d_parent->d_generation;
+  }
+
+  SPgSQL *d_parent;
+  string d_query;
+  string d_name;
+  int d_nparams;
+  vector<string> d_params;
+  PGresult *d_res;
+  int d_row;
+  unsigned int d_generation;
+};
+
+SSqlStatement* SPgSQL::prepare(const string &query, int nparams)
+{
+  return new SPgSQLStatement(this, query, nparams);
+}
+
 string SPgSQL::escape(const string &name)
 {
   string a;
@@ -19,12 +19,17 @@ public:
   int doQuery(const string &query, result_t &result);
   int doQuery(const string &query);
   int doCommand(const string &query);
+  void doQueries(const vector<string> &queries, vector<result_t> &results);
   bool getRow(row_t &row);
+  SSqlStatement* prepare(const string &query, int nparams);
   string escape(const string &str);    
   void setLog(bool state);
 private:
+  friend class SPgSQLStatement;
   void ensureConnect();
   PGconn* d_db; 
+  unsigned int d_generation;  // bumped on every (re)connect, prepared statements do not survive those
+  unsigned int d_nstatements;
   string d_connectstr;
   string d_connectlogstr;
   PGresult* d_result;
@@ -26,6 +26,8 @@
 #include <fstream>
 #include <fcntl.h>
 #include <sstream>
+#include <limits>
+#include <algorithm>
 #include <boost/bind.hpp>
 #include <boost/algorithm/string.hpp>
 #include <boost/foreach.hpp>
@@ -80,6 +82,7 @@ int Bind2Backend::s_first=1;
 pthread_mutex_t Bind2Backend::s_startup_lock=PTHREAD_MUTEX_INITIALIZER;
 pthread_mutex_t Bind2Backend::s_state_lock=PTHREAD_MUTEX_INITIALIZER;
 pthread_mutex_t Bind2Backend::s_state_swap_lock=PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t Bind2Backend::s_reload_lock=PTHREAD_MUTEX_INITIALIZER;
 string Bind2Backend::s_binddirectory;  
 /* when a query comes in, we find the most appropriate zone and answer from that */
 
@@ -88,6 +91,7 @@ BB2DomainInfo::BB2DomainInfo()
 {
   d_loaded=false;
   d_lastcheck=0;
+  d_ctime=0;
   d_checknow=false;
   d_status="Unknown";
 }
@@ -132,6 +136,104 @@ void BB2DomainInfo::setCtime()
   d_ctime=buf.st_ctime;
 }
 
+namespace {
+  //! orders compact records by qname, the same way Bind2DNSCompare does for a plain string
+  struct CompactQnameCompare
+  {
+    explicit CompactQnameCompare(const Bind2CompactRecords* cr) : d_cr(cr) {}
+    bool operator()(const Bind2CompactRecords::Record& a, const string& b) const
+    {
+      return strcmp(d_cr->str(a.qname), b.c_str()) < 0;
+    }
+    bool operator()(const string& a, const Bind2CompactRecords::Record& b) const
+    {
+      return strcmp(a.c_str(), d_cr->str(b.qname)) < 0;
+    }
+    const Bind2CompactRecords* d_cr;
+  };
+
+  //! orders record positions by the NSEC3 hash of the record
+  struct CompactHashCompare
+  {
+    CompactHashCompare(const vector<Bind2CompactRecords::Record>& records, const vector<char>& pool) : d_records(records), d_pool(pool) {}
+    bool operator()(uint32_t a, uint32_t b) const
+    {
+      return strcmp(&d_pool[d_records[a].nsec3hash], &d_pool[d_records[b].nsec3hash]) < 0;
+    }
+    const vector<Bind2CompactRecords::Record>& d_records;
+    const vector<char>& d_pool;
+  };
+}
+
+Bind2CompactRecords::Bind2CompactRecords(const recordstorage_t& records)
+{
+  map<string, uint32_t> offsets; // only needed while building
+  map<string, uint32_t> wireoffsets;
+  d_records.reserve(records.size());
+
+  Record rec;
+  BOOST_FOREACH(const Bind2DNSRecord& bdr, records) {
+    rec.qname=intern(offsets, bdr.qname);
+    rec.content=intern(offsets, bdr.content);
+    rec.wirecontent=internWire(wireoffsets, bdr.wirecontent);
+    rec.nsec3hash=intern(offsets, bdr.nsec3hash);
+    rec.ttl=bdr.ttl;
+    rec.qtype=bdr.qtype;
+    rec.priority=bdr.priority;
+    rec.auth=bdr.auth;
+    d_records.push_back(rec);
+  }
+  vector<char>(d_pool).swap(d_pool); // shrink to fit
+
+  for(uint32_t n=0; n < d_records.size(); ++n)
+    if(d_records[n].auth && d_pool[d_records[n].nsec3hash])
+      d_hashindex.push_back(n);
+  stable_sort(d_hashindex.begin(), d_hashindex.end(), CompactHashCompare(d_records, d_pool));
+}
+
+uint32_t Bind2CompactRecords::intern(map<string, uint32_t>& offsets, const string& str)
+{
+  map<string, uint32_t>::const_iterator iter=offsets.find(str);
+  if(iter != offsets.end())
+    return iter->second;
+
+  if(d_pool.size() + str.size() + 1 > std::numeric_limits<uint32_t>::max())
+    throw AhuException("Zone too large to store in compact form");
+
+  uint32_t offset=d_pool.size();
+  d_pool.insert(d_pool.end(), str.begin(), str.end());
+  d_pool.push_back(0);
+  offsets.insert(make_pair(str, offset));
+  return offset;
+}
+
+uint32_t Bind2CompactRecords::internWire(map<string, uint32_t>& offsets, const string& wire)
+{
+  map<string, uint32_t>::const_iterator iter=offsets.find(wire);
+  if(iter != offsets.end())
+    return iter->second;
+
+  if(d_pool.size() + wire.size() + 2 > std::numeric_limits<uint32_t>::max())
+    throw AhuException("Zone too large to store in compact form");
+
+  uint32_t offset=d_pool.size();
+  d_pool.push_back((char)(wire.size() >> 8));
+  d_pool.push_back((char)(wire.size() & 0xff));
+  d_pool.insert(d_pool.end(), wire.begin(), wire.end());
+  offsets.insert(make_pair(wire, offset));
+  return offset;
+}
+
+pair<Bind2CompactRecords::const_iterator, Bind2CompactRecords::const_iterator> Bind2CompactRecords::equal_range(const string& qname) const
+{
+  return std::equal_range(d_records.begin(), d_records.end(), qname, CompactQnameCompare(this));
+}
+
+Bind2CompactRecords::const_iterator Bind2CompactRecords::upper_bound(const string& qname) const
+{
+  return std::upper_bound(d_records.begin(), d_records.end(), qname, CompactQnameCompare(this));
+}
+
 void Bind2Backend::setNotified(uint32_t id, uint32_t serial)
 {
   Lock l(&s_state_lock);
@@ -411,9 +513,8 @@ static string canonic(string ret)
 /** THIS IS AN INTERNAL FUNCTION! It does moadnsparser prio impedence matching
     This function adds a record to a domain with a certain id. 
     Much of the complication is due to the efforts to benefit from std::string reference counting copy on write semantics */
-void Bind2Backend::insert(shared_ptr<State> stage, int id, const string &qnameu, const QType &qtype, const string &content, int ttl, int prio, const std::string& hashed)
+void Bind2Backend::insert(BB2DomainInfo& bb2, const string &qnameu, const QType &qtype, const string &content, int ttl, int prio, const std::string& hashed)
 {
-  BB2DomainInfo bb2 = stage->id_zone_map[id];
   Bind2DNSRecord bdr;
 
   recordstorage_t& records=*bb2.d_records; 
@@ -460,19 +561,36 @@ void Bind2Backend::insert(shared_ptr<State> stage, int id, const string &qnameu,
 
   bdr.ttl=ttl;
   bdr.priority=prio;
+  bdr.wirecontent=makeWireContent(bdr.qtype, bdr.content, bdr.priority);
   
   records.insert(bdr);
 }
 
 
+//! finds the id of the zone called name, false if we have no such zone, or name is not a valid name to begin with
+static bool getZoneId(const Bind2Backend::name_id_map_t& nimap, const string& name, int* id)
+{
+  try {
+    Bind2Backend::name_id_map_t::const_iterator iter=nimap.find(DNSName(name));
+    if(iter == nimap.end())
+      return false;
+    *id=iter->second;
+    return true;
+  }
+  catch(AhuException& ae) {
+    return false;
+  }
+}
+
 string Bind2Backend::DLReloadNowHandler(const vector<string>&parts, Utility::pid_t ppid)
 {
   shared_ptr<State> state = getState();
   ostringstream ret;
 
   for(vector<string>::const_iterator i=parts.begin()+1;i<parts.end();++i) {
-    if(state->name_id_map.count(*i)) {
-      BB2DomainInfo& bbd=state->id_zone_map[state->name_id_map[*i]];
+    int id;
+    if(getZoneId(state->name_id_map, *i, &id)) {
+      BB2DomainInfo& bbd=state->id_zone_map[id];
       Bind2Backend bb2;
       bb2.queueReload(&bbd);
       ret<< *i << ": "<< (bbd.d_loaded ? "": "[rejected]") <<"\t"<<bbd.d_status<<"\n";      
@@ -493,8 +611,9 @@ string Bind2Backend::DLDomStatusHandler(const vector<string>&parts, Utility::pid
       
   if(parts.size() > 1) {
     for(vector<string>::const_iterator i=parts.begin()+1;i<parts.end();++i) {
-      if(state->name_id_map.count(*i)) {
-        BB2DomainInfo& bbd=state->id_zone_map[state->name_id_map[*i]];  // XXX s_name_id_map needs trick as well
+      int id;
+      if(getZoneId(state->name_id_map, *i, &id)) {
+        BB2DomainInfo& bbd=state->id_zone_map[id];  // XXX s_name_id_map needs trick as well
         ret<< *i << ": "<< (bbd.d_loaded ? "": "[rejected]") <<"\t"<<bbd.d_status<<"\n";      
     }
       else
@@ -593,10 +712,8 @@ void Bind2Backend::fixupAuth(shared_ptr<recordstorage_t> records)
   }
 }
 
-void Bind2Backend::doEmptyNonTerminals(shared_ptr<State> stage, int id, bool nsec3zone, NSEC3PARAMRecordContent ns3pr)
+void Bind2Backend::doEmptyNonTerminals(BB2DomainInfo& bb2, bool nsec3zone, NSEC3PARAMRecordContent ns3pr)
 {
-  BB2DomainInfo bb2 = stage->id_zone_map[id];
-
   bool doent=true;
   set<string> qnames, nonterm;
   string qname, shorter, hashed;
@@ -639,20 +756,132 @@ void Bind2Backend::doEmptyNonTerminals(shared_ptr<State> stage, int id, bool nse
     rr.qname=qname+"."+bb2.d_name+".";
     if(nsec3zone)
       hashed=toLower(toBase32Hex(hashQNameWithSalt(ns3pr.d_iterations, ns3pr.d_salt, rr.qname)));
-    insert(stage, id, rr.qname, rr.qtype, rr.content, rr.ttl, rr.priority, hashed);
+    insert(bb2, rr.qname, rr.qtype, rr.content, rr.ttl, rr.priority, hashed);
+  }
+}
+
+/** (re)parses the zone file of bbd into freshly allocated records, so any previous records of bbd, which may still be in use, stay intact.
+    Touches nothing but bbd, and can therefore run in parallel for different zones. Throws on error, in which case bbd should be discarded. */
+void Bind2Backend::parseZoneFile(BB2DomainInfo& bbd, bool nsec3zone, const NSEC3PARAMRecordContent& ns3pr, bool compact)
+{
+  bbd.d_records=shared_ptr<recordstorage_t>(new recordstorage_t());
+  bbd.d_compact.reset();
+
+  ZoneParserTNG zpt(bbd.d_filename, bbd.d_name, s_binddirectory);
+  DNSResourceRecord rr;
+  string hashed;
+  while(zpt.get(rr)) {
+    if(rr.qtype.getCode() == QType::NSEC || rr.qtype.getCode() == QType::NSEC3)
+      continue; // we synthesise NSECs on demand
+
+    if(nsec3zone) {
+      if(rr.qtype.getCode() != QType::NSEC3 && rr.qtype.getCode() != QType::RRSIG)
+        hashed=toLower(toBase32Hex(hashQNameWithSalt(ns3pr.d_iterations, ns3pr.d_salt, rr.qname)));
+      else
+        hashed="";
+    }
+    insert(bbd, rr.qname, rr.qtype, rr.content, rr.ttl, rr.priority, hashed);
+  }
+
+  fixupAuth(bbd.d_records);
+  doEmptyNonTerminals(bbd, nsec3zone, ns3pr);
+
+  if(compact) {
+    static shared_ptr<recordstorage_t> norecords(new recordstorage_t); // shared by all compacted zones, never modified
+    bbd.d_compact=shared_ptr<Bind2CompactRecords>(new Bind2CompactRecords(*bbd.d_records));
+    bbd.d_records=norecords;
+  }
+}
+
+/** the zones loadConfig() found to be new or changed, parsed by a pool of reloadThread()s */
+struct Bind2Backend::ReloadQueue
+{
+  struct Job
+  {
+    BB2DomainInfo bbd;
+    bool nsec3zone;
+    NSEC3PARAMRecordContent ns3pr;
+  };
+  vector<Job> jobs;
+  unsigned int next;  //!< first job nobody picked up yet, only touched atomically
+  bool compact;
+  string logprefix;
+
+  pthread_mutex_t lock; //!< protects the fields below
+  int rejected;
+  string status;
+};
+
+void* Bind2Backend::reloadThread(void* p)
+{
+  ReloadQueue* rq=(ReloadQueue*)p;
+  unsigned int n;
+  while((n=__sync_fetch_and_add(&rq->next, 1)) < rq->jobs.size())
+    reloadZone(rq, n);
+  return 0;
+}
+
+/** parses one zone of the queue, and publishes it in s_state right away, so it does not have to wait for the rest */
+void Bind2Backend::reloadZone(ReloadQueue* rq, unsigned int n)
+{
+  BB2DomainInfo& bbd=rq->jobs[n].bbd;
+  string msg;
+  L<<Logger::Info<<rq->logprefix<<" parsing '"<<bbd.d_name<<"' from file '"<<bbd.d_filename<<"'"<<endl;
+
+  try {
+    parseZoneFile(bbd, rq->jobs[n].nsec3zone, rq->jobs[n].ns3pr, rq->compact);
+  }
+  catch(AhuException &ae) {
+    msg=" error at "+nowTime()+" parsing '"+bbd.d_name+"' from file '"+bbd.d_filename+"': "+ae.reason;
+  }
+  catch(std::exception &ae) {
+    msg=" error at "+nowTime()+" parsing '"+bbd.d_name+"' from file '"+bbd.d_filename+"': "+ae.what();
+  }
+
+  {
+    Lock l(&s_state_lock);
+    id_zone_map_t::iterator iter=s_state->id_zone_map.find(bbd.d_id);
+    if(iter != s_state->id_zone_map.end() && iter->second.d_filename == bbd.d_filename) { // the zone may have been changed or removed meanwhile
+      if(msg.empty()) {
+        iter->second.d_records=bbd.d_records;
+        iter->second.d_compact=bbd.d_compact;
+        iter->second.d_ctime=bbd.d_ctime;
+        iter->second.d_checknow=false;
+        iter->second.d_status="parsed into memory at "+nowTime();
+        iter->second.d_loaded=true;
+      }
+      else
+        iter->second.d_status=msg; // if we had a previous version, keep serving that
+    }
+  }
+  bbd.d_records.reset(); // the published copy keeps them alive
+  bbd.d_compact.reset();
+
+  if(!msg.empty()) {
+    L<<Logger::Warning<<rq->logprefix<<msg<<endl;
+    Lock l(&rq->lock);
+    rq->status+=msg;
+    rq->rejected++;
   }
 }
 
 void Bind2Backend::loadConfig(string* status)
 {
-  // Interference with createSlaveDomain()
-  Lock l(&s_state_lock);
+  Lock rl(&s_reload_lock);
   
   static int domain_id=1;
 
+  if(getArg("config").empty())
+    return;
+
   shared_ptr<State> staging = shared_ptr<State>(new State);
+  ReloadQueue rq;
+  int remdomains=0;
+  int newdomains=0;
+  {
+    // Interference with createSlaveDomain()
+    Lock l(&s_state_lock);
 
-  if(!getArg("config").empty()) {
     BindParser BP;
     try {
       BP.parse(getArg("config"));
@@ -670,9 +899,6 @@ void Bind2Backend::loadConfig(string* status)
 
     L<<Logger::Warning<<d_logprefix<<" Parsing "<<domains.size()<<" domain(s), will report when done"<<endl;
     
-    int rejected=0;
-    int newdomains=0;
-
     //    random_shuffle(domains.begin(), domains.end());
     struct stat st;
       
@@ -681,6 +907,7 @@ void Bind2Backend::loadConfig(string* status)
       if(stat(i->filename.c_str(), &st) == 0) {
         i->d_dev = st.st_dev;
         i->d_ino = st.st_ino;
+        i->d_ctime = st.st_ctime;
       }
     }
 
@@ -694,9 +921,18 @@ void Bind2Backend::loadConfig(string* status)
           continue;
         }
 
+        DNSName zname;
+        try {
+          zname=DNSName(i->name);
+        }
+        catch(AhuException& ae) {
+          L<<Logger::Error<<d_logprefix<<" Skipping zone '"<<i->name<<"': "<<ae.reason<<endl;
+          continue;
+        }
+
         BB2DomainInfo* bbd=0;
 
-        if(!s_state->name_id_map.count(i->name)) { // is it fully new?
+        if(!s_state->name_id_map.count(zname)) { // is it fully new?
           bbd=&staging->id_zone_map[domain_id];
           bbd->d_id=domain_id++;
         
@@ -708,11 +944,11 @@ void Bind2Backend::loadConfig(string* status)
           bbd->d_loaded=false;
         }
         else {  // no, we knew about it already
-          staging->id_zone_map[s_state->name_id_map[i->name]] = s_state->id_zone_map[s_state->name_id_map[i->name]]; // these should all be read-only on s_state
-          bbd = &staging->id_zone_map[s_state->name_id_map[i->name]];
+          staging->id_zone_map[s_state->name_id_map[zname]] = s_state->id_zone_map[s_state->name_id_map[zname]]; // these should all be read-only on s_state
+          bbd = &staging->id_zone_map[s_state->name_id_map[zname]];
         }
         
-        staging->name_id_map[i->name]=bbd->d_id; // fill out name -> id map
+        staging->name_id_map[zname]=bbd->d_id; // fill out name -> id map
 
         // overwrite what we knew about the domain
         bbd->d_name=i->name;
@@ -722,63 +958,13 @@ void Bind2Backend::loadConfig(string* status)
         bbd->d_masters=i->masters;
         bbd->d_also_notify=i->alsoNotify;
         
-        if(filenameChanged || !bbd->d_loaded || !bbd->current()) {
-          L<<Logger::Info<<d_logprefix<<" parsing '"<<i->name<<"' from file '"<<i->filename<<"'"<<endl;
-
-          NSEC3PARAMRecordContent ns3pr;
-          bool nsec3zone=getNSEC3PARAM(i->name, &ns3pr);
-        
-          try {
-            // we need to allocate a new vector so we don't kill the original, which is still in use!
-            bbd->d_records=shared_ptr<recordstorage_t> (new recordstorage_t()); 
-
-            ZoneParserTNG zpt(i->filename, i->name, BP.getDirectory());
-            DNSResourceRecord rr;
-            string hashed;
-            while(zpt.get(rr)) {  // FIXME this code is duplicate
-              if(rr.qtype.getCode() == QType::NSEC || rr.qtype.getCode() == QType::NSEC3)
-                continue; // we synthesise NSECs on demand
-
-              if(nsec3zone) {
-                if(rr.qtype.getCode() != QType::NSEC3 && rr.qtype.getCode() != QType::RRSIG)
-                  hashed=toLower(toBase32Hex(hashQNameWithSalt(ns3pr.d_iterations, ns3pr.d_salt, rr.qname)));
-                else
-                  hashed="";
-              }
-              insert(staging, bbd->d_id, rr.qname, rr.qtype, rr.content, rr.ttl, rr.priority, hashed);
-            }
-        
-            // sort(staging->id_zone_map[bbd->d_id].d_records->begin(), staging->id_zone_map[bbd->d_id].d_records->end());
-            
-            fixupAuth(staging->id_zone_map[bbd->d_id].d_records);
-            doEmptyNonTerminals(staging, bbd->d_id, nsec3zone, ns3pr);
-            
-            staging->id_zone_map[bbd->d_id].setCtime();
-            staging->id_zone_map[bbd->d_id].d_loaded=true; 
-            staging->id_zone_map[bbd->d_id].d_status="parsed into memory at "+nowTime();
-            
-            //  s_stage->id_zone_map[bbd->d_id].d_records->swap(*s_staging_zone_map[bbd->d_id].d_records);
-          }
-          catch(AhuException &ae) {
-            ostringstream msg;
-            msg<<" error at "+nowTime()+" parsing '"<<i->name<<"' from file '"<<i->filename<<"': "<<ae.reason;
-
-            if(status)
-              *status+=msg.str();
-            staging->id_zone_map[bbd->d_id].d_status=msg.str();
-            L<<Logger::Warning<<d_logprefix<<msg.str()<<endl;
-            rejected++;
-          }
-          catch(std::exception &ae) {
-            ostringstream msg;
-            msg<<" error at "+nowTime()+" parsing '"<<i->name<<"' from file '"<<i->filename<<"': "<<ae.what();
-
-            if(status)
-              *status+=msg.str();
-            staging->id_zone_map[bbd->d_id].d_status=msg.str();
-            L<<Logger::Warning<<d_logprefix<<msg.str()<<endl;
-            rejected++;
-          }
+        // a zone whose file has the ctime we loaded it with is skipped, without looking at its contents
+        if(filenameChanged || !bbd->d_loaded || bbd->d_checknow || !i->d_ctime || i->d_ctime != bbd->d_ctime) {
+          ReloadQueue::Job job;
+          job.bbd=*bbd;
+          job.bbd.d_ctime=i->d_ctime; // the ctime before parsing, so a change while we parse triggers another reload
+          job.nsec3zone=getNSEC3PARAM(i->name, &job.ns3pr);
+          rq.jobs.push_back(job);
         }
         /*
         vector<vector<BBResourceRecord> *>&tmp=d_zone_id_map[bbd.d_id];  // shrink trick
@@ -787,7 +973,6 @@ void Bind2Backend::loadConfig(string* status)
       }
 
     // figure out which domains were new and which vanished
-    int remdomains=0;
     set<string> oldnames, newnames;
     for(id_zone_map_t::const_iterator j=s_state->id_zone_map.begin();j != s_state->id_zone_map.end();++j) {
       oldnames.insert(j->second.d_name);
@@ -804,7 +989,7 @@ void Bind2Backend::loadConfig(string* status)
     // remove domains from the *name* map, delete their pointer
     for(vector<string>::const_iterator k=diff.begin();k!=diff.end(); ++k) {
       L<<Logger::Error<<"Removing domain: "<<*k<<endl;
-      s_state->name_id_map.erase(*k);
+      s_state->name_id_map.erase(DNSName(*k));
     }
 
     // now remove from the s_state->id_zone_map
@@ -826,17 +1011,50 @@ void Bind2Backend::loadConfig(string* status)
     set_difference(newnames.begin(), newnames.end(), oldnames.begin(), oldnames.end(), back_inserter(diff2));
     newdomains=diff2.size();
     
-    Lock l(&s_state_swap_lock);
+    // publish the new set of zones now, new zones show up as not loaded until their turn comes, changed ones keep their old records
+    Lock sl(&s_state_swap_lock);
     s_state.swap(staging); 
+  }
+  staging.reset();
+
+  rq.next=0;
+  rq.compact=mustDo("compact-records");
+  rq.logprefix=d_logprefix;
+  rq.rejected=0;
+  pthread_mutex_init(&rq.lock, 0);
+
+  unsigned int numthreads=getArgAsNum("reload-threads");
+  if(!numthreads) {
+    long cpus=sysconf(_SC_NPROCESSORS_ONLN);
+    numthreads = cpus > 0 ? cpus : 1;
+  }
+  if(numthreads > rq.jobs.size())
+    numthreads = rq.jobs.size();
+
+  vector<pthread_t> tids;
+  for(unsigned int n=1; n < numthreads; ++n) {
+    pthread_t tid;
+    if(pthread_create(&tid, 0, &reloadThread, &rq)) {
+      L<<Logger::Error<<d_logprefix<<" Unable to start zone parsing thread: "<<stringerror()<<endl;
+      break;
+    }
+    tids.push_back(tid);
+  }
+  reloadThread(&rq); // this thread joins in, and parses everything by itself if no others could be started
+  for(vector<pthread_t>::const_iterator tid=tids.begin(); tid != tids.end(); ++tid)
+    pthread_join(*tid, 0);
+  pthread_mutex_destroy(&rq.lock);
 
-    // report
-    ostringstream msg;
-    msg<<" Done parsing domains, "<<rejected<<" rejected, "<<newdomains<<" new, "<<remdomains<<" removed"; 
-    if(status)
-      *status=msg.str();
+  if(status)
+    *status+=rq.status;
 
-    L<<Logger::Error<<d_logprefix<<msg.str()<<endl;
-  }
+  // report
+  ostringstream msg;
+  msg<<" Done parsing domains, "<<rq.jobs.size()<<" parsed, "<<rq.rejected<<" rejected, "<<newdomains<<" new, "<<remdomains<<" removed"; 
+  if(status)
+    *status=msg.str();
+
+  L<<Logger::Error<<d_logprefix<<msg.str()<<endl;
 }
 
 /** nuke all records from memory, keep bbd intact though. */
@@ -844,49 +1062,24 @@ void Bind2Backend::nukeZoneRecords(BB2DomainInfo *bbd)
 {
   bbd->d_loaded=0; // block further access
   bbd->d_records = shared_ptr<recordstorage_t > (new recordstorage_t);
+  bbd->d_compact.reset();
 }
 
-
 void Bind2Backend::queueReload(BB2DomainInfo *bbd)
 {
   Lock l(&s_state_lock);
 
-  shared_ptr<State> staging(new State);
-
   // we reload *now* for the time being
 
   try {
     // nukeZoneRecords(bbd); // ? do we need this?
-    staging->id_zone_map[bbd->d_id]=s_state->id_zone_map[bbd->d_id];
-    shared_ptr<recordstorage_t > newrecords(new recordstorage_t);
-    staging->id_zone_map[bbd->d_id].d_records=newrecords;
-
-    ZoneParserTNG zpt(bbd->d_filename, bbd->d_name, s_binddirectory);
-    DNSResourceRecord rr;
-    string hashed;
+    BB2DomainInfo staged=s_state->id_zone_map[bbd->d_id];
     NSEC3PARAMRecordContent ns3pr;
     bool nsec3zone=getNSEC3PARAM(bbd->d_name, &ns3pr);
-    while(zpt.get(rr)) {
-      if(rr.qtype.getCode() == QType::NSEC || rr.qtype.getCode() == QType::NSEC3)
-        continue; // we synthesise NSECs on demand
-
-      if(nsec3zone) {
-        if(rr.qtype.getCode() != QType::NSEC3 && rr.qtype.getCode() != QType::RRSIG)
-          hashed=toLower(toBase32Hex(hashQNameWithSalt(ns3pr.d_iterations, ns3pr.d_salt, rr.qname)));
-        else
-          hashed="";
-      }
-      insert(staging, bbd->d_id, rr.qname, rr.qtype, rr.content, rr.ttl, rr.priority, hashed);
-    }
-    // cerr<<"Start sort of "<<staging->id_zone_map[bbd->d_id].d_records->size()<<" records"<<endl;        
-    // sort(staging->id_zone_map[bbd->d_id].d_records->begin(), staging->id_zone_map[bbd->d_id].d_records->end());
-    // cerr<<"Sorting done"<<endl;
-    
-    fixupAuth(staging->id_zone_map[bbd->d_id].d_records);
-    doEmptyNonTerminals(staging, bbd->d_id, nsec3zone, ns3pr);
-    staging->id_zone_map[bbd->d_id].setCtime();
+    parseZoneFile(staged, nsec3zone, ns3pr, mustDo("compact-records"));
+    staged.setCtime();
 
-    s_state->id_zone_map[bbd->d_id]=staging->id_zone_map[bbd->d_id]; // move over
+    s_state->id_zone_map[bbd->d_id]=staged; // move over
 
     bbd->setCtime();
     // and raise d_loaded again!
@@ -911,6 +1104,9 @@ bool Bind2Backend::findBeforeAndAfterUnhashed(BB2DomainInfo& bbd, const std::str
 {
   string domain=toLower(qname);
 
+  if(bbd.d_compact)
+    return findBeforeAndAfterUnhashedCompact(bbd, domain, before, after);
+
   //cout<<"starting lower bound for: '"<<domain<<"'"<<endl;
 
   recordstorage_t::const_iterator iter = bbd.d_records->upper_bound(domain);
@@ -947,6 +1143,65 @@ bool Bind2Backend::findBeforeAndAfterUnhashed(BB2DomainInfo& bbd, const std::str
   return true;
 }
 
+bool Bind2Backend::findBeforeAndAfterUnhashedCompact(BB2DomainInfo& bbd, const std::string& domain, std::string& before, std::string& after)
+{
+  const Bind2CompactRecords& records = *bbd.d_compact;
+  Bind2CompactRecords::const_iterator iter = records.upper_bound(domain);
+
+  while(iter == records.end() || strcmp(records.str(iter->qname), domain.c_str()) > 0 || (!(iter->auth) && (!(iter->qtype == QType::NS))) || (!(iter->qtype)))
+    iter--;
+
+  before=records.str(iter->qname);
+
+  iter = records.upper_bound(domain);
+  if(iter == records.end()) {
+    after.clear();
+  } else {
+    while((!(iter->auth) && (!(iter->qtype == QType::NS))) || (!(iter->qtype)))
+    {
+      iter++;
+      if(iter == records.end())
+      {
+        after.clear();
+        return true;
+      }
+    }
+    after = records.str(iter->qname);
+  }
+  return true;
+}
+
+/** the compact hash index only holds authoritative records with a hash, so no skipping is needed */
+bool Bind2Backend::getBeforeAndAfterHashedCompact(BB2DomainInfo& bbd, const std::string& lqname, std::string& unhashed, std::string& before, std::string& after)
+{
+  const Bind2CompactRecords& records = *bbd.d_compact;
+  const vector<uint32_t>& hashindex = records.hashIndex();
+
+  if(hashindex.empty()) {
+    before.clear();
+    after.clear();
+    return false;
+  }
+
+  // first entry with a hash beyond lqname
+  vector<uint32_t>::const_iterator first=hashindex.begin(), last=hashindex.end();
+  while(first != last) {
+    vector<uint32_t>::const_iterator middle = first + (last - first) / 2;
+    if(strcmp(records.str((records.begin() + *middle)->nsec3hash), lqname.c_str()) <= 0)
+      first = middle + 1;
+    else
+      last = middle;
+  }
+
+  const Bind2CompactRecords::Record& prev = *(records.begin() + (first == hashindex.begin() ? hashindex.back() : *(first - 1)));
+  before = records.str(prev.nsec3hash);
+  unhashed = dotConcat(labelReverse(records.str(prev.qname)), bbd.d_name);
+
+  const Bind2CompactRecords::Record& next = *(records.begin() + (first == hashindex.end() ? hashindex.front() : *first));
+  after = records.str(next.nsec3hash);
+  return true;
+}
+
 bool Bind2Backend::getBeforeAndAfterNamesAbsolute(uint32_t id, const std::string& qname, std::string& unhashed, std::string& before, std::string& after)
 {
   shared_ptr<State> state = s_state;
@@ -961,6 +1216,9 @@ bool Bind2Backend::getBeforeAndAfterNamesAbsolute(uint32_t id, const std::string
   }
   else {
     string lqname = toLower(qname);
+    if(bbd.d_compact)
+      return getBeforeAndAfterHashedCompact(bbd, lqname, unhashed, before, after);
+
     // cerr<<"\nin bind2backend::getBeforeAndAfterAbsolute: nsec3 HASH for "<<auth<<", asked for: "<<lqname<< " (auth: "<<auth<<".)"<<endl;
     typedef recordstorage_t::index<HashedTag>::type records_by_hashindex_t;
     records_by_hashindex_t& hashindex=boost::multi_index::get<HashedTag>(*bbd.d_records);
@@ -1030,18 +1288,22 @@ void Bind2Backend::lookup(const QType &qtype, const string &qname, DNSPacket *pk
 {
   d_handle.reset();
 
-  string domain=toLower(qname);
-
   static bool mustlog=::arg().mustDo("query-logging");
   if(mustlog) 
-    L<<Logger::Warning<<"Lookup for '"<<qtype.getName()<<"' of '"<<domain<<"'"<<endl;
+    L<<Logger::Warning<<"Lookup for '"<<qtype.getName()<<"' of '"<<qname<<"'"<<endl;
 
   shared_ptr<State> state = s_state;
 
-  name_id_map_t::const_iterator iditer;
-  do {
-    iditer=state->name_id_map.find(domain);
-  } while ((iditer == state->name_id_map.end() || (zoneId != iditer->second && zoneId != -1)) && chopOff(domain));
+  name_id_map_t::const_iterator iditer=state->name_id_map.end();
+  try {
+    DNSName name(qname);  // chopped down in place until we hit a zone we have
+    do {
+      iditer=state->name_id_map.find(name);
+    } while ((iditer == state->name_id_map.end() || (zoneId != iditer->second && zoneId != -1)) && name.chopOff());
+  }
+  catch(AhuException& ae) {
+    iditer=state->name_id_map.end();
+  }
 
   if(iditer==state->name_id_map.end()) {
     if(mustlog)
@@ -1049,6 +1311,7 @@ void Bind2Backend::lookup(const QType &qtype, const string &qname, DNSPacket *pk
     d_handle.d_list=false;
     return;
   }
+  string domain=iditer->first.isRoot() ? "" : toLower(iditer->first.toString(false));
   //  unsigned int id=*iditer;
   if(mustlog)
     L<<Logger::Warning<<"Found a zone '"<<domain<<"' (with id " << iditer->second<<") that might contain data "<<endl;
@@ -1078,6 +1341,18 @@ void Bind2Backend::lookup(const QType &qtype, const string &qname, DNSPacket *pk
     throw DBException("Zone for '"+bbd.d_name+"' in '"+bbd.d_filename+"' being reloaded"); // if we don't throw here, we crash for some reason
   }
 
+  string lname=labelReverse(toLower(d_handle.qname));
+  d_handle.mustlog = mustlog;
+  d_handle.d_list=false;
+
+  if(bbd.d_compact) {
+    d_handle.d_compact = bbd.d_compact;
+    pair<Bind2CompactRecords::const_iterator, Bind2CompactRecords::const_iterator> crange = d_handle.d_compact->equal_range(lname);
+    d_handle.d_citer=crange.first;
+    d_handle.d_cend_iter=crange.second;
+    return;
+  }
+
   d_handle.d_records = bbd.d_records; // give it a reference counted copy
   
   if(d_handle.d_records->empty())
@@ -1085,12 +1360,10 @@ void Bind2Backend::lookup(const QType &qtype, const string &qname, DNSPacket *pk
 
   pair<recordstorage_t::const_iterator, recordstorage_t::const_iterator> range;
 
-  string lname=labelReverse(toLower(d_handle.qname));
   //cout<<"starting equal range for: '"<<d_handle.qname<<"', search is for: '"<<lname<<"'"<<endl;
  
   range = d_handle.d_records->equal_range(lname);
   //cout<<"End equal range"<<endl;
-  d_handle.mustlog = mustlog;
   
   if(range.first==range.second) {
     // cerr<<"Found nothing!"<<endl;
@@ -1114,7 +1387,7 @@ Bind2Backend::handle::handle()
 
 bool Bind2Backend::get(DNSResourceRecord &r)
 {
-  if(!d_handle.d_records) {
+  if(!d_handle.d_records && !d_handle.d_compact) {
     if(d_handle.mustlog)
       L<<Logger::Warning<<"There were no answers"<<endl;
     return false;
@@ -1144,6 +1417,7 @@ bool Bind2Backend::handle::get(DNSResourceRecord &r)
 void Bind2Backend::handle::reset()
 {
   d_records.reset();
+  d_compact.reset();
   qname.clear();
   mustlog=false;
 }
@@ -1151,6 +1425,24 @@ void Bind2Backend::handle::reset()
 //#define DLOG(x) x
 bool Bind2Backend::handle::get_normal(DNSResourceRecord &r)
 {
+  if(d_compact) {
+    while(d_citer!=d_cend_iter && !(qtype.getCode()==QType::ANY || d_citer->qtype==qtype.getCode()))
+      d_citer++;
+    if(d_citer==d_cend_iter)
+      return false;
+
+    r.qname=qname.empty() ? domain : (qname+"."+domain);
+    r.domain_id=id;
+    r.content=d_compact->str(d_citer->content);
+    r.qtype=d_citer->qtype;
+    r.ttl=d_citer->ttl;
+    r.priority=d_citer->priority;
+    r.setWireContent(d_compact->wire(d_citer->wirecontent));
+    r.auth=d_citer->auth;
+    d_citer++;
+    return true;
+  }
+
   DLOG(L << "Bind2Backend get() was called for "<<qtype.getName() << " record for '"<<
        qname<<"' - "<<d_records->size()<<" available in total!"<<endl);
   
@@ -1174,6 +1466,7 @@ bool Bind2Backend::handle::get_normal(DNSResourceRecord &r)
   r.qtype=(d_iter)->qtype;
   r.ttl=(d_iter)->ttl;
   r.priority=(d_iter)->priority;
+  r.setWireContent((d_iter)->wirecontent);
 
   //if(!d_iter->auth && r.qtype.getCode() != QType::A && r.qtype.getCode()!=QType::AAAA && r.qtype.getCode() != QType::NS)
   //  cerr<<"Warning! Unauth response for qtype "<< r.qtype.getName() << " for '"<<r.qname<<"'"<<endl;
@@ -1194,6 +1487,11 @@ bool Bind2Backend::list(const string &target, int id)
   DLOG(L<<"Bind2Backend constructing handle for list of "<<id<<endl);
 
   d_handle.d_records=state->id_zone_map[id].d_records; // give it a copy, which will stay around
+  d_handle.d_compact=state->id_zone_map[id].d_compact;
+  if(d_handle.d_compact) {
+    d_handle.d_citer=d_handle.d_compact->begin();
+    d_handle.d_cend_iter=d_handle.d_compact->end();
+  }
   d_handle.d_qname_iter= d_handle.d_records->begin();
   d_handle.d_qname_end=d_handle.d_records->end();   // iter now points to a vector of pointers to vector<BBResourceRecords>
 
@@ -1205,6 +1503,22 @@ bool Bind2Backend::list(const string &target, int id)
 
 bool Bind2Backend::handle::get_list(DNSResourceRecord &r)
 {
+  if(d_compact) {
+    if(d_citer==d_cend_iter)
+      return false;
+    const char* cqname=d_compact->str(d_citer->qname);
+    r.qname=*cqname ? (labelReverse(cqname)+"."+domain) : domain;
+    r.domain_id=id;
+    r.content=d_compact->str(d_citer->content);
+    r.qtype=d_citer->qtype;
+    r.ttl=d_citer->ttl;
+    r.priority=d_citer->priority;
+    r.setWireContent(d_compact->wire(d_citer->wirecontent));
+    r.auth=d_citer->auth;
+    d_citer++;
+    return true;
+  }
+
   if(d_qname_iter!=d_qname_end) {
     r.qname=d_qname_iter->qname.empty() ? domain : (labelReverse(d_qname_iter->qname)+"."+domain);
     r.domain_id=id;
@@ -1212,6 +1526,7 @@ bool Bind2Backend::handle::get_list(DNSResourceRecord &r)
     r.qtype=(d_qname_iter)->qtype;
     r.ttl=(d_qname_iter)->ttl;
     r.priority=(d_qname_iter)->priority;
+    r.setWireContent((d_qname_iter)->wirecontent);
     r.auth = d_qname_iter->auth;
     d_qname_iter++;
     return true;
@@ -1312,7 +1627,7 @@ bool Bind2Backend::createSlaveDomain(const string &ip, const string &domain, con
   bbd.d_masters.push_back(ip);
   bbd.d_filename = filename;
 
-  s_state->name_id_map[domain] = bbd.d_id;
+  s_state->name_id_map[DNSName(domain)] = bbd.d_id;
   
   return true;
 }
@@ -1331,6 +1646,8 @@ class Bind2Factory : public BackendFactory
          declare(suffix,"supermasters","List of IP-addresses of supermasters","");
          declare(suffix,"supermaster-destdir","Destination directory for newly added slave zones",::arg()["config-dir"]);
          declare(suffix,"dnssec-db","Filename to store & access our DNSSEC metadatabase, empty for none", "");
+         declare(suffix,"reload-threads","Number of threads that parse zones on startup and rediscover, 0 for one per CPU","0");
+         declare(suffix,"compact-records","Store zones in a compact read-only format that uses a lot less memory","no");
       }
 
       DNSBackend *make(const string &suffix="")
@@ -34,6 +34,7 @@
 #include <unistd.h>
 #include "misc.hh"
 #include "dnsbackend.hh"
+#include "dnsname.hh"
 
 #include "namespaces.hh"
 using namespace ::boost::multi_index;
@@ -45,6 +46,7 @@ struct Bind2DNSRecord
 {
   string qname;
   string content;
+  string wirecontent; //!< content as uncompressed rdata, see makeWireContent(). Made at zone load, which makes loads slower and costs a string per record
   string nsec3hash;
   uint32_t ttl;
   uint16_t qtype;
@@ -86,6 +88,62 @@ typedef multi_index_container<
               >
 > recordstorage_t;
 
+/** Read-only alternative to recordstorage_t, used when bind-compact-records is set. All records of a zone live in one
+    vector, in the same order as in recordstorage_t, so lookups are a binary search over contiguous memory. Names, contents and
+    NSEC3 hashes are stored only once per zone, in a pool of zero terminated strings, and records refer to them by offset.
+    This typically needs a fraction of the memory of recordstorage_t, which spends several allocations on every record. */
+class Bind2CompactRecords : public boost::noncopyable
+{
+public:
+  struct Record
+  {
+    uint32_t qname;     //!< offset in the string pool
+    uint32_t content;   //!< offset in the string pool
+    uint32_t wirecontent; //!< offset in the string pool, of a length prefixed string as rdata may contain zeroes
+    uint32_t nsec3hash; //!< offset in the string pool
+    uint32_t ttl;
+    uint16_t qtype;
+    uint16_t priority;
+    bool auth;
+  };
+  typedef vector<Record>::const_iterator const_iterator;
+
+  explicit Bind2CompactRecords(const recordstorage_t& records);
+
+  const_iterator begin() const { return d_records.begin(); }
+  const_iterator end() const { return d_records.end(); }
+  bool empty() const { return d_records.empty(); }
+  size_t size() const { return d_records.size(); }
+
+  //! qname is label reversed and relative to the zone, like Bind2DNSRecord::qname
+  pair<const_iterator, const_iterator> equal_range(const string& qname) const;
+  const_iterator upper_bound(const string& qname) const;
+
+  const char* str(uint32_t offset) const
+  {
+    return &d_pool[offset];
+  }
+
+  string wire(uint32_t offset) const
+  {
+    return string(&d_pool[offset + 2], ((unsigned char)d_pool[offset] << 8) | (unsigned char)d_pool[offset + 1]);
+  }
+
+  //! positions of the authoritative records that have an NSEC3 hash, ordered by that hash
+  const vector<uint32_t>& hashIndex() const
+  {
+    return d_hashindex;
+  }
+
+private:
+  uint32_t intern(map<string, uint32_t>& offsets, const string& str);
+  uint32_t internWire(map<string, uint32_t>& offsets, const string& wire);
+
+  vector<Record> d_records;
+  vector<char> d_pool;
+  vector<uint32_t> d_hashindex;
+};
+
 /** Class which describes all metadata of a domain for storage by the Bind2Backend, and also contains a pointer to a vector of Bind2DNSRecord's */
 class BB2DomainInfo
 {
@@ -110,6 +168,7 @@ public:
   uint32_t d_lastnotified; //!< Last serial number we notified our slaves of
 
   shared_ptr<recordstorage_t > d_records;  //!< the actual records belonging to this domain
+  shared_ptr<Bind2CompactRecords> d_compact; //!< if set, holds the records instead of d_records (which is then empty)
 private:
   time_t getCtime();
   time_t d_checkinterval;
@@ -161,7 +220,7 @@ public:
   // end of DNSSEC 
 
 
-  typedef map<string, int, CIStringCompare> name_id_map_t;
+  typedef map<DNSName, int> name_id_map_t;
   typedef map<uint32_t, BB2DomainInfo> id_zone_map_t;
 
   struct State : public boost::noncopyable
@@ -170,7 +229,7 @@ public:
     id_zone_map_t id_zone_map;
   };
 
-  static void insert(shared_ptr<State> stage, int id, const string &qname, const QType &qtype, const string &content, int ttl=300, int prio=25, const std::string& hashed=string());  
+  static void insert(BB2DomainInfo& bb2, const string &qname, const QType &qtype, const string &content, int ttl=300, int prio=25, const std::string& hashed=string());  
   void rediscover(string *status=0);
 
   bool isMaster(const string &name, const string &ip);
@@ -197,6 +256,9 @@ private:
     recordstorage_t::const_iterator d_qname_iter;
     recordstorage_t::const_iterator d_qname_end;
 
+    shared_ptr<Bind2CompactRecords> d_compact;
+    Bind2CompactRecords::const_iterator d_citer, d_cend_iter;
+
     bool d_list;
     int id;
 
@@ -233,12 +295,20 @@ private:
 
   void queueReload(BB2DomainInfo *bbd);
   bool findBeforeAndAfterUnhashed(BB2DomainInfo& bbd, const std::string& qname, std::string& unhashed, std::string& before, std::string& after);
+  bool findBeforeAndAfterUnhashedCompact(BB2DomainInfo& bbd, const std::string& qname, std::string& before, std::string& after);
+  bool getBeforeAndAfterHashedCompact(BB2DomainInfo& bbd, const std::string& lqname, std::string& unhashed, std::string& before, std::string& after);
   void reload();
   static string DLDomStatusHandler(const vector<string>&parts, Utility::pid_t ppid);
   static string DLListRejectsHandler(const vector<string>&parts, Utility::pid_t ppid);
   static string DLReloadNowHandler(const vector<string>&parts, Utility::pid_t ppid);
   static void fixupAuth(shared_ptr<recordstorage_t> records);
-  static void doEmptyNonTerminals(shared_ptr<State> stage, int id, bool nsec3zone, NSEC3PARAMRecordContent ns3pr);
+  static void doEmptyNonTerminals(BB2DomainInfo& bb2, bool nsec3zone, NSEC3PARAMRecordContent ns3pr);
+  static void parseZoneFile(BB2DomainInfo& bbd, bool nsec3zone, const NSEC3PARAMRecordContent& ns3pr, bool compact);
   void loadConfig(string *status=0);
+
+  struct ReloadQueue;
+  static void* reloadThread(void* p);
+  static void reloadZone(ReloadQueue* rq, unsigned int n);
+  static pthread_mutex_t s_reload_lock;              //!< only one loadConfig() at a time
   static void nukeZoneRecords(BB2DomainInfo *bbd);
 };
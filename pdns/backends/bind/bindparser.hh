@@ -28,7 +28,7 @@
 class BindDomainInfo 
 {
 public:
-  BindDomainInfo() : d_dev(0), d_ino(0)
+  BindDomainInfo() : d_dev(0), d_ino(0), d_ctime(0)
   {}
 
   void clear() 
@@ -38,6 +38,7 @@ public:
     alsoNotify.clear();
     d_dev=0;
     d_ino=0;
+    d_ctime=0;
   }
   string name;
   string viewName;
@@ -48,6 +49,7 @@ public:
     
   dev_t d_dev;
   ino_t d_ino;
+  time_t d_ctime; //!< ctime of the zone file, 0 if it could not be stat'ed
 
   bool operator<(const BindDomainInfo& b) const
   {
@@ -23,6 +23,7 @@
 #include <map>
 
 #include <iostream>
+#include <sstream>
 #include <stdio.h>
 #include "namespaces.hh"
 
@@ -48,6 +49,10 @@ enum dbmode_t {MYSQL, ORACLE, POSTGRES, SQLITE, MYDNS};
 static dbmode_t g_mode;
 static bool g_intransaction;
 static int g_numRecords;
+static int g_batchSize;
+static string g_batchColumns;
+static string g_batchRows;
+static int g_numBatchRows;
 
 static string sqlstr(const string &name)
 {
@@ -70,8 +75,32 @@ static string sqlstr(const string &name)
     return "'"+a+"'";
 }
 
+/** writes out the records that were batched up by emitRecord() as one insert. Each row selects the id of its domain, like
+    the one insert per record output does, so a zone without a domains row inserts nothing */
+static void flushRecords()
+{
+  if(!g_numBatchRows)
+    return;
+  cout<<"insert into records ("<<g_batchColumns<<")\n  "<<g_batchRows<<";\n";
+  g_batchRows.clear();
+  g_numBatchRows=0;
+}
+
+static void batchRecord(const string& columns, const string& row)
+{
+  if(g_numBatchRows && columns != g_batchColumns)
+    flushRecords();
+  g_batchColumns=columns;
+  if(g_numBatchRows++)
+    g_batchRows.append("\nunion all\n  ");
+  g_batchRows.append(row);
+  if(g_numBatchRows >= g_batchSize)
+    flushRecords();
+}
+
 static void startNewTransaction()
 {
+  flushRecords();
   if(!::arg().mustDo("transactions"))
     return;
    
@@ -113,7 +142,31 @@ static void emitRecord(const string& zoneName, const string &qname, const string
     auth=false;
   }
 
-  if(g_mode==MYSQL || g_mode==SQLITE) {
+  if(g_batchSize > 1 && (g_mode==MYSQL || g_mode==SQLITE || g_mode==POSTGRES)) {
+    ostringstream row;
+    string domain=" from domains where name="+toLower(sqlstr(zoneName));
+    if(!g_doDNSSEC) {
+      row<<"select id, "<<
+        sqlstr(toLower(stripDot(qname)))<<", "<<
+        sqlstr(qtype)<<", "<<
+        sqlstr(stripDot(content))<<", "<<ttl<<", "<<prio<<domain;
+      batchRecord("domain_id, name,type,content,ttl,prio", row.str());
+    } else
+    {
+      row<<"select id, "<<
+        sqlstr(toLower(stripDot(qname)))<<", "<<
+        sqlstr(toLower(labelReverse(makeRelative(stripDot(qname), zoneName))))<<", ";
+      if(g_mode==POSTGRES)
+        row<<"'"<< (auth  ? 't' : 'f') <<"'";
+      else
+        row<<auth;
+      row<<", "<<
+        sqlstr(qtype)<<", "<<
+        sqlstr(stripDot(content))<<", "<<ttl<<", "<<prio<<domain;
+      batchRecord("domain_id, name, ordername, auth, type,content,ttl,prio", row.str());
+    }
+  }
+  else if(g_mode==MYSQL || g_mode==SQLITE) {
     if(!g_doDNSSEC) {
       cout<<"insert into records (domain_id, name,type,content,ttl,prio) select id ,"<<
         sqlstr(toLower(stripDot(qname)))<<", "<<
@@ -214,6 +267,7 @@ int main(int argc, char **argv)
     ::arg().setSwitch("slave","Keep BIND slaves as slaves")="no";
     ::arg().setSwitch("transactions","If target SQL supports it, use transactions")="no";
     ::arg().setSwitch("on-error-resume-next","Continue after errors")="no";
+    ::arg().set("batch-size","Number of records per insert statement, for gmysql, gpgsql and gsqlite (at most 500)")="1";
     ::arg().set("zone","Zonefile to parse")="";
     ::arg().set("zone-name","Specify an $ORIGIN in case it is not present")="";
     ::arg().set("named-conf","Bind 8/9 named.conf to parse")="";
@@ -259,6 +313,9 @@ int main(int argc, char **argv)
     }
 
     g_doDNSSEC=::arg().mustDo("dnssec");
+    g_batchSize=::arg().asNum("batch-size");
+    if(g_batchSize > 500)
+      g_batchSize=500; // SQLite does not take more than 500 selects joined by union all
       
     namedfile=::arg()["named-conf"];
     zonefile=::arg()["zone"];
@@ -327,6 +384,7 @@ int main(int argc, char **argv)
             DNSResourceRecord rr;
             while(zpt.get(rr)) 
               emitRecord(i->name, rr.qname, rr.qtype.getName(), rr.content, rr.ttl, rr.priority);
+            flushRecords();
             num_domainsdone++;
           }
           catch(std::exception &ae) {
@@ -354,6 +412,7 @@ int main(int argc, char **argv)
       startNewTransaction();
       while(zpt.get(rr)) 
         emitRecord(::arg()["zone-name"], rr.qname, rr.qtype.getName(), rr.content, rr.ttl, rr.priority);
+      flushRecords();
       num_domainsdone=1;
     }
     cerr<<num_domainsdone<<" domains were fully parsed, containing "<<g_numRecords<<" records\n";
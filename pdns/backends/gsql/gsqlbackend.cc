@@ -239,10 +239,46 @@ string GSQLBackend::sqlEscape(const string &name)
 }
 
 
+/** Splits an 'insert into ... values (...)' query into the part up to and including 'values', and the
+    parenthesised row, so several rows can be sent in one statement. Returns false for other queries */
+static bool splitInsertQuery(const string& query, string& prefix, string& row)
+{
+  string lc=toLower(query);
+  string::size_type pos=lc.rfind("values");
+  if(pos==string::npos || (pos && (isalnum(lc[pos-1]) || lc[pos-1]=='_')))
+    return false;
+
+  string::size_type start=lc.find_first_not_of(" \t\n", pos+6);
+  string::size_type end=lc.find_last_not_of(" \t\n;");
+  if(start==string::npos || lc[start]!='(' || lc[end]!=')')
+    return false;
+
+  // the parenthesis we start with must be the one that closes at the end
+  int depth=0;
+  bool quoted=false;
+  for(string::size_type n=start; n <= end; ++n) {
+    if(lc[n]=='\'')
+      quoted=!quoted;
+    else if(!quoted && lc[n]=='(')
+      depth++;
+    else if(!quoted && lc[n]==')' && !--depth && n!=end)
+      return false;
+  }
+  if(depth || quoted)
+    return false;
+
+  prefix=query.substr(0, start);
+  row=query.substr(start, end-start+1);
+  return true;
+}
+
 GSQLBackend::GSQLBackend(const string &mode, const string &suffix)
 {
   setArgPrefix(mode+suffix);
   d_db=0;
+  d_activeStmt=0;
+  d_inTransaction=false;
+  d_numPendingInserts=0;
   d_logprefix="["+mode+"Backend"+suffix+"] ";
 	
   try
@@ -273,6 +309,18 @@ GSQLBackend::GSQLBackend(const string &mode, const string &suffix)
   d_SuperMasterInfoQuery=getArg("supermaster-query");
   d_InsertSlaveZoneQuery=getArg("insert-slave-query");
   d_InsertRecordQuery=getArg("insert-record-query"+authswitch);
+  try
+  {
+    d_insertBatchSize = max(getArgAsNum("insert-batch-size"), 1);
+  }
+  catch (ArgException e)
+  {
+    d_insertBatchSize = 1;
+  }
+  if(d_insertBatchSize > 1 && !splitInsertQuery(d_InsertRecordQuery, d_InsertRecordPrefix, d_InsertRecordRow)) {
+    L<<Logger::Warning<<d_logprefix<<"insert-record-query is not of the form 'insert ... values (...)', not batching inserts"<<endl;
+    d_insertBatchSize = 1;
+  }
   d_UpdateSerialOfZoneQuery=getArg("update-serial-query");
   d_UpdateLastCheckofZoneQuery=getArg("update-lastcheck-query");
   d_ZoneLastChangeQuery=getArg("zone-lastchange-query");
@@ -321,13 +369,17 @@ bool GSQLBackend::updateDNSSECOrderAndAuth(uint32_t domain_id, const std::string
 
 bool GSQLBackend::updateDNSSECOrderAndAuthAbsolute(uint32_t domain_id, const std::string& qname, const std::string& ordername, bool auth)
 {
+  flushInserts();
   if(!d_dnssecQueries)
     return false;
-  char output[1024];
-
-  snprintf(output, sizeof(output)-1, d_setOrderAuthQuery.c_str(), sqlEscape(ordername).c_str(), auth, sqlEscape(qname).c_str(), domain_id);
   try {
-    d_db->doCommand(output);
+    if(SSqlStatement* stmt=getStatement(d_setOrderAuthQuery))
+      stmt->bind(ordername)->bind((long)auth)->bind(qname)->bind((long)domain_id)->execute();
+    else {
+      char output[1024];
+      snprintf(output, sizeof(output)-1, d_setOrderAuthQuery.c_str(), sqlEscape(ordername).c_str(), auth, sqlEscape(qname).c_str(), domain_id);
+      d_db->doCommand(output);
+    }
   }
   catch(SSqlException &e) {
     throw AhuException("GSQLBackend unable to update ordername/auth for domain_id "+itoa(domain_id)+": "+e.txtReason());
@@ -337,13 +389,17 @@ bool GSQLBackend::updateDNSSECOrderAndAuthAbsolute(uint32_t domain_id, const std
 
 bool GSQLBackend::nullifyDNSSECOrderNameAndUpdateAuth(uint32_t domain_id, const std::string& qname, bool auth)
 {
+  flushInserts();
   if(!d_dnssecQueries)
     return false;
-  char output[1024];
-
-  snprintf(output, sizeof(output)-1, d_nullifyOrderNameAndUpdateAuthQuery.c_str(), auth, domain_id, sqlEscape(qname).c_str());
   try {
-    d_db->doCommand(output);
+    if(SSqlStatement* stmt=getStatement(d_nullifyOrderNameAndUpdateAuthQuery))
+      stmt->bind((long)auth)->bind((long)domain_id)->bind(qname)->execute();
+    else {
+      char output[1024];
+      snprintf(output, sizeof(output)-1, d_nullifyOrderNameAndUpdateAuthQuery.c_str(), auth, domain_id, sqlEscape(qname).c_str());
+      d_db->doCommand(output);
+    }
   }
   catch(SSqlException &e) {
     throw AhuException("GSQLBackend unable to nullify ordername and update auth for domain_id "+itoa(domain_id)+": "+e.txtReason());
@@ -353,13 +409,17 @@ bool GSQLBackend::nullifyDNSSECOrderNameAndUpdateAuth(uint32_t domain_id, const
 
 bool GSQLBackend::nullifyDNSSECOrderNameAndAuth(uint32_t domain_id, const std::string& qname, const std::string& type)
 {
+  flushInserts();
   if(!d_dnssecQueries)
     return false;
-  char output[1024];
-
-  snprintf(output, sizeof(output)-1, d_nullifyOrderNameAndAuthQuery.c_str(), sqlEscape(qname).c_str(), sqlEscape(type).c_str(), domain_id);
   try {
-    d_db->doCommand(output);
+    if(SSqlStatement* stmt=getStatement(d_nullifyOrderNameAndAuthQuery))
+      stmt->bind(qname)->bind(type)->bind((long)domain_id)->execute();
+    else {
+      char output[1024];
+      snprintf(output, sizeof(output)-1, d_nullifyOrderNameAndAuthQuery.c_str(), sqlEscape(qname).c_str(), sqlEscape(type).c_str(), domain_id);
+      d_db->doCommand(output);
+    }
   }
   catch(SSqlException &e) {
     throw AhuException("GSQLBackend unable to nullify ordername/auth for domain_id "+itoa(domain_id)+": "+e.txtReason());
@@ -369,6 +429,7 @@ bool GSQLBackend::nullifyDNSSECOrderNameAndAuth(uint32_t domain_id, const std::s
 
 bool GSQLBackend::setDNSSECAuthOnDsRecord(uint32_t domain_id, const std::string& qname)
 {
+  flushInserts();
   if(!d_dnssecQueries)
     return false;
   char output[1024];
@@ -385,6 +446,7 @@ bool GSQLBackend::setDNSSECAuthOnDsRecord(uint32_t domain_id, const std::string&
 
 bool GSQLBackend::updateEmptyNonTerminals(uint32_t domain_id, const std::string& zonename, set<string>& insert, set<string>& erase, bool remove)
 {
+  flushInserts();
   char output[1024];
 
   if(remove) {
@@ -432,6 +494,7 @@ bool GSQLBackend::doesDNSSEC()
 
 bool GSQLBackend::getBeforeAndAfterNamesAbsolute(uint32_t id, const std::string& qname, std::string& unhashed, std::string& before, std::string& after)
 {
+  flushInserts();
   if(!d_dnssecQueries)
     return false;
   // cerr<<"gsql before/after called for id="<<id<<", qname='"<<qname<<"'"<<endl;
@@ -439,47 +502,57 @@ bool GSQLBackend::getBeforeAndAfterNamesAbsolute(uint32_t id, const std::string&
   string lcqname=toLower(qname);
   
   SSql::row_t row;
+  SSqlStatement *stmt;
 
   char output[1024];
 
-  snprintf(output, sizeof(output)-1, d_afterOrderQuery.c_str(), sqlEscape(lcqname).c_str(), id);
-  
   try {
-    d_db->doQuery(output);
+    if((stmt=getStatement(d_afterOrderQuery)))
+      stmt->bind(lcqname)->bind((long)id)->execute();
+    else {
+      snprintf(output, sizeof(output)-1, d_afterOrderQuery.c_str(), sqlEscape(lcqname).c_str(), id);
+      d_db->doQuery(output);
+    }
+    while(stmt ? stmt->getRow(row) : d_db->getRow(row)) {
+      after=row[0];
+    }
   }
   catch(SSqlException &e) {
     throw AhuException("GSQLBackend unable to find before/after (after) for domain_id "+itoa(id)+": "+e.txtReason());
   }
 
-  while(d_db->getRow(row)) {
-    after=row[0];
-  }
-
   if(after.empty() && !lcqname.empty()) {
-    snprintf(output, sizeof(output)-1, d_firstOrderQuery.c_str(), id);
-  
     try {
-      d_db->doQuery(output);
+      if((stmt=getStatement(d_firstOrderQuery)))
+        stmt->bind((long)id)->execute();
+      else {
+        snprintf(output, sizeof(output)-1, d_firstOrderQuery.c_str(), id);
+        d_db->doQuery(output);
+      }
+      while(stmt ? stmt->getRow(row) : d_db->getRow(row)) {
+        after=row[0];
+      }
     }
     catch(SSqlException &e) {
       throw AhuException("GSQLBackend unable to find before/after (first) for domain_id "+itoa(id)+": "+e.txtReason());
     }
-    while(d_db->getRow(row)) {
-      after=row[0];
-    }
   }
 
-  snprintf(output, sizeof(output)-1, d_beforeOrderQuery.c_str(), sqlEscape(lcqname).c_str(), id);
   try {
-    d_db->doQuery(output);
+    if((stmt=getStatement(d_beforeOrderQuery)))
+      stmt->bind(lcqname)->bind((long)id)->execute();
+    else {
+      snprintf(output, sizeof(output)-1, d_beforeOrderQuery.c_str(), sqlEscape(lcqname).c_str(), id);
+      d_db->doQuery(output);
+    }
+    while(stmt ? stmt->getRow(row) : d_db->getRow(row)) {
+      before=row[0];
+      unhashed=row[1];
+    }
   }
   catch(SSqlException &e) {
     throw AhuException("GSQLBackend unable to find before/after (before) for domain_id "+itoa(id)+": "+e.txtReason());
   }
-  while(d_db->getRow(row)) {
-    before=row[0];
-    unhashed=row[1];
-  }
   
   if(! unhashed.empty())
   {
@@ -487,17 +560,21 @@ bool GSQLBackend::getBeforeAndAfterNamesAbsolute(uint32_t id, const std::string&
     return true;
   }
 
-  snprintf(output, sizeof(output)-1, d_lastOrderQuery.c_str(), id);
   try {
-    d_db->doQuery(output);
+    if((stmt=getStatement(d_lastOrderQuery)))
+      stmt->bind((long)id)->execute();
+    else {
+      snprintf(output, sizeof(output)-1, d_lastOrderQuery.c_str(), id);
+      d_db->doQuery(output);
+    }
+    while(stmt ? stmt->getRow(row) : d_db->getRow(row)) {
+      before=row[0];
+      unhashed=row[1];
+    }
   }
   catch(SSqlException &e) {
     throw AhuException("GSQLBackend unable to find before/after (last) for domain_id "+itoa(id)+": "+e.txtReason());
   }
-  while(d_db->getRow(row)) {
-    before=row[0];
-    unhashed=row[1];
-  }
 
   return true;
 }
@@ -682,59 +759,138 @@ bool GSQLBackend::setDomainMetadata(const string& name, const std::string& kind,
 }
 
 
-void GSQLBackend::lookup(const QType &qtype,const string &qname, DNSPacket *pkt_p, int domain_id)
+/** Turns one of our printf style query templates into a query with a ? for every parameter, so it can be
+    prepared. A literal that holds nothing but a conversion ('%s', '%d', or PostgreSQL's E'%s') becomes a
+    placeholder, as does a bare %d. Returns false for templates that do anything else with their parameters,
+    those keep being sent as text. */
+static bool templateToPrepared(const string& format, string& query, int& nparams)
 {
-  string format;
-  char output[1024];
-
-  d_db->setLog(::arg().mustDo("query-logging"));
+  query.clear();
+  nparams=0;
+  bool quoted=false;
+  for(string::size_type pos=0; pos < format.size(); ++pos) {
+    char c=format[pos];
+    if(c=='\'') {
+      if(!quoted && (!format.compare(pos, 4, "'%s'") || !format.compare(pos, 4, "'%d'"))) {
+        string::size_type len=query.size();
+        if(len && (query[len-1]=='E' || query[len-1]=='e') && (len==1 || !(isalnum(query[len-2]) || query[len-2]=='_')))
+          query.resize(len-1);
+        query+='?';
+        nparams++;
+        pos+=3;
+        continue;
+      }
+      quoted=!quoted;
+      query+=c;
+    }
+    else if(c=='%') {
+      if(!format.compare(pos, 2, "%%")) {
+        query+='%';
+        ++pos;
+      }
+      else if(!quoted && !format.compare(pos, 2, "%d")) {
+        query+='?';
+        nparams++;
+        ++pos;
+      }
+      else
+        return false;
+    }
+    else if(c=='?' && !quoted) // would be mistaken for a placeholder
+      return false;
+    else
+      query+=c;
+  }
+  return !quoted;
+}
 
-  string lcqname=toLower(qname);
-  
-  // lcqname=labelReverse(makeRelative(lcqname, "net"));
+//! returns the prepared statement for this query template, or 0 if it has to be sent as text
+SSqlStatement* GSQLBackend::getStatement(const string &format)
+{
+  statements_t::const_iterator i=d_statements.find(&format);
+  if(i!=d_statements.end())
+    return i->second;
+
+  SSqlStatement* stmt=0;
+  string query;
+  int nparams;
+  if(templateToPrepared(format, query, nparams)) {
+    try {
+      stmt=d_db->prepare(query, nparams);
+    }
+    catch(SSqlException &e) {
+      L<<Logger::Warning<<d_logprefix<<"Unable to prepare query, sending it as text instead: "<<e.txtReason()<<endl;
+    }
+  }
+  d_statements[&format]=stmt;
+  return stmt;
+}
 
+const string& GSQLBackend::lookupFormat(const QType &qtype, const string &qname, int domain_id) const
+{
+  bool wildcard=qname[0]=='%';
   if(qtype.getCode()!=QType::ANY) {
     // qtype qname domain_id
-    if(domain_id<0) {
-      if(qname[0]=='%')
-        format=d_wildCardNoIDQuery;
-      else
-        format=d_noWildCardNoIDQuery;
+    if(domain_id<0)
+      return wildcard ? d_wildCardNoIDQuery : d_noWildCardNoIDQuery;
+    return wildcard ? d_wildCardIDQuery : d_noWildCardIDQuery;
+  }
+  // qtype==ANY
+  // qname domain_id
+  if(domain_id<0)
+    return wildcard ? d_wildCardANYNoIDQuery : d_noWildCardANYNoIDQuery;
+  return wildcard ? d_wildCardANYIDQuery : d_noWildCardANYIDQuery;
+}
+
+string GSQLBackend::makeLookupQuery(const QType &qtype, const string &qname, int domain_id)
+{
+  const string& format=lookupFormat(qtype, qname, domain_id);
+  char output[1024];
 
+  string lcqname=toLower(qname);
+  
+  if(qtype.getCode()!=QType::ANY) {
+    if(domain_id<0)
       snprintf(output,sizeof(output)-1, format.c_str(),sqlEscape(qtype.getName()).c_str(), sqlEscape(lcqname).c_str());
-    }
-    else {
-      if(qname[0]!='%')
-        format=d_noWildCardIDQuery;
-      else
-        format=d_wildCardIDQuery;
+    else
       snprintf(output,sizeof(output)-1, format.c_str(),sqlEscape(qtype.getName()).c_str(),sqlEscape(lcqname).c_str(),domain_id);
-    }
   }
   else {
-    // qtype==ANY
-    // qname domain_id
-    if(domain_id<0) {
-      if(qname[0]=='%')
-        format=d_wildCardANYNoIDQuery;
-      else
-        format=d_noWildCardANYNoIDQuery;
-
+    if(domain_id<0)
       snprintf(output,sizeof(output)-1, format.c_str(),sqlEscape(lcqname).c_str());
-    }
-    else {
-      if(qname[0]!='%')
-        format=d_noWildCardANYIDQuery;
-      else
-        format=d_wildCardANYIDQuery;
+    else
       snprintf(output,sizeof(output)-1, format.c_str(),sqlEscape(lcqname).c_str(),domain_id);
-    }
   }
+  return output;
+}
+
+//! runs the lookup through its prepared statement and returns that, or returns 0 if the lookup has to be sent as text
+SSqlStatement* GSQLBackend::executeLookup(const QType &qtype, const string &qname, int domain_id)
+{
+  SSqlStatement* stmt=getStatement(lookupFormat(qtype, qname, domain_id));
+  if(stmt) {
+    if(qtype.getCode()!=QType::ANY)
+      stmt->bind(qtype.getName());
+    stmt->bind(toLower(qname));
+    if(domain_id>=0)
+      stmt->bind((long)domain_id);
+    stmt->execute();
+  }
+  return stmt;
+}
+
+void GSQLBackend::lookup(const QType &qtype,const string &qname, DNSPacket *pkt_p, int domain_id)
+{
+  flushInserts();
+  d_db->setLog(::arg().mustDo("query-logging"));
 
   try {
-    d_db->doQuery(output);
+    d_activeStmt=executeLookup(qtype, qname, domain_id);
+    if(!d_activeStmt)
+      d_db->doQuery(makeLookupQuery(qtype, qname, domain_id));
   }
   catch(SSqlException &e) {
+    d_activeStmt=0;
     throw AhuException(e.txtReason());
   }
 
@@ -743,16 +899,94 @@ void GSQLBackend::lookup(const QType &qtype,const string &qname, DNSPacket *pkt_
   d_qtype=qtype;
   d_count=0;
 }
+
+/* Nothing goes to the database before harvestLookup() is called, so this is not asynchronous, the calling thread still waits
+   for the answers. What it saves is round trips: lookups that can't be prepared are all sent in one doQueries() batch */
+void GSQLBackend::submitLookup(const QType &qtype, const string &qname, DNSPacket *pkt_p, int domain_id)
+{
+  PendingLookup pl;
+  pl.qtype=qtype;
+  pl.qname=qname;
+  pl.domain_id=domain_id;
+  d_pendingLookups.push_back(pl);
+  d_pendingQnames.push_back(qname);
+}
+
+bool GSQLBackend::harvestLookup(vector<DNSResourceRecord>& rrs)
+{
+  flushInserts();
+  rrs.clear();
+  if(d_pendingResults.empty()) {
+    if(d_pendingLookups.empty())
+      return false;
+
+    d_db->setLog(::arg().mustDo("query-logging"));
+    vector<SSql::result_t> results(d_pendingLookups.size());
+    vector<string> queries;                // the lookups without a prepared statement
+    vector<vector<string>::size_type> ids; // and which of results each of those goes to
+    try {
+      for(vector<PendingLookup>::size_type n=0; n < d_pendingLookups.size(); ++n) {
+        const PendingLookup& pl=d_pendingLookups[n];
+        if(SSqlStatement* stmt=executeLookup(pl.qtype, pl.qname, pl.domain_id)) {
+          SSql::row_t row;
+          while(stmt->getRow(row))
+            results[n].push_back(row);
+        }
+        else {
+          queries.push_back(makeLookupQuery(pl.qtype, pl.qname, pl.domain_id));
+          ids.push_back(n);
+        }
+      }
+      if(!queries.empty()) {
+        vector<SSql::result_t> batch;
+        d_db->doQueries(queries, batch);
+        for(vector<string>::size_type n=0; n < ids.size(); ++n)
+          results[ids[n]].swap(batch[n]);
+      }
+    }
+    catch(SSqlException &e) {
+      discardLookups();
+      throw AhuException(e.txtReason());
+    }
+    d_pendingLookups.clear();
+    d_pendingResults.insert(d_pendingResults.end(), results.begin(), results.end());
+  }
+
+  const SSql::result_t& result=d_pendingResults.front();
+  DNSResourceRecord rr;
+  for(SSql::result_t::const_iterator i=result.begin(); i!=result.end(); ++i) {
+    rowToRecord(*i, d_pendingQnames.front(), rr);
+    rrs.push_back(rr);
+  }
+  d_pendingResults.pop_front();
+  d_pendingQnames.pop_front();
+  return true;
+}
+
+void GSQLBackend::discardLookups()
+{
+  d_pendingLookups.clear();
+  d_pendingQnames.clear();
+  d_pendingResults.clear();
+}
+
 bool GSQLBackend::list(const string &target, int domain_id )
 {
+  flushInserts();
   DLOG(L<<"GSQLBackend constructing handle for list of domain id '"<<domain_id<<"'"<<endl);
 
-  char output[1024];
-  snprintf(output,sizeof(output)-1,d_listQuery.c_str(),domain_id);
   try {
-    d_db->doQuery(output);
+    d_activeStmt=getStatement(d_listQuery);
+    if(d_activeStmt)
+      d_activeStmt->bind((long)domain_id)->execute();
+    else {
+      char output[1024];
+      snprintf(output,sizeof(output)-1,d_listQuery.c_str(),domain_id);
+      d_db->doQuery(output);
+    }
   }
   catch(SSqlException &e) {
+    d_activeStmt=0;
     throw AhuException("GSQLBackend list query: "+e.txtReason());
   }
 
@@ -847,34 +1081,49 @@ bool GSQLBackend::get(DNSResourceRecord &r)
 {
   // L << "GSQLBackend get() was called for "<<qtype.getName() << " record: ";
   SSql::row_t row;
-  if(d_db->getRow(row)) {
-    r.content=row[0];
-    if (row[1].empty())
-        r.ttl = ::arg().asNum( "default-ttl" );
-    else 
-        r.ttl=atol(row[1].c_str());
-    r.priority=atol(row[2].c_str());
-    if(!d_qname.empty())
-      r.qname=d_qname;
-    else
-      r.qname=row[5];
-    r.qtype=row[3];
-    r.last_modified=0;
-    
-    if(d_dnssecQueries)
-      r.auth = !row[6].empty() && row[6][0]=='1';
-    else
-      r.auth = 1; 
-    
-    r.domain_id=atoi(row[4].c_str());
+  bool more;
+  try {
+    more=d_activeStmt ? d_activeStmt->getRow(row) : d_db->getRow(row);
+  }
+  catch(SSqlException &e) {
+    d_activeStmt=0;
+    throw AhuException("GSQLBackend get: "+e.txtReason());
+  }
+  if(more) {
+    rowToRecord(row, d_qname, r);
     return true;
   }
   
+  d_activeStmt=0;
   return false;
 }
 
+void GSQLBackend::rowToRecord(const SSql::row_t& row, const string& qname, DNSResourceRecord& r)
+{
+  r.content=row[0];
+  if (row[1].empty())
+      r.ttl = ::arg().asNum( "default-ttl" );
+  else 
+      r.ttl=atol(row[1].c_str());
+  r.priority=atol(row[2].c_str());
+  if(!qname.empty())
+    r.qname=qname;
+  else
+    r.qname=row[5];
+  r.qtype=row[3];
+  r.last_modified=0;
+  
+  if(d_dnssecQueries)
+    r.auth = !row[6].empty() && row[6][0]=='1';
+  else
+    r.auth = 1; 
+  
+  r.domain_id=atoi(row[4].c_str());
+}
+
 bool GSQLBackend::replaceRRSet(uint32_t domain_id, const string& qname, const QType& qt, const vector<DNSResourceRecord>& rrset)
 {
+  flushInserts();
   string deleteQuery = (boost::format(d_DeleteRRSet) % domain_id % sqlEscape(qname) % sqlEscape(qt.getName())).str();
   d_db->doCommand(deleteQuery);
   BOOST_FOREACH(const DNSResourceRecord& rr, rrset) {
@@ -887,6 +1136,21 @@ bool GSQLBackend::replaceRRSet(uint32_t domain_id, const string& qname, const QT
 bool GSQLBackend::feedRecord(const DNSResourceRecord &r)
 {
   string output;
+  if(d_inTransaction && d_insertBatchSize > 1) {
+    if(d_numPendingInserts++)
+      d_pendingInserts.append(",");
+    else
+      d_pendingInserts=d_InsertRecordPrefix;
+    if(d_dnssecQueries)
+      d_pendingInserts.append((boost::format(d_InsertRecordRow) % sqlEscape(r.content) % r.ttl % r.priority % sqlEscape(r.qtype.getName()) % r.domain_id % toLower(sqlEscape(r.qname)) % (int)r.auth).str());
+    else
+      d_pendingInserts.append((boost::format(d_InsertRecordRow) % sqlEscape(r.content) % r.ttl % r.priority % sqlEscape(r.qtype.getName()) % r.domain_id % toLower(sqlEscape(r.qname))).str());
+
+    if(d_numPendingInserts >= d_insertBatchSize)
+      flushInserts();
+    return true;
+  }
+
   if(d_dnssecQueries) {
     output = (boost::format(d_InsertRecordQuery) % sqlEscape(r.content) % r.ttl % r.priority % sqlEscape(r.qtype.getName()) % r.domain_id % toLower(sqlEscape(r.qname)) % (int)r.auth).str();
   } else {
@@ -902,6 +1166,23 @@ bool GSQLBackend::feedRecord(const DNSResourceRecord &r)
   return true; // XXX FIXME this API should not return 'true' I think -ahu 
 }
 
+//! sends the records feedRecord() batched up, needs to happen before anything else looks at or changes the records table
+void GSQLBackend::flushInserts()
+{
+  if(!d_numPendingInserts)
+    return;
+
+  string output;
+  output.swap(d_pendingInserts);
+  d_numPendingInserts=0;
+  try {
+    d_db->doCommand(output);
+  }
+  catch (SSqlException &e) {
+    throw AhuException("GSQLBackend unable to feed records: "+e.txtReason());
+  }
+}
+
 bool GSQLBackend::startTransaction(const string &domain, int domain_id)
 {
   char output[1024];
@@ -915,12 +1196,15 @@ bool GSQLBackend::startTransaction(const string &domain, int domain_id)
   catch (SSqlException &e) {
     throw AhuException("Database failed to start transaction: "+e.txtReason());
   }
+  d_inTransaction=true;
 
   return true;
 }
 
 bool GSQLBackend::commitTransaction()
 {
+  flushInserts();
+  d_inTransaction=false;
   try {
     d_db->doCommand("commit");
   }
@@ -932,6 +1216,9 @@ bool GSQLBackend::commitTransaction()
 
 bool GSQLBackend::abortTransaction()
 {
+  d_pendingInserts.clear();
+  d_numPendingInserts=0;
+  d_inTransaction=false;
   try {
     d_db->doCommand("rollback");
   }
@@ -943,6 +1230,7 @@ bool GSQLBackend::abortTransaction()
 
 bool GSQLBackend::calculateSOASerial(const string& domain, const SOAData& sd, time_t& serial)
 {
+  flushInserts();
   if (d_ZoneLastChangeQuery.empty()) {
     // query not set => fall back to default impl
     return DNSBackend::calculateSOASerial(domain, sd, serial);
@@ -13,6 +13,8 @@ public:
   GSQLBackend(const string &mode, const string &suffix); //!< Makes our connection to the database. Throws an exception if it fails.
   virtual ~GSQLBackend()
   {
+    for(statements_t::const_iterator i=d_statements.begin(); i!=d_statements.end(); ++i)
+      delete i->second; // before the connection they belong to
     if(d_db)
       delete d_db;
   }
@@ -26,6 +28,9 @@ public:
   void lookup(const QType &, const string &qdomain, DNSPacket *p=0, int zoneId=-1);
   bool list(const string &target, int domain_id);
   bool get(DNSResourceRecord &r);
+  void submitLookup(const QType &, const string &qdomain, DNSPacket *p=0, int zoneId=-1);
+  bool harvestLookup(vector<DNSResourceRecord>& rrs);
+  void discardLookups();
   void getAllDomains(vector<DomainInfo> *domains);
   bool isMaster(const string &domain, const string &ip);
   void alsoNotifies(const string &domain, set<string> *ips);
@@ -63,12 +68,40 @@ public:
   
   bool getTSIGKey(const string& name, string* algorithm, string* content);
 private:
+  const string& lookupFormat(const QType &qtype, const string &qname, int domain_id) const;
+  string makeLookupQuery(const QType &qtype, const string &qname, int domain_id);
+  SSqlStatement* executeLookup(const QType &qtype, const string &qname, int domain_id);
+  SSqlStatement* getStatement(const string &format);
+  void flushInserts();
+  void rowToRecord(const SSql::row_t& row, const string& qname, DNSResourceRecord& r);
+
   string d_qname;
   QType d_qtype;
   int d_count;
   SSql *d_db;
   SSql::result_t d_result;
 
+  typedef map<const string*, SSqlStatement*> statements_t;
+  statements_t d_statements;  // keyed by the query template below, 0 if it can't be prepared
+  SSqlStatement *d_activeStmt; // get() retrieves rows from here, if set
+
+  struct PendingLookup
+  {
+    QType qtype;
+    string qname;
+    int domain_id;
+  };
+  vector<PendingLookup> d_pendingLookups; // submitted, not yet sent to the database
+  deque<string> d_pendingQnames;      // one per outstanding lookup, sent or not
+  deque<SSql::result_t> d_pendingResults; // sent, not yet harvested
+
+  bool d_inTransaction;
+  unsigned int d_insertBatchSize;  // 1 if d_InsertRecordQuery can't be turned into a multi-row insert
+  string d_InsertRecordPrefix;     // d_InsertRecordQuery up to and including 'values'
+  string d_InsertRecordRow;        // the (...) part of d_InsertRecordQuery, repeated for every record
+  string d_pendingInserts;
+  unsigned int d_numPendingInserts;
+
   string d_wildCardNoIDQuery;
   string d_noWildCardNoIDQuery;
   string d_noWildCardIDQuery;
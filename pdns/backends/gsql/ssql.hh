@@ -29,6 +29,21 @@ private:
   string d_reason;
 };
 
+//! A query that the database parses and plans once, and then runs many times with different parameters
+class SSqlStatement
+{
+public:
+  typedef vector<string> row_t;
+  //! binds the next parameter, in the order the placeholders appear in the query
+  virtual SSqlStatement* bind(const string &value)=0;
+  virtual SSqlStatement* bind(long value)=0;
+  //! runs the statement with the parameters bound so far, and clears them for the next run
+  virtual SSqlStatement* execute()=0;
+  //! retrieves one row of the last execute(), returns false if no more were available
+  virtual bool getRow(row_t &row)=0;
+  virtual ~SSqlStatement(){};
+};
+
 class SSql
 {
 public:
@@ -38,7 +53,17 @@ public:
   virtual int doQuery(const string &query, result_t &result)=0;
   virtual int doQuery(const string &query)=0;
   virtual int doCommand(const string &query)=0;
+  //! runs several SELECT queries, results[n] receives the rows of queries[n]. Drivers that can should send them in one go
+  virtual void doQueries(const vector<string> &queries, vector<result_t> &results)
+  {
+    results.clear();
+    results.resize(queries.size());
+    for(vector<string>::size_type n=0; n < queries.size(); ++n)
+      doQuery(queries[n], results[n]);
+  }
   virtual bool getRow(row_t &row)=0;
+  //! prepares a statement with nparams parameters, marked as ? in the query. Returns 0 if the driver can't prepare statements
+  virtual SSqlStatement* prepare(const string &query, int nparams) { return 0; }
   virtual string escape(const string &name)=0;
   virtual void setLog(bool state){}
   virtual ~SSql(){};
@@ -28,6 +28,7 @@ DNSProxy *DP;
 DynListener *dl;
 CommunicatorClass Communicator;
 UDPNameserver *N;
+vector<UDPNameserver*> g_udpReceivers; //!< with reuseport, receiver thread n listens on g_udpReceivers[n]
 int avg_latency;
 TCPNameserver *TN;
 
@@ -68,8 +69,12 @@ void declareArguments()
   ::arg().set("loglevel","Amount of logging. Higher is more. Do not set below 3")="4";
   ::arg().set("default-soa-name","name to insert in the SOA record if none set in the backend")="a.misconfigured.powerdns.server";
   ::arg().set("distributor-threads","Default number of Distributor (backend) threads to start")="3";
+  ::arg().set("distributor-batch-size","Maximum number of queued questions a Distributor thread takes at once")="1";
   ::arg().set("signing-threads","Default number of signer threads to start")="3";
   ::arg().set("receiver-threads","Default number of Distributor (backend) threads to start")="1";
+  ::arg().setSwitch("reuseport","Give each receiver thread its own UDP sockets, bound with SO_REUSEPORT")="no";
+  ::arg().set("udp-batch-size","Number of UDP packets to receive or send per system call, if the OS supports it. 1 disables batching")="1";
+  ::arg().set("udp-batch-flush-usec","Maximum number of microseconds a batched UDP answer may be held back")="100";
   ::arg().set("queue-limit","Maximum number of milliseconds to queue a query")="1500"; 
   ::arg().set("recursor","If recursion is desired, IP address of a recursing nameserver")="no"; 
   ::arg().set("allow-recursion","List of subnets that are allowed to recurse")="0.0.0.0/0";
@@ -219,8 +224,11 @@ void *qthread(void *number)
 {
   DNSPacket *P;
   DNSDistributor *distributor = new DNSDistributor(::arg().asNum("distributor-threads")); // the big dispatcher!
+  UDPNameserver *NS = (size_t)number < g_udpReceivers.size() ? g_udpReceivers[(size_t)number] : N;
   DNSPacket question;
-  DNSPacket cached;
+  char cached[65535]; // PacketCache hits are assembled here and sent straight from this thread
+  int cachedlen;
+  UDPNameserver::Batch batch(::arg().asNum("udp-batch-size"), ::arg().asNum("udp-batch-flush-usec"));
 
   unsigned int &numreceived=*S.getPointer("udp-queries");
   unsigned int &numanswered=*S.getPointer("udp-answers");
@@ -250,7 +258,7 @@ void *qthread(void *number)
       }
     }
 
-    if(!(P=N->receive(&question))) { // receive a packet         inline
+    if(!(P=NS->receive(&question, &batch))) { // receive a packet         inline
       continue;                    // packet was broken, try again
     }
 
@@ -273,18 +281,11 @@ void *qthread(void *number)
       L << Logger::Notice<<"Remote "<< remote <<" wants '" << P->qdomain<<"|"<<P->qtype.getName() << 
             "', do = " <<P->d_dnssecOk <<", bufsize = "<< P->getMaxReplyLen()<<": ";
     }
-    if((P->d.opcode != Opcode::Notify) && P->couldBeCached() && PC.get(P, &cached)) { // short circuit - does the PacketCache recognize this question?
+    if((P->d.opcode != Opcode::Notify) && P->couldBeCached() && (cachedlen=PC.get(P, cached, sizeof(cached)))) { // short circuit - does the PacketCache recognize this question?
       if(logDNSQueries)
         L<<"packetcache HIT"<<endl;
-      cached.setRemote(&P->d_remote);  // inlined
-      cached.setSocket(P->getSocket());                               // inlined
-      cached.d_anyLocal = P->d_anyLocal;
-      cached.setMaxReplyLen(P->getMaxReplyLen());
-      cached.d.rd=P->d.rd; // copy in recursion desired bit 
-      cached.d.id=P->d.id;
-      cached.commitD(); // commit d to the packet                        inlined
-
-      N->send(&cached);   // answer it then                              inlined
+
+      N->send(&batch, cached, cachedlen, P->getSocket(), P->d_remote, P->d_anyLocal);   // answer it then, id and flags are already patched in
       diff=P->d_dt.udiff();                                                    
       avg_latency=(int)(0.999*avg_latency+0.001*diff); // 'EWMA'
       
@@ -38,6 +38,7 @@
 #include "ahuexception.hh"
 #include "arguments.hh"
 #include "statbag.hh"
+#include "mpmcqueue.hh"
 
 extern StatBag S;
 
@@ -55,6 +56,10 @@ extern StatBag S;
     the Distributor using its numBackends() method. This is silly.
 
     If an exception escapes a Backend, the distributor retires it.
+
+    Questions travel through a bounded lock-free queue, and backend threads sleep on a LightSemaphore, so
+    handing over a question normally costs a few atomic operations and no system calls. A backend thread
+    that wakes up takes up to 'distributor-batch-size' questions in one go.
 */
 template<class Answer, class Question, class Backend> class Distributor
 {
@@ -92,18 +97,20 @@ public:
   
 private:
   bool d_overloaded;
-  std::queue<QuestionData> questions;
-  pthread_mutex_t q_lock;
+  MPMCQueue<QuestionData> d_questions;
   
   deque<tuple_t> answers;
   pthread_mutex_t a_lock;
 
-  Semaphore numquestions;
+  LightSemaphore numquestions;
   Semaphore numanswers;
 
   pthread_mutex_t to_mut;
   pthread_cond_t to_cond;
 
+  QuestionData popQuestion();
+  void requeue(vector<QuestionData>& batch);
+
   int nextid;
   time_t d_last_started;
   int d_num_threads;
@@ -114,16 +121,13 @@ private:
 
 //template<class Answer, class Question, class Backend>::nextid;
 
-template<class Answer, class Question, class Backend>Distributor<Answer,Question,Backend>::Distributor(int n)
+template<class Answer, class Question, class Backend>Distributor<Answer,Question,Backend>::Distributor(int n) : d_questions(::arg().asNum("max-queue-length")+1)
 {
   b=0;
   d_overloaded = false;
   nextid=0;
   // d_idle_threads=0;
   d_last_started=time(0);
-//  sem_init(&numquestions,0,0);
-  pthread_mutex_init(&q_lock,0);
-
 //  sem_init(&numanswers,0,0);
   pthread_mutex_init(&a_lock,0);
 
@@ -151,7 +155,7 @@ template<class Answer, class Question, class Backend>void *Distributor<Answer,Qu
   try {
     Backend *b=new Backend(); // this will answer our questions
     Distributor *us=static_cast<Distributor *>(p);
-    int qcount;
+    int qcount=0;
 
     // this is so gross
 #ifndef SMTPREDIR 
@@ -159,20 +163,26 @@ template<class Answer, class Question, class Backend>void *Distributor<Answer,Qu
 #endif 
     // ick ick ick!
     static int overloadQueueLength=::arg().asNum("overload-queue-length");
+    static unsigned int batchSize=std::max(::arg().asNum("distributor-batch-size"), 1);
+    vector<QuestionData> batch;
+    batch.reserve(batchSize);
     for(;;) {
-      ++(us->d_idle_threads);
+      if(batch.empty()) {
+        ++(us->d_idle_threads);
 
-      us->numquestions.getValue( &qcount );
+        qcount=us->d_questions.size();
 
-      us->numquestions.wait();
+        us->numquestions.wait();
 
-      --(us->d_idle_threads);
-      pthread_mutex_lock(&us->q_lock);
-
-      QuestionData QD=us->questions.front();
+        --(us->d_idle_threads);
+        do {
+          batch.push_back(us->popQuestion());
+        } while(batch.size() < batchSize && us->numquestions.tryWait());
+        std::reverse(batch.begin(), batch.end()); // we take them from the back
+      }
 
-      us->questions.pop();
-      pthread_mutex_unlock(&us->q_lock);
+      QuestionData QD=batch.back();
+      batch.pop_back();
 
       Question *q=QD.Q;
       
@@ -197,11 +207,13 @@ template<class Answer, class Question, class Backend>void *Distributor<Answer,Qu
       }
       catch(const AhuException &e) {
         L<<Logger::Error<<"Backend error: "<<e.reason<<endl;
+        us->requeue(batch);
         delete b;
         return 0;
       }
       catch(...) {
         L<<Logger::Error<<Logger::NTLog<<"Caught unknown exception in Distributor thread "<<(unsigned long)pthread_self()<<endl;
+        us->requeue(batch);
         delete b;
         return 0;
       }
@@ -303,31 +315,50 @@ template<class Answer, class Question, class Backend>int Distributor<Answer,Ques
   QD.id=nextid++;
   QD.callback=callback;
 
-  pthread_mutex_lock(&q_lock);
-  questions.push(QD);
-  pthread_mutex_unlock(&q_lock);
+  static int overloadQueueLength=::arg().asNum("overload-queue-length");
+  static int maxQueueLength=::arg().asNum("max-queue-length");
 
+  if(!d_questions.push(QD)) {
+    L<<Logger::Error<<d_questions.size()<<" questions waiting for database attention. Limit is "<<maxQueueLength<<", respawning"<<endl;
+    _exit(1);
+  }
   numquestions.post();
-  
-  static int overloadQueueLength=::arg().asNum("overload-queue-length");
 
-  if(!(nextid%50)) {
-    int val;
-    numquestions.getValue( &val );
+  int val=d_questions.size(); // lock-free, so we can afford to check this every time
     
-    if(!d_overloaded)
-      d_overloaded = overloadQueueLength && (val > overloadQueueLength);
-
-    if(val>::arg().asNum("max-queue-length")) {
-      L<<Logger::Error<<val<<" questions waiting for database attention. Limit is "<<::arg().asNum("max-queue-length")<<", respawning"<<endl;
-      _exit(1);
-    }
+  if(!d_overloaded)
+    d_overloaded = overloadQueueLength && (val > overloadQueueLength);
 
+  if(val>maxQueueLength) {
+    L<<Logger::Error<<val<<" questions waiting for database attention. Limit is "<<maxQueueLength<<", respawning"<<endl;
+    _exit(1);
   }
 
   return QD.id;
 }
 
+//! takes a question off the queue, after numquestions told us there is one
+template<class Answer, class Question, class Backend>typename Distributor<Answer,Question,Backend>::QuestionData Distributor<Answer,Question,Backend>::popQuestion()
+{
+  QuestionData QD;
+  // a producer that got its slot before the one we were woken for may not have filled it yet, this is very brief
+  while(!d_questions.pop(&QD))
+    sched_yield();
+  return QD;
+}
+
+//! hands back questions a dying backend thread had taken but not answered, so they are not lost
+template<class Answer, class Question, class Backend>void Distributor<Answer,Question,Backend>::requeue(vector<QuestionData>& batch)
+{
+  for(typename vector<QuestionData>::const_iterator i = batch.begin(); i != batch.end(); ++i) {
+    if(d_questions.push(*i))
+      numquestions.post();
+    else
+      delete i->Q;
+  }
+  batch.clear();
+}
+
 template<class Answer, class Question,class Backend>Answer* Distributor<Answer,Question,Backend>::answer()
 {
   numanswers.wait();
@@ -365,7 +396,7 @@ template<class Answer, class Question,class Backend>Answer* Distributor<Answer,Q
 
 template<class Answer, class Question,class Backend>void Distributor<Answer,Question,Backend>::getQueueSizes(int &questions, int &answers)
 {
-  numquestions.getValue( &questions );
+  questions=d_questions.size();
   numanswers.getValue( &answers );
 }
 
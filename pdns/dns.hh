@@ -70,7 +70,7 @@ public:
 class DNSResourceRecord
 {
 public:
-  DNSResourceRecord() : qclass(1), priority(0), signttl(0), last_modified(0), d_place(ANSWER), auth(1), scopeMask(0) {};
+  DNSResourceRecord() : qclass(1), priority(0), signttl(0), last_modified(0), d_place(ANSWER), auth(1), scopeMask(0), wireqtype(0), wirepriority(0) {};
   ~DNSResourceRecord(){};
 
   // data
@@ -80,6 +80,7 @@ public:
   string qname; //!< the name of this record, for example: www.powerdns.com
   string wildcardname;
   string content; //!< what this record points to. Example: 10.1.2.3
+  string wirecontent; //!< optional: content (and priority) as uncompressed rdata, saves DNSPacket::wrapup() from parsing content. Set it with setWireContent()
   uint16_t priority; //!< For qtypes that support a priority or preference (MX, SRV)
   uint32_t ttl; //!< Time To Live of this record
   uint32_t signttl; //!< If non-zero, use this TTL as original TTL in the RRSIG
@@ -91,6 +92,22 @@ public:
   bool auth;
   uint8_t scopeMask;
 
+  /** Records get reused, and a lot of code changes qtype or content without knowing about wirecontent. So we keep what
+      wirecontent was made from, and it is only used while qtype, content and priority are still exactly the same. Call this
+      after setting those. Keeping content costs no copy when strings share their data, and then comparing it is cheap too. */
+  void setWireContent(const string& wire)
+  {
+    wirecontent = wire;
+    wiresource = content;
+    wireqtype = qtype.getCode();
+    wirepriority = priority;
+  }
+  bool hasWireContent() const
+  {
+    return !wirecontent.empty() && wireqtype == qtype.getCode() && wirepriority == priority &&
+      wiresource.size() == content.size() && (wiresource.data() == content.data() || wiresource == content);
+  }
+
   template<class Archive>
   void serialize(Archive & ar, const unsigned int version)
   {
@@ -99,12 +116,18 @@ public:
     ar & qname;
     ar & wildcardname;
     ar & content;
+    ar & wirecontent; // only ever saved while it matches, see UeberBackend::addCache()
     ar & priority;
     ar & ttl;
     ar & domain_id;
     ar & last_modified;
     ar & d_place;
     ar & auth;
+    if(Archive::is_loading::value) {
+      wiresource = content;
+      wireqtype = qtype.getCode();
+      wirepriority = priority;
+    }
   }
 
   bool operator<(const DNSResourceRecord &b) const
@@ -115,6 +138,11 @@ public:
       return(content < b.content);
     return false;
   }
+
+private:
+  string wiresource;      //!< the content wirecontent was made from
+  uint16_t wireqtype;     //!< and the qtype
+  uint16_t wirepriority;  //!< and the priority
 };
 
 #ifdef _MSC_VER
@@ -255,6 +255,37 @@ bool DNSBackend::getSOA(const string &domain, SOAData &sd, DNSPacket *p)
   return true;
 }
 
+void DNSBackend::submitLookup(const QType &qtype, const string &qdomain, DNSPacket *pkt_p, int zoneId)
+{
+  PendingLookup pl;
+  pl.qtype=qtype;
+  pl.qdomain=qdomain;
+  pl.pkt_p=pkt_p;
+  pl.zoneId=zoneId;
+  d_pending.push_back(pl);
+}
+
+bool DNSBackend::harvestLookup(vector<DNSResourceRecord>& rrs)
+{
+  rrs.clear();
+  if(d_pending.empty())
+    return false;
+
+  PendingLookup pl=d_pending.front();
+  d_pending.pop_front();
+
+  this->lookup(pl.qtype, pl.qdomain, pl.pkt_p, pl.zoneId);
+  DNSResourceRecord rr;
+  while(this->get(rr))
+    rrs.push_back(rr);
+  return true;
+}
+
+void DNSBackend::discardLookups()
+{
+  d_pending.clear();
+}
+
 bool DNSBackend::getBeforeAndAfterNames(uint32_t id, const std::string& zonename, const std::string& qname, std::string& before, std::string& after)
 {
   string lcqname=toLower(qname);
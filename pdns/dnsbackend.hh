@@ -25,6 +25,7 @@ class DNSPacket;
 #include <string>
 #include <vector>
 #include <map>
+#include <deque>
 #include <sys/types.h>
 #include "ahuexception.hh"
 #include <set>
@@ -80,6 +81,16 @@ public:
   virtual void lookup(const QType &qtype, const string &qdomain, DNSPacket *pkt_p=0, int zoneId=-1)=0; 
   virtual bool get(DNSResourceRecord &)=0; //!< retrieves one DNSResource record, returns false if no more were available
 
+  //! queues a lookup to be answered later by harvestLookup(), so a backend can run several lookups together
+  /** This is not asynchronous, harvestLookup() still blocks until the answers are in. Backends that talk to a database
+      over a connection can override submitLookup(), harvestLookup() and discardLookups() to save round trips on the
+      queued queries. The default simply remembers the lookup and performs it through lookup() and get() when it is
+      harvested. Do not mix this with lookup()/get() while lookups are outstanding. */
+  virtual void submitLookup(const QType &qtype, const string &qdomain, DNSPacket *pkt_p=0, int zoneId=-1);
+  //! retrieves all records for the oldest submitted lookup, returns false if no lookups were outstanding
+  virtual bool harvestLookup(vector<DNSResourceRecord>& rrs);
+  //! forgets about all outstanding lookups, for instance after an exception
+  virtual void discardLookups();
 
   //! Initiates a list of the specified domain
   /** Once initiated, DNSResourceRecord objects can be retrieved using get(). Should return false
@@ -258,6 +269,14 @@ protected:
   bool getRemote(DNSPacket *p, struct sockaddr *in, Utility::socklen_t *len);
 
 private:
+  struct PendingLookup
+  {
+    QType qtype;
+    string qdomain;
+    DNSPacket *pkt_p;
+    int zoneId;
+  };
+  deque<PendingLookup> d_pending;
   string d_prefix;
 };
 
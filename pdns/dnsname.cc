@@ -0,0 +1,169 @@
+/*
+    PowerDNS Versatile Database Driven Nameserver
+    Copyright (C) 2013  PowerDNS.COM BV
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License version 2
+    as published by the Free Software Foundation
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#include "dnsname.hh"
+#include "ahuexception.hh"
+#include <string.h>
+
+DNSName::DNSName(const string& name)
+{
+  parse(name.c_str(), name.size());
+}
+
+DNSName::DNSName(const char* name)
+{
+  parse(name, strlen(name));
+}
+
+void DNSName::parse(const char* name, unsigned int len)
+{
+  d_labels = 0;
+  if(len == 1 && name[0] == '.')
+    len = 0;
+  d_storage.reserve(len + 1);
+
+  char label[64];
+  unsigned int labellen = 0;
+  for(unsigned int pos = 0; pos <= len; ++pos) {
+    if(pos == len || name[pos] == '.') {
+      if(!labellen) {
+        if(pos == len)  // after the trailing dot, or the empty string
+          break;
+        throw AhuException("Empty label in name '"+string(name, len)+"'");
+      }
+      d_storage.append(1, (char)labellen);
+      d_storage.append(label, labellen);
+      ++d_labels;
+      labellen = 0;
+      continue;
+    }
+    if(labellen == sizeof(label) - 1)
+      throw AhuException("Label too long in name '"+string(name, len)+"'");
+
+    char c = name[pos];
+    if(c == '\\' && pos + 1 < len) {
+      ++pos;
+      if(pos + 2 < len && isdigit(name[pos]) && isdigit(name[pos+1]) && isdigit(name[pos+2])) {
+        c = (char)((name[pos]-'0')*100 + (name[pos+1]-'0')*10 + (name[pos+2]-'0'));
+        pos += 2;
+      }
+      else
+        c = name[pos];
+    }
+    label[labellen++] = c;
+  }
+  if(d_storage.size() > 254)
+    throw AhuException("Name '"+string(name, len)+"' is too long");
+  rehash();
+}
+
+DNSName::DNSName(const char* wire, unsigned int len) : d_labels(0)
+{
+  unsigned int pos = 0;
+  for(;;) {
+    if(pos >= len)
+      throw AhuException("Name runs beyond the end of the packet");
+    unsigned char labellen = wire[pos];
+    if(!labellen)
+      break;
+    if(labellen & 0xc0)
+      throw AhuException("Compressed name where none was expected");
+    pos += labellen + 1;
+    ++d_labels;
+  }
+  if(pos > 254)
+    throw AhuException("Name on the wire is too long");
+  d_storage.assign(wire, pos);
+  rehash();
+}
+
+string DNSName::toString(bool trailingDot) const
+{
+  if(d_storage.empty())
+    return ".";
+
+  string ret;
+  ret.reserve(d_storage.size() + 1);
+  for(string::size_type pos = 0; pos < d_storage.size(); ) {
+    unsigned char labellen = d_storage[pos++];
+    for(unsigned int n = 0; n < labellen; ++n, ++pos) {
+      char c = d_storage[pos];
+      if(c == '.' || c == '\\') {
+        ret.append(1, '\\');
+        ret.append(1, c);
+      }
+      else if(c == ' ')
+        ret += "\\032";
+      else
+        ret.append(1, c);
+    }
+    ret.append(1, '.');
+  }
+  if(!trailingDot)
+    ret.resize(ret.size() - 1);
+  return ret;
+}
+
+//! stores where each label starts in offsets, which needs room for 127 entries, and returns the number of labels
+unsigned int DNSName::labelOffsets(uint8_t* offsets) const
+{
+  unsigned int count = 0;
+  for(string::size_type pos = 0; pos < d_storage.size(); pos += (unsigned char)d_storage[pos] + 1)
+    offsets[count++] = pos;
+  return count;
+}
+
+int DNSName::canonCompare(const DNSName& rhs) const
+{
+  uint8_t ours[128], theirs[128];
+  unsigned int ourcount = labelOffsets(ours), theircount = rhs.labelOffsets(theirs);
+
+  while(ourcount && theircount) {
+    const unsigned char* a = (const unsigned char*)d_storage.c_str() + ours[--ourcount];
+    const unsigned char* b = (const unsigned char*)rhs.d_storage.c_str() + theirs[--theircount];
+    unsigned int alen = *a++, blen = *b++, len = min(alen, blen);
+    unsigned int n = pdns_imismatch((const char*)a, (const char*)b, len);
+    if(n < len)
+      return (unsigned char)dns_tolower(a[n]) - (unsigned char)dns_tolower(b[n]);
+    if(alen != blen)
+      return alen < blen ? -1 : 1;
+  }
+  if(ourcount == theircount)
+    return 0;
+  return ourcount < theircount ? -1 : 1;  // the name with fewer labels is the parent, which sorts first
+}
+
+bool DNSName::isPartOf(const DNSName& parent) const
+{
+  if(parent.d_labels > d_labels)
+    return false;
+  string::size_type pos = 0;
+  for(unsigned int skip = d_labels - parent.d_labels; skip; --skip)
+    pos += (unsigned char)d_storage[pos] + 1;
+  return d_storage.size() - pos == parent.d_storage.size() &&
+    equalLabels(d_storage.c_str() + pos, parent.d_storage.c_str(), parent.d_storage.size());
+}
+
+bool DNSName::chopOff()
+{
+  if(d_storage.empty())
+    return false;
+  d_storage.erase(0, (unsigned char)d_storage[0] + 1);
+  --d_labels;
+  rehash();
+  return true;
+}
@@ -0,0 +1,106 @@
+/*
+    PowerDNS Versatile Database Driven Nameserver
+    Copyright (C) 2013  PowerDNS.COM BV
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License version 2
+    as published by the Free Software Foundation
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#ifndef PDNS_DNSNAME_HH
+#define PDNS_DNSNAME_HH
+
+#include <string>
+#include <stdint.h>
+#include "misc.hh"
+#include "namespaces.hh"
+
+/** A domain name, stored the way it goes on the wire: length prefixed labels, without the final empty label and
+    without compression. This is smaller than the dotted text, needs no escaping, and keeps the case the name came in with.
+
+    Comparisons are case insensitive. The case insensitive hash is calculated once, when the name is made, so hashed
+    containers and operator== mostly get away with comparing two integers. operator< is the canonical ordering of RFC 4034,
+    which compares names label by label starting at the root, so a zone and everything below it are adjacent in an ordered
+    container. isPartOf() and chopOff() work on the labels in place and allocate nothing.
+
+    Text with a trailing dot and text without one make the same DNSName, "" and "." are both the root. */
+class DNSName
+{
+public:
+  DNSName() : d_hash(2166136261U), d_labels(0) {}   //!< the root
+  explicit DNSName(const string& name);             //!< from dotted text, which may have \. and \DDD escapes
+  explicit DNSName(const char* name);
+  DNSName(const char* wire, unsigned int len);      //!< from an uncompressed name on the wire, like the question of a packet
+
+  string toString(bool trailingDot=true) const;     //!< escaped like PacketReader::getLabel() does, the root is "."
+  const string& getStorage() const                  //!< the labels in wire format, without the terminating 0
+  {
+    return d_storage;
+  }
+  unsigned int wireLength() const                   //!< including the terminating 0
+  {
+    return d_storage.size() + 1;
+  }
+  unsigned int countLabels() const
+  {
+    return d_labels;
+  }
+  bool isRoot() const
+  {
+    return d_storage.empty();
+  }
+  uint32_t hash() const
+  {
+    return d_hash;
+  }
+
+  bool isPartOf(const DNSName& parent) const;       //!< true if we equal parent, or are below it
+  bool chopOff();                                   //!< removes the leftmost label, false if we were the root already
+
+  bool operator==(const DNSName& rhs) const
+  {
+    return d_hash == rhs.d_hash && d_storage.size() == rhs.d_storage.size() &&
+      equalLabels(d_storage.c_str(), rhs.d_storage.c_str(), d_storage.size());
+  }
+  bool operator!=(const DNSName& rhs) const
+  {
+    return !(*this == rhs);
+  }
+  bool operator<(const DNSName& rhs) const          //!< canonical order, RFC 4034 section 6.1
+  {
+    return canonCompare(rhs) < 0;
+  }
+  int canonCompare(const DNSName& rhs) const;
+
+private:
+  void parse(const char* name, unsigned int len);
+  void rehash()
+  {
+    d_hash = pdns_ihash(d_storage.c_str(), d_storage.size());
+  }
+  unsigned int labelOffsets(uint8_t* offsets) const;
+  static bool equalLabels(const char* a, const char* b, unsigned int len)
+  {
+    return pdns_imismatch(a, b, len) == len;  // length octets are below 64 so they are never case folded
+  }
+
+  string d_storage;
+  uint32_t d_hash;
+  uint8_t d_labels;
+};
+
+//! for boost::hash, and therefore for hashed multi_index indexes
+inline std::size_t hash_value(const DNSName& name)
+{
+  return name.hash();
+}
+
+#endif
@@ -241,6 +241,75 @@ unsigned int DNSPacket::getMinTTL()
   return minttl;
 }
 
+/** Turns content (and priority) the way a backend has it into uncompressed rdata, which DNSPacket::wrapup() can then copy
+    into a packet without parsing content again. Returns an empty string if content does not parse, wrapup() will complain
+    about that later on like it always did. SOA records are never done this way, their content gets rewritten on the way
+    out too often (SOA-EDIT, serial and TTL fixups). */
+string makeWireContent(uint16_t qtype, const string& content, uint16_t priority)
+{
+  if(!qtype || qtype == QType::SOA)  // qtype 0 is an empty non-terminal
+    return string();
+
+  string zone;
+  if(qtype == QType::MX || qtype == QType::SRV)
+    zone = lexical_cast<string>(priority) + " " + content;
+  else if(!content.empty() && qtype == QType::TXT && content[0]!='"')
+    zone = "\""+content+"\"";
+  else if(content.empty())
+    zone = ".";
+  else
+    zone = content;
+
+  try {
+    shared_ptr<DNSRecordContent> drc(DNSRecordContent::mastermake(qtype, 1, zone));
+    return drc->serialize("", true); // canonic, so no compression pointers that only make sense in this one packet
+  }
+  catch(...) {
+    return string();
+  }
+}
+
+//! decodes an uncompressed name at pos in wire, fails for names that would need escaping to go through xfrLabel()
+static bool wireToLabel(const string& wire, string::size_type pos, string& label)
+{
+  label.clear();
+  while(pos < wire.size()) {
+    unsigned char len = wire[pos++];
+    if(!len)
+      break;
+    if(len >= 64 || pos + len > wire.size())
+      return false;
+    if(!label.empty())
+      label.append(1, '.');
+    for(string::size_type n = pos; n < pos + len; ++n)
+      if(wire[n]=='.' || wire[n]=='\\' || wire[n]==' ')
+        return false;
+    label.append(wire, pos, len);
+    pos += len;
+    if(pos == wire.size())
+      return false; // no terminating root label
+  }
+  if(pos != wire.size())
+    return false;
+  if(label.empty())
+    label=".";
+  return true;
+}
+
+//! writes rdata made by makeWireContent(), names in the types that may be compressed go through xfrLabel() to get that done
+static void writeWireContent(DNSPacketWriter& pw, uint16_t qtype, const string& wire)
+{
+  string label;
+  if((qtype == QType::NS || qtype == QType::PTR || qtype == QType::CNAME) && wireToLabel(wire, 0, label))
+    pw.xfrLabel(label, true);
+  else if(qtype == QType::MX && wire.size() > 2 && wireToLabel(wire, 2, label)) {
+    pw.xfr16BitInt(((unsigned char)wire[0] << 8) | (unsigned char)wire[1]);
+    pw.xfrLabel(label, true);
+  }
+  else
+    pw.xfrBlob(wire);
+}
+
 /** Must be called before attempting to access getData(). This function stuffs all resource
  *  records found in rrs into the data buffer. It also frees resource records queued for us.
  */
@@ -290,20 +359,26 @@ void DNSPacket::wrapup()
       uint8_t maxScopeMask=0;
       for(pos=d_rrs.begin(); pos < d_rrs.end(); ++pos) {
         maxScopeMask = max(maxScopeMask, pos->scopeMask);
-        // this needs to deal with the 'prio' mismatch:
-        if(pos->qtype.getCode()==QType::MX || pos->qtype.getCode() == QType::SRV) {  
-          pos->content = lexical_cast<string>(pos->priority) + " " + pos->content;
+        pw.startRecord(pos->qname, pos->qtype.getCode(), pos->ttl, pos->qclass, (DNSPacketWriter::Place)pos->d_place); 
+
+        if(pos->hasWireContent() && pos->qtype.getCode() != QType::SOA) {
+          writeWireContent(pw, pos->qtype.getCode(), pos->wirecontent);
         }
+        else {
+          // this needs to deal with the 'prio' mismatch:
+          if(pos->qtype.getCode()==QType::MX || pos->qtype.getCode() == QType::SRV) {  
+            pos->content = lexical_cast<string>(pos->priority) + " " + pos->content;
+          }
 
-        if(!pos->content.empty() && pos->qtype.getCode()==QType::TXT && pos->content[0]!='"') {
-          pos->content="\""+pos->content+"\"";
+          if(!pos->content.empty() && pos->qtype.getCode()==QType::TXT && pos->content[0]!='"') {
+            pos->content="\""+pos->content+"\"";
+          }
+          if(pos->content.empty())  // empty contents confuse the MOADNS setup
+            pos->content=".";
+
+          shared_ptr<DNSRecordContent> drc(DNSRecordContent::mastermake(pos->qtype.getCode(), 1, pos->content)); 
+          drc->toPacket(pw);
         }
-        if(pos->content.empty())  // empty contents confuse the MOADNS setup
-          pos->content=".";
-        
-        pw.startRecord(pos->qname, pos->qtype.getCode(), pos->ttl, pos->qclass, (DNSPacketWriter::Place)pos->d_place); 
-        shared_ptr<DNSRecordContent> drc(DNSRecordContent::mastermake(pos->qtype.getCode(), 1, pos->content)); 
-              drc->toPacket(pw);
         if(pw.size() + 20U > (d_tcp ? 65535 : getMaxReplyLen())) { // 20 = room for EDNS0
           pw.rollback();
           if(pos->d_place == DNSResourceRecord::ANSWER || pos->d_place == DNSResourceRecord::AUTHORITY) {
@@ -472,7 +547,7 @@ try
     return -1;
   }
 
-  MOADNSParser mdp(d_rawpacket);
+  StreamingDNSParser sp(d_rawpacket.c_str(), d_rawpacket.size()); // we only need a few things, no need to parse it all
   EDNSOpts edo;
 
   // ANY OPTION WHICH *MIGHT* BE SET DOWN BELOW SHOULD BE CLEARED FIRST!
@@ -480,12 +555,16 @@ try
   d_wantsnsid=false;
   d_dnssecOk=false;
   d_ednsping.clear();
-  d_havetsig = mdp.getTSIGPos();
+  d_havetsig = false;
   d_haveednssubnet = false;
   d_haveednssection = false;
 
+  StreamingDNSParser::Record rec;
+  while(sp.next(rec))
+    if(rec.d_type == QType::TSIG && rec.d_class == 0xff)
+      d_havetsig = true;
 
-  if(getEDNSOpts(mdp, &edo)) {
+  if(getEDNSOpts(sp, &edo)) {
     d_haveednssection=true;
     d_maxreplylen=std::min(edo.d_packetsize, (uint16_t)1680);
 //    cerr<<edo.d_Z<<endl;
@@ -517,7 +596,12 @@ try
   }
 
   memcpy((void *)&d,(const void *)d_rawpacket.c_str(),12);
-  qdomain=mdp.d_qname;
+  if(sp.d_qnamepos) {
+    char qname[StreamingDNSParser::s_maxLabelLength];
+    qdomain.assign(qname, sp.getLabel(sp.d_qnamepos, qname, sizeof(qname)));
+  }
+  else
+    qdomain.clear();
   if(!qdomain.empty()) // strip dot
     boost::erase_tail(qdomain, 1);
 
@@ -528,8 +612,8 @@ try
     }
   }
   
-  qtype=mdp.d_qtype;
-  qclass=mdp.d_qclass;
+  qtype=sp.d_qtype;
+  qclass=sp.d_qclass;
   return 0;
 }
 catch(std::exception& e) {
@@ -184,5 +184,6 @@ private:
 
 
 bool checkForCorrectTSIG(const DNSPacket* q, DNSBackend* B, string* keyname, string* secret, TSIGRecordContent* trc);
+string makeWireContent(uint16_t qtype, const string& content, uint16_t priority);
 
 #endif
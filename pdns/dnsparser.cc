@@ -288,13 +288,202 @@ void MOADNSParser::init(const char *packet, unsigned int len)
 }
 
 
+StreamingDNSParser::StreamingDNSParser(const char* packet, unsigned int len) 
+  : d_qnamepos(0), d_qtype(0), d_qclass(0), d_packet((const uint8_t*)packet), d_len(len)
+{
+  if(len < sizeof(dnsheader))
+    throw MOADNSException("Packet shorter than minimal header");
+  if(len > 65535)
+    throw MOADNSException("Packet larger than 65535 bytes");
+
+  memcpy(&d_header, packet, sizeof(dnsheader));
+
+  if(d_header.opcode!=0 && d_header.opcode != 4) // notification
+    throw MOADNSException("Can't parse non-query packet with opcode="+ lexical_cast<string>(d_header.opcode));
+
+  d_header.qdcount=ntohs(d_header.qdcount);
+  d_header.ancount=ntohs(d_header.ancount);
+  d_header.nscount=ntohs(d_header.nscount);
+  d_header.arcount=ntohs(d_header.arcount);
+
+  uint16_t pos=sizeof(dnsheader);
+  try {
+    for(unsigned int n=0; n < d_header.qdcount; ++n) {
+      d_qnamepos=pos;
+      pos=skipLabel(pos);
+      if(pos + 4U > d_len)
+        throw std::out_of_range("Question runs beyond end of packet");
+      d_qtype=256 * d_packet[pos] + d_packet[pos+1];
+      d_qclass=256 * d_packet[pos+2] + d_packet[pos+3];
+      pos+=4;
+    }
+  }
+  catch(std::out_of_range &re) {
+    throw MOADNSException("Error parsing question of packet of "+lexical_cast<string>(len)+" bytes: "+string(re.what()));
+  }
+  d_recordspos=pos;
+}
+
+uint16_t StreamingDNSParser::skipLabel(uint16_t pos) const
+{
+  for(;;) {
+    if(pos >= d_len)
+      throw std::out_of_range("Label runs beyond end of packet");
+    uint8_t labellen=d_packet[pos];
+    if(!labellen)
+      return pos + 1;
+    if((labellen & 0xc0) == 0xc0) {
+      if(pos + 2U > d_len)
+        throw std::out_of_range("Label runs beyond end of packet");
+      return pos + 2;
+    }
+    pos+=labellen + 1;
+  }
+}
+
+bool StreamingDNSParser::next(Record& rec) const
+{
+  if(rec.d_index >= (unsigned int)(d_header.ancount + d_header.nscount + d_header.arcount))
+    return false;
+
+  uint16_t pos = rec.d_index ? rec.d_next : d_recordspos;
+  try {
+    rec.d_labelpos=pos;
+    pos=skipLabel(pos);
+    if(pos + sizeof(dnsrecordheader) > d_len)
+      throw std::out_of_range("Record header runs beyond end of packet");
+
+    struct dnsrecordheader ah;
+    memcpy(&ah, d_packet + pos, sizeof(ah));
+    pos+=sizeof(ah);
+    rec.d_type=ntohs(ah.d_type);
+    rec.d_class=ntohs(ah.d_class);
+    rec.d_ttl=ntohl(ah.d_ttl);
+    rec.d_clen=ntohs(ah.d_clen);
+    rec.d_contentpos=pos;
+    if(pos + (unsigned int)rec.d_clen > d_len)
+      throw std::out_of_range("Record content runs beyond end of packet");
+    rec.d_next=pos + rec.d_clen;
+  }
+  catch(std::out_of_range &re) {
+    if(d_header.tc) // don't sweat it over truncated packets
+      return false;
+    throw MOADNSException("Error parsing packet of "+lexical_cast<string>(d_len)+" bytes (rd="+
+                          lexical_cast<string>(d_header.rd)+
+                          "), out of bounds: "+string(re.what()));
+  }
+
+  if(rec.d_index < d_header.ancount)
+    rec.d_place=DNSRecord::Answer;
+  else if(rec.d_index < d_header.ancount + d_header.nscount)
+    rec.d_place=DNSRecord::Nameserver;
+  else
+    rec.d_place=DNSRecord::Additional;
+  rec.d_index++;
+
+  // RFC 2845 4.6: a TSIG can only be the last record, anything else is a broken or forged packet
+  if(rec.d_type == QType::TSIG && rec.d_class == 0xff &&
+     (rec.d_place != DNSRecord::Additional || rec.d_index != (unsigned int)(d_header.ancount + d_header.nscount + d_header.arcount)))
+    throw MOADNSException("Packet of "+lexical_cast<string>(d_len)+" bytes has a TSIG record that is not the last record");
+  return true;
+}
+
+unsigned int StreamingDNSParser::getLabel(uint16_t pos, char* buf, unsigned int size) const
+{
+  unsigned int len=0;
+  for(;;) {
+    if(pos >= d_len)
+      throw MOADNSException("Label runs beyond end of packet");
+    uint8_t labellen=d_packet[pos++];
+
+    if(!labellen)
+      break;
+    if((labellen & 0xc0) == 0xc0) {
+      if(pos >= d_len)
+        throw MOADNSException("Label runs beyond end of packet");
+      uint16_t offset=256*(labellen & ~0xc0) + d_packet[pos];
+      if(offset < sizeof(dnsheader) || offset >= pos - 1) // only going backwards guarantees we get to the end
+        throw MOADNSException("forward reference during label decompression");
+      pos=offset;
+      continue;
+    }
+    if(pos + labellen > d_len)
+      throw MOADNSException("Label runs beyond end of packet");
+    for(unsigned int n = 0; n < labellen; ++n, ++pos) {
+      char c=d_packet[pos];
+      if(len + 5 > size) // worst case, an escaped space plus the trailing dot
+        throw MOADNSException("Label does not fit in buffer");
+      if(c=='.' || c=='\\') {
+        buf[len++]='\\';
+        buf[len++]=c;
+      }
+      else if(c==' ') {
+        memcpy(buf + len, "\\032", 4);
+        len+=4;
+      }
+      else
+        buf[len++]=c;
+    }
+    if(len + 1 > size)
+      throw MOADNSException("Label does not fit in buffer");
+    buf[len++]='.';
+  }
+  if(!len) {
+    if(!size)
+      throw MOADNSException("Label does not fit in buffer");
+    buf[len++]='.';
+  }
+  return len;
+}
+
+string StreamingDNSParser::getLabel(uint16_t pos) const
+{
+  char buf[s_maxLabelLength];
+  return string(buf, getLabel(pos, buf, sizeof(buf)));
+}
+
+bool StreamingDNSParser::labelEquals(uint16_t pos, const string& name) const
+{
+  char buf[s_maxLabelLength];
+  unsigned int len=getLabel(pos, buf, sizeof(buf));
+  if(len != name.size())
+    return false;
+  for(unsigned int n = 0; n < len; ++n)
+    if(dns_tolower(buf[n]) != dns_tolower(name[n]))
+      return false;
+  return true;
+}
+
+shared_ptr<DNSRecordContent> StreamingDNSParser::getContent(const Record& rec) const
+{
+  // PacketReader, like MOADNSParser, works on the packet without its header
+  PacketReader pr(d_packet + sizeof(dnsheader), d_len - sizeof(dnsheader));
+  pr.d_pos=rec.d_contentpos - sizeof(dnsheader) - sizeof(dnsrecordheader);
+
+  try {
+    struct dnsrecordheader ah;
+    pr.getDnsrecordheader(ah);
+
+    DNSRecord dr;
+    dr.d_type=ah.d_type;
+    dr.d_class=ah.d_class;
+    dr.d_ttl=ah.d_ttl;
+    dr.d_clen=ah.d_clen;
+    dr.d_place=rec.d_place == DNSRecord::Answer ? DNSRecord::Answer : (rec.d_place == DNSRecord::Nameserver ? DNSRecord::Nameserver : DNSRecord::Additional);
+    return shared_ptr<DNSRecordContent>(DNSRecordContent::mastermake(dr, pr));
+  }
+  catch(std::out_of_range &re) {
+    throw MOADNSException("Error parsing record content, out of bounds: "+string(re.what()));
+  }
+}
+
 void PacketReader::getDnsrecordheader(struct dnsrecordheader &ah)
 {
   unsigned int n;
   unsigned char *p=reinterpret_cast<unsigned char*>(&ah);
   
   for(n=0; n < sizeof(dnsrecordheader); ++n) 
-    p[n]=d_content.at(d_pos++);
+    p[n]=at(d_pos++);
   
   ah.d_type=ntohs(ah.d_type);
   ah.d_class=ntohs(ah.d_class);
@@ -313,45 +502,45 @@ void PacketReader::copyRecord(vector<unsigned char>& dest, uint16_t len)
     return;
 
   for(uint16_t n=0;n<len;++n) {
-    dest.at(n)=d_content.at(d_pos++);
+    dest.at(n)=at(d_pos++);
   }
 }
 
 void PacketReader::copyRecord(unsigned char* dest, uint16_t len)
 {
-  if(d_pos + len > d_content.size())
+  if(d_pos + len > d_size)
     throw std::out_of_range("Attempt to copy outside of packet");
 
-  memcpy(dest, &d_content.at(d_pos), len);
+  memcpy(dest, ptrAt(d_pos), len);
   d_pos+=len;
 }
 
 void PacketReader::xfr48BitInt(uint64_t& ret)
 {
   ret=0;
-  ret+=d_content.at(d_pos++);
+  ret+=at(d_pos++);
   ret<<=8;
-  ret+=d_content.at(d_pos++);
+  ret+=at(d_pos++);
   ret<<=8;
-  ret+=d_content.at(d_pos++);
+  ret+=at(d_pos++);
   ret<<=8;
-  ret+=d_content.at(d_pos++);
+  ret+=at(d_pos++);
   ret<<=8;
-  ret+=d_content.at(d_pos++);
+  ret+=at(d_pos++);
   ret<<=8;
-  ret+=d_content.at(d_pos++);
+  ret+=at(d_pos++);
 }
 
 uint32_t PacketReader::get32BitInt()
 {
   uint32_t ret=0;
-  ret+=d_content.at(d_pos++);
+  ret+=at(d_pos++);
   ret<<=8;
-  ret+=d_content.at(d_pos++);
+  ret+=at(d_pos++);
   ret<<=8;
-  ret+=d_content.at(d_pos++);
+  ret+=at(d_pos++);
   ret<<=8;
-  ret+=d_content.at(d_pos++);
+  ret+=at(d_pos++);
   
   return ret;
 }
@@ -359,7 +548,12 @@ uint32_t PacketReader::get32BitInt()
 
 uint16_t PacketReader::get16BitInt()
 {
-  return get16BitInt(d_content, d_pos);
+  uint16_t ret=0;
+  ret+=at(d_pos++);
+  ret<<=8;
+  ret+=at(d_pos++);
+  
+  return ret;
 }
 
 uint16_t PacketReader::get16BitInt(const vector<unsigned char>&content, uint16_t& pos)
@@ -374,7 +568,7 @@ uint16_t PacketReader::get16BitInt(const vector<unsigned char>&content, uint16_t
 
 uint8_t PacketReader::get8BitInt()
 {
-  return d_content.at(d_pos++);
+  return at(d_pos++);
 }
 
 
@@ -382,7 +576,7 @@ string PacketReader::getLabel(unsigned int recurs)
 {
   string ret;
   ret.reserve(40);
-  getLabelFromContent(d_content, d_pos, ret, recurs++);
+  getLabelFromContent(d_content, d_size, d_pos, ret, recurs++);
   return ret;
 }
 
@@ -418,11 +612,11 @@ string PacketReader::getText(bool multi)
     if(!ret.empty()) {
       ret.append(1,' ');
     }
-    unsigned char labellen=d_content.at(d_pos++);
+    unsigned char labellen=at(d_pos++);
     
     ret.append(1,'"');
     if(labellen) { // no need to do anything for an empty string
-      string val(&d_content.at(d_pos), &d_content.at(d_pos+labellen-1)+1);
+      string val(ptrAt(d_pos), ptrAt(d_pos+labellen-1)+1);
       ret.append(txtEscape(val)); // the end is one beyond the packet
     }
     ret.append(1,'"');
@@ -435,13 +629,15 @@ string PacketReader::getText(bool multi)
 }
 
 
-void PacketReader::getLabelFromContent(const vector<uint8_t>& content, uint16_t& frompos, string& ret, int recurs) 
+void PacketReader::getLabelFromContent(const uint8_t* content, unsigned int size, uint16_t& frompos, string& ret, int recurs) 
 {
   if(recurs > 1000) // the forward reference-check below should make this test 100% obsolete
     throw MOADNSException("Loop");
 
   for(;;) {
-    unsigned char labellen=content.at(frompos++);
+    if(frompos >= size)
+      throw std::out_of_range("Label runs beyond end of packet");
+    unsigned char labellen=content[frompos++];
 
     if(!labellen) {
       if(ret.empty())
@@ -449,22 +645,25 @@ void PacketReader::getLabelFromContent(const vector<uint8_t>& content, uint16_t&
       break;
     }
     if((labellen & 0xc0) == 0xc0) {
-      uint16_t offset=256*(labellen & ~0xc0) + (unsigned int)content.at(frompos++) - sizeof(dnsheader);
+      if(frompos >= size)
+        throw std::out_of_range("Label runs beyond end of packet");
+      uint16_t offset=256*(labellen & ~0xc0) + (unsigned int)content[frompos++] - sizeof(dnsheader);
       //        cout<<"This is an offset, need to go to: "<<offset<<endl;
 
       if(offset >= frompos-2)
         throw MOADNSException("forward reference during label decompression");
-      return getLabelFromContent(content, offset, ret, ++recurs);
+      return getLabelFromContent(content, size, offset, ret, ++recurs);
     }
     else {
-      // XXX FIXME THIS MIGHT BE VERY SLOW!
+      if(frompos + labellen > size)
+        throw std::out_of_range("Label runs beyond end of packet");
       ret.reserve(ret.size() + labellen + 2);
       for(string::size_type n = 0 ; n < labellen; ++n, frompos++) {
-        if(content.at(frompos)=='.' || content.at(frompos)=='\\') {
+        if(content[frompos]=='.' || content[frompos]=='\\') {
           ret.append(1, '\\');
           ret.append(1, content[frompos]);
         }
-        else if(content.at(frompos)==' ') {
+        else if(content[frompos]==' ') {
           ret+="\\032";
         }
         else 
@@ -478,7 +677,7 @@ void PacketReader::getLabelFromContent(const vector<uint8_t>& content, uint16_t&
 void PacketReader::xfrBlob(string& blob)
 {
   if(d_recordlen && !(d_pos == (d_startrecordpos + d_recordlen)))
-    blob.assign(&d_content.at(d_pos), &d_content.at(d_startrecordpos + d_recordlen - 1 ) + 1);
+    blob.assign(ptrAt(d_pos), ptrAt(d_startrecordpos + d_recordlen - 1 ) + 1);
   else
     blob.clear();
 
@@ -488,7 +687,7 @@ void PacketReader::xfrBlob(string& blob)
 void PacketReader::xfrBlob(string& blob, int length)
 {
   if(length) {
-    blob.assign(&d_content.at(d_pos), &d_content.at(d_pos + length - 1 ) + 1 );
+    blob.assign(ptrAt(d_pos), ptrAt(d_pos + length - 1 ) + 1 );
     
     d_pos += length;
   }
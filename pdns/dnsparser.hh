@@ -64,11 +64,18 @@ class PacketReader
 {
 public:
   PacketReader(const vector<uint8_t>& content) 
-    : d_pos(0), d_startrecordpos(0), d_content(content)
+    : d_pos(0), d_startrecordpos(0), d_content(content.empty() ? 0 : &content[0]), d_size(content.size())
   {
     d_recordlen = content.size();
   }
 
+  //! reads straight from the len bytes at content, which have to stay around (and unchanged) while this reader is in use
+  PacketReader(const uint8_t* content, unsigned int len) 
+    : d_pos(0), d_startrecordpos(0), d_content(content), d_size(len)
+  {
+    d_recordlen = len;
+  }
+
   uint32_t get32BitInt();
   uint16_t get16BitInt();
   uint8_t get8BitInt();
@@ -124,7 +131,7 @@ public:
   void xfrHexBlob(string& blob, bool keepReading=false);
 
   static uint16_t get16BitInt(const vector<unsigned char>&content, uint16_t& pos);
-  static void getLabelFromContent(const vector<uint8_t>& content, uint16_t& frompos, string& ret, int recurs);
+  static void getLabelFromContent(const uint8_t* content, unsigned int size, uint16_t& frompos, string& ret, int recurs);
 
   void getDnsrecordheader(struct dnsrecordheader &ah);
   void copyRecord(vector<unsigned char>& dest, uint16_t len);
@@ -138,7 +145,20 @@ public:
 private:
   uint16_t d_startrecordpos; // needed for getBlob later on
   uint16_t d_recordlen;      // ditto
-  const vector<uint8_t>& d_content;
+  const uint8_t* d_content;
+  unsigned int d_size;
+
+  const uint8_t* ptrAt(unsigned int pos) const
+  {
+    if(pos >= d_size)
+      throw std::out_of_range("Attempt to read outside of packet");
+    return d_content + pos;
+  }
+
+  uint8_t at(unsigned int pos) const
+  {
+    return *ptrAt(pos);
+  }
 };
 
 struct DNSRecord;
@@ -334,6 +354,65 @@ private:
   uint16_t d_tsigPos;
 };
 
+/** Alternative to MOADNSParser for when not everything in a packet is needed. It walks the packet where it sits: nothing
+    is copied, names are only decoded when asked for, into buffers the caller provides, and a DNSRecordContent is only made
+    for the records getContent() is called for. Positions are offsets into the packet, header included. The packet has to
+    stay around, unchanged, for as long as the parser is in use. */
+class StreamingDNSParser : public boost::noncopyable
+{
+public:
+  //! parses the header and the question, throws MOADNSException if that fails
+  StreamingDNSParser(const char* packet, unsigned int len);
+
+  struct Record
+  {
+    Record() : d_index(0), d_next(0) {}
+    uint16_t d_labelpos;   //!< where the name of this record starts
+    uint16_t d_type;
+    uint16_t d_class;
+    uint32_t d_ttl;
+    uint16_t d_clen;
+    uint16_t d_contentpos; //!< where the content of this record starts
+    uint8_t d_place;       //!< DNSRecord::Answer, Nameserver or Additional
+
+    unsigned int d_index;  //!< for next(), a default constructed Record comes before the first one
+    uint16_t d_next;
+  };
+
+  /** moves rec on to the next record, returns false if there are no more. As with MOADNSParser, a truncated (tc) packet
+      simply ends after the last complete record, in other packets running out of data throws MOADNSException. So does a
+      TSIG record that is not the last record of the additional section */
+  bool next(Record& rec) const;
+
+  /** writes the name at pos into buf like MOADNSParser presents names, escaped and with a trailing dot, and returns its
+      length. Throws MOADNSException if it does not fit in size bytes, s_maxLabelLength always does */
+  unsigned int getLabel(uint16_t pos, char* buf, unsigned int size) const;
+  string getLabel(uint16_t pos) const;
+  //! if the name at pos is name, case insensitively, with name in the same form as getLabel() returns it
+  bool labelEquals(uint16_t pos, const string& name) const;
+
+  const char* getPacket() const
+  {
+    return (const char*)d_packet;
+  }
+
+  //! makes the content of rec, the same way MOADNSParser does it for all records
+  shared_ptr<DNSRecordContent> getContent(const Record& rec) const;
+
+  enum { s_maxLabelLength = 1025 };
+
+  dnsheader d_header;    //!< counts in host byte order, like MOADNSParser
+  uint16_t d_qnamepos;   //!< 0 if there is no question
+  uint16_t d_qtype, d_qclass;
+
+private:
+  uint16_t skipLabel(uint16_t pos) const;
+
+  const uint8_t* d_packet;
+  unsigned int d_len;
+  uint16_t d_recordspos;
+};
+
 string simpleCompress(const string& label, const string& root="");
 void simpleExpandTo(const string& label, unsigned int frompos, string& ret);
 void ageDNSPacket(std::string& packet, uint32_t seconds);
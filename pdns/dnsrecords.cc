@@ -328,6 +328,44 @@ bool getEDNSOpts(const MOADNSParser& mdp, EDNSOpts* eo)
   return false;
 }
 
+bool getEDNSOpts(const StreamingDNSParser& sp, EDNSOpts* eo)
+{
+  if(!sp.d_header.arcount)
+    return false;
+
+  const char* packet=sp.getPacket();
+  StreamingDNSParser::Record rec;
+  while(sp.next(rec)) {
+    if(rec.d_place != DNSRecord::Additional || rec.d_type != QType::OPT)
+      continue;
+    eo->d_packetsize=rec.d_class;
+
+    EDNS0Record stuff;
+    uint32_t ttl=ntohl(rec.d_ttl);
+    memcpy(&stuff, &ttl, sizeof(stuff));
+
+    eo->d_extRCode=stuff.extRCode;
+    eo->d_version=stuff.version;
+    eo->d_Z = ntohs(stuff.Z);
+
+    // same as OPTRecordContent::getData(), but straight from the packet
+    unsigned int pos=rec.d_contentpos, end=rec.d_contentpos + rec.d_clen;
+    uint16_t code, len;
+    while(end >= 4 + pos) {
+      code = 256 * (unsigned char)packet[pos] + (unsigned char)packet[pos+1];
+      len = 256 * (unsigned char)packet[pos+2] + (unsigned char)packet[pos+3];
+      pos+=4;
+
+      if(pos + len > end)
+        break;
+
+      eo->d_options.push_back(make_pair(code, string(packet + pos, len)));
+      pos+=len;
+    }
+    return true;
+  }
+  return false;
+}
 
 void reportBasicTypes()
 {
@@ -543,6 +543,7 @@ struct EDNSOpts
 
 class MOADNSParser;
 bool getEDNSOpts(const MOADNSParser& mdp, EDNSOpts* eo);
+bool getEDNSOpts(const StreamingDNSParser& sp, EDNSOpts* eo);
 
 void reportBasicTypes();
 void reportOtherTypes();
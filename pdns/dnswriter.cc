@@ -7,6 +7,8 @@
 DNSPacketWriter::DNSPacketWriter(vector<uint8_t>& content, const string& qname, uint16_t  qtype, uint16_t qclass, uint8_t opcode)
   : d_pos(0), d_content(content), d_qname(qname), d_qtype(qtype), d_qclass(qclass), d_canonic(false), d_lowerCase(false)
 {
+  memset(d_compress, 0, sizeof(d_compress));
+  d_compressUsed=0;
   d_content.clear();
   dnsheader dnsheader;
   
@@ -45,7 +47,6 @@ DNSPacketWriter::DNSPacketWriter(vector<uint8_t>& content, const string& qname,
   memcpy(&*i, &qclass, 2);
 
   d_stuff=0xffff;
-  d_labelmap.reserve(16);
 }
 
 dnsheader* DNSPacketWriter::getHeader()
@@ -156,15 +157,6 @@ void DNSPacketWriter::xfrText(const string& text, bool)
   }
 }
 
-DNSPacketWriter::lmap_t::iterator find(DNSPacketWriter::lmap_t& lmap, const string& label)
-{
-  DNSPacketWriter::lmap_t::iterator ret;
-  for(ret=lmap.begin(); ret != lmap.end(); ++ret)
-    if(pdns_iequals(ret->first ,label))
-      break;
-  return ret;
-}
-
 //! tokenize a label into parts, the parts describe a begin offset and an end offset
 bool labeltokUnescape(labelparts_t& parts, const string& label)
 {
@@ -191,12 +183,72 @@ bool labeltokUnescape(labelparts_t& parts, const string& label)
   return unescapedSomething;
 }
 
-// this is the absolute hottest function in the pdns recursor 
-void DNSPacketWriter::xfrLabel(const string& Label, bool compress)
+//! the len bytes at offset in the packet as it will be once committed, 0 if they are not all written (and in one piece) yet
+const uint8_t* DNSPacketWriter::bytesAt(unsigned int offset, unsigned int len) const
 {
-  string label = d_lowerCase ? toLower(Label) : Label;
-  labelparts_t parts;
+  if(offset + len <= d_content.size())
+    return &d_content[offset];
+  if(offset < d_content.size() + d_stuff)
+    return 0;
+  offset -= d_content.size() + d_stuff;
+  if(offset + len <= d_record.size())
+    return &d_record[offset];
+  return 0;
+}
+
+//! checks if the name in the packet at offset equals labels first and onwards of d_parts, following compression pointers
+bool DNSPacketWriter::nameMatches(unsigned int offset, const char* data, unsigned int first) const
+{
+  unsigned int hops=0;
+  for(;;) {
+    const uint8_t* ptr=bytesAt(offset, 1);
+    if(!ptr)
+      return false;
+    unsigned int len=*ptr;
+    if((len & 0xc0) == 0xc0) {
+      if(!(ptr=bytesAt(offset, 2)) || ++hops > 64)
+        return false;
+      offset=((len & 0x3f) << 8) | ptr[1];
+      continue;
+    }
+    if(!len)
+      return first == d_parts.size();
+    if(first == d_parts.size() || len != d_parts[first].second - d_parts[first].first || !(ptr=bytesAt(offset, len + 1)))
+      return false;
+    const char* label=data + d_parts[first].first;
+    for(unsigned int n=0; n < len; ++n)
+      if(dns_tolower(ptr[n+1]) != dns_tolower(label[n]))
+        return false;
+    offset+=len+1;
+    ++first;
+  }
+}
 
+//! returns the offset of a name equal to labels first and onwards of d_parts, 0 if we did not write it before
+uint16_t DNSPacketWriter::findCompressed(uint32_t hash, const char* data, unsigned int first) const
+{
+  uint16_t tag=hash >> 16;
+  for(unsigned int n=hash & (s_compressSlots - 1); d_compress[n].offset; n=(n + 1) & (s_compressSlots - 1))
+    if(d_compress[n].tag == tag && nameMatches(d_compress[n].offset, data, first))
+      return d_compress[n].offset;
+  return 0;
+}
+
+void DNSPacketWriter::addCompressed(uint32_t hash, uint16_t offset)
+{
+  if(d_compressUsed >= s_compressSlots * 3 / 4) // keep probe sequences short, and at least one slot free
+    return;
+  unsigned int n=hash & (s_compressSlots - 1);
+  while(d_compress[n].offset)
+    n=(n + 1) & (s_compressSlots - 1);
+  d_compress[n].offset=offset;
+  d_compress[n].tag=hash >> 16;
+  d_compressUsed++;
+}
+
+// this is the absolute hottest function in the pdns recursor 
+void DNSPacketWriter::xfrLabel(const string& label, bool compress)
+{
   if(d_canonic)
     compress=false;
 
@@ -205,64 +257,63 @@ void DNSPacketWriter::xfrLabel(const string& Label, bool compress)
     d_record.push_back(0);
     return;
   }
-  bool unescaped=labeltokUnescape(parts, label); 
-  
+
+  const char* data=label.c_str();
+  if(labeltokUnescape(d_parts, label)) { // rare, so allocating here is fine
+    d_unescaped.clear();
+    for(labelparts_t::iterator i=d_parts.begin(); i!=d_parts.end(); ++i) {
+      string part(label.c_str() + i -> first, i->second - i->first);
+      boost::replace_all(part, "\\.", ".");
+      boost::replace_all(part, "\\032", " ");
+      boost::replace_all(part, "\\\\", "\\"); 
+      i->first=d_unescaped.size();
+      d_unescaped.append(part);
+      i->second=d_unescaped.size();
+    }
+    data=d_unescaped.c_str();
+  }
+
+  // hash every suffix of the name, starting from the root, so each label is only looked at once
+  unsigned int nparts=d_parts.size();
+  d_hashes.resize(nparts);
+  uint32_t hash=2166136261U;
+  for(unsigned int n=nparts; n--; ) {
+    string::size_type len=d_parts[n].second - d_parts[n].first;
+    if(!len) // empty label in the middle of name
+      throw MOADNSException("DNSPacketWriter::xfrLabel() found empty label in the middle of name");
+    if(len > 255)
+      throw MOADNSException("DNSPacketWriter::xfrLabel() tried to write an overly large label");
+    hash=pdns_ihash(data + d_parts[n].first, len, (hash ^ len) * 16777619U);
+    d_hashes[n]=hash;
+  }
+
   // d_stuff is amount of stuff that is yet to be written out - the dnsrecordheader for example
   unsigned int pos=d_content.size() + d_record.size() + d_stuff; 
-  string chopped;
-  bool deDot = labellen && (label[labellen-1]=='.'); // make sure we don't store trailing dots in the labelmap
 
-  for(labelparts_t::const_iterator i=parts.begin(); i!=parts.end(); ++i) {
-    if(deDot)
-      chopped.assign(label.c_str() + i->first, labellen - i->first -1);
-    else
-      chopped.assign(label.c_str() + i->first);
-
-    lmap_t::iterator li=d_labelmap.end();
-    // see if we've written out this domain before
-    //    cerr<<"Searching for compression pointer to '"<<chopped<<"', "<<d_labelmap.size()<<" cmp-records"<<endl;
-    if(compress && (li=find(d_labelmap, chopped))!=d_labelmap.end()) {   
-      //      cerr<<"\tFound a compression pointer to '"<<chopped<<"': "<<li->second<<endl;
-      uint16_t offset=li->second;
+  for(unsigned int n=0; n < nparts; ++n) {
+    uint16_t offset=findCompressed(d_hashes[n], data, n);
+    if(compress && offset) {
       offset|=0xc000;
       d_record.push_back((char)(offset >> 8));
       d_record.push_back((char)(offset & 0xff));
-      goto out;                                 // skip trailing 0 in case of compression
+      return;                                   // no trailing 0 in case of compression
     }
-
-    if(li==d_labelmap.end() && pos< 16384) {
-      //      cerr<<"\tStoring a compression pointer to '"<<chopped<<"': "<<pos<<endl;
-      d_labelmap.push_back(make_pair(chopped, pos));                       //  if untrue, we need to count - also, don't store offsets > 16384, won't work
-    }
-
-    if(unescaped) {
-      string part(label.c_str() + i -> first, i->second - i->first);
-      boost::replace_all(part, "\\.", ".");
-      boost::replace_all(part, "\\032", " ");
-      boost::replace_all(part, "\\\\", "\\"); 
-      if(part.size() > 255)
-          throw MOADNSException("DNSPacketWriter::xfrLabel() tried to write an overly large label");
-      d_record.push_back(part.size());
-      unsigned int len=d_record.size();
-      d_record.resize(len + part.size());
-
-      memcpy(((&*d_record.begin()) + len), part.c_str(), part.size());
-      pos+=(part.size())+1;        		 
-    }
-    else {
-      char labelsize=(char)(i->second - i->first);
-      if(!labelsize) // empty label in the middle of name
-        throw MOADNSException("DNSPacketWriter::xfrLabel() found empty label in the middle of name");
-      d_record.push_back(labelsize);
-      unsigned int len=d_record.size();
-      d_record.resize(len + i->second - i->first);
-      memcpy(((&*d_record.begin()) + len), label.c_str() + i-> first, i->second - i->first);
-      pos+=(i->second - i->first)+1;
+    if(!offset && pos < 16384)                  // don't store offsets > 16384, won't work
+      addCompressed(d_hashes[n], pos);
+
+    unsigned int len=d_parts[n].second - d_parts[n].first;
+    d_record.push_back(len);
+    unsigned int rpos=d_record.size();
+    d_record.resize(rpos + len);
+    if(d_lowerCase) {
+      for(unsigned int i=0; i < len; ++i)
+        d_record[rpos + i]=dns_tolower(data[d_parts[n].first + i]);
     }
+    else
+      memcpy(&d_record[rpos], data + d_parts[n].first, len);
+    pos+=len+1;
   }
   d_record.push_back(0);
-
- out:;
 }
 
 void DNSPacketWriter::xfrBlob(const string& blob, int  )
@@ -12,6 +12,9 @@
 #include "dns.hh"
 #include "namespaces.hh"
 
+typedef vector<pair<string::size_type, string::size_type> > labelparts_t;
+bool labeltokUnescape(labelparts_t& parts, const string& label);
+
 /** this class can be used to write DNS packets. It knows about DNS in the sense that it makes 
     the packet header and record headers.
 
@@ -42,7 +45,6 @@ class DNSPacketWriter : public boost::noncopyable
 {
 
 public:
-  typedef vector<pair<string, uint16_t> > lmap_t;
   enum Place {ANSWER=1, AUTHORITY=2, ADDITIONAL=3}; 
 
   //! Start a DNS Packet in the vector passed, with question qname, qtype and qclass
@@ -110,6 +112,21 @@ public:
   }
 
 private:
+  /** Names (and their suffixes) written so far, for compression. Open addressing over a fixed number of slots, each
+      holding the packet offset of a name and some bits of its hash. Candidates are checked against what is actually in the
+      packet, so hash collisions and offsets left behind by rollback() do no harm. */
+  struct CompressSlot
+  {
+    uint16_t offset; //!< 0 means unused, no name ever starts there
+    uint16_t tag;    //!< upper half of the hash of the name
+  };
+  enum { s_compressSlots = 1024 };
+
+  const uint8_t* bytesAt(unsigned int offset, unsigned int len) const;
+  bool nameMatches(unsigned int offset, const char* data, unsigned int first) const;
+  uint16_t findCompressed(uint32_t hash, const char* data, unsigned int first) const;
+  void addCompressed(uint32_t hash, uint16_t offset);
+
   vector <uint8_t>& d_content;
   vector <uint8_t> d_record;
   string d_qname;
@@ -117,7 +134,11 @@ private:
   string d_recordqname;
   uint16_t d_recordqtype, d_recordqclass;
   uint32_t d_recordttl;
-  lmap_t d_labelmap;
+  CompressSlot d_compress[s_compressSlots];
+  unsigned int d_compressUsed;
+  labelparts_t d_parts;      // scratch space for xfrLabel, kept around so it does not allocate for every name
+  vector<uint32_t> d_hashes; // ditto
+  string d_unescaped;        // ditto
   uint16_t d_stuff;
   uint16_t d_sor;
   uint16_t d_rollbackmarker; // start of last complete packet, for rollback
@@ -125,7 +146,5 @@ private:
   bool d_canonic, d_lowerCase;
 };
 
-typedef vector<pair<string::size_type, string::size_type> > labelparts_t;
-bool labeltokUnescape(labelparts_t& parts, const string& label);
 std::vector<string> segmentDNSText(const string& text); // from dnslabeltext.rl
 #endif
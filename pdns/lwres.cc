@@ -108,51 +108,26 @@ int asyncresolve(const ComboAddress& ip, const string& domain, int type, bool do
         	  domain, type, queryfd, now);
   }
   else {
-    try {
-      Socket s((AddressFamily)ip.sin4.sin_family, Stream);
-
-      s.setNonBlocking();
-      ComboAddress local = getQueryLocalAddress(ip.sin4.sin_family, 0);
-
-      s.bind(local);
-        
-      ComboAddress remote = ip;
-      remote.sin4.sin_port = htons(53);      
-      s.connect(remote);
-      
-      uint16_t tlen=htons(vpacket.size());
-      char *lenP=(char*)&tlen;
-      const char *msgP=(const char*)&*vpacket.begin();
-      string packet=string(lenP, lenP+2)+string(msgP, msgP+vpacket.size());
-      
-      ret=asendtcp(packet, &s);
-      if(!(ret>0))           
-        return ret;
-      
-      packet.clear();
-      ret=arecvtcp(packet, 2, &s);
-      if(!(ret > 0))
-        return ret;
-      
-      memcpy(&tlen, packet.c_str(), 2);
-      len=ntohs(tlen); // switch to the 'len' shared with the rest of the function
-      
-      ret=arecvtcp(packet, len, &s);
-      if(!(ret > 0))
-        return ret;
-      
-      if(len > bufsize) {
-        bufsize=len;
-        scoped_array<unsigned char> narray(new unsigned char[bufsize]);
-        buf.swap(narray);
-      }
-      memcpy(buf.get(), packet.c_str(), len);
-
-      ret=1;
-    }
-    catch(NetworkError& ne) {
-      ret = -2; // OS limits error
+    ComboAddress remote = ip;
+    remote.sin4.sin_port = htons(53);
+
+    uint16_t tlen=htons(vpacket.size());
+    char *lenP=(char*)&tlen;
+    const char *msgP=(const char*)&*vpacket.begin();
+    string packet=string(lenP, lenP+2)+string(msgP, msgP+vpacket.size());
+
+    string answer;
+    ret=asendrecvtcp(remote, packet, pw.getHeader()->id, domain, type, &answer); // might reuse a connection to remote
+    if(!(ret > 0))
+      return ret;
+
+    len=answer.size();
+    if(len > bufsize) {
+      bufsize=len;
+      scoped_array<unsigned char> narray(new unsigned char[bufsize]);
+      buf.swap(narray);
     }
+    memcpy(buf.get(), answer.c_str(), len);
   }
 
   
@@ -165,36 +140,45 @@ int asyncresolve(const ComboAddress& ip, const string& domain, int type, bool do
   lwr->d_result.clear();
   try {
     lwr->d_tcbit=0;
-    MOADNSParser mdp((const char*)buf.get(), len);
-    lwr->d_aabit=mdp.d_header.aa;
-    lwr->d_tcbit=mdp.d_header.tc;
-    lwr->d_rcode=mdp.d_header.rcode;
+    StreamingDNSParser sp((const char*)buf.get(), len); // checks the question before spending time on the records
+    lwr->d_aabit=sp.d_header.aa;
+    lwr->d_tcbit=sp.d_header.tc;
+    lwr->d_rcode=sp.d_header.rcode;
     
-    if(mdp.d_header.rcode == RCode::FormErr && mdp.d_qname.empty() && mdp.d_qtype == 0 && mdp.d_qclass == 0) {
+    if(sp.d_header.rcode == RCode::FormErr && !sp.d_qnamepos && sp.d_qtype == 0 && sp.d_qclass == 0) {
       return 1; // this is "success", the error is set in lwr->d_rcode
     }
 
-    if(!pdns_iequals(domain, mdp.d_qname)) { 
-      if(!mdp.d_qname.empty() && domain.find((char)0) == string::npos) {// embedded nulls are too noisy, plus empty domains are too
-        L<<Logger::Notice<<"Packet purporting to come from remote server "<<ip.toString()<<" contained wrong answer: '" << domain << "' != '" << mdp.d_qname << "'" << endl;
+    if(!sp.d_qnamepos || !sp.labelEquals(sp.d_qnamepos, domain)) { 
+      if(sp.d_qnamepos && domain.find((char)0) == string::npos) {// embedded nulls are too noisy, plus empty domains are too
+        L<<Logger::Notice<<"Packet purporting to come from remote server "<<ip.toString()<<" contained wrong answer: '" << domain << "' != '" << sp.getLabel(sp.d_qnamepos) << "'" << endl;
       }
       // unexpected count has already been done @ pdns_recursor.cc
       goto out;
     }
 
-    for(MOADNSParser::answers_t::const_iterator i=mdp.d_answers.begin(); i!=mdp.d_answers.end(); ++i) {          
+    char label[StreamingDNSParser::s_maxLabelLength];
+    StreamingDNSParser::Record rec;
+    while(sp.next(rec)) {
       DNSResourceRecord rr;
       rr.priority = 0;
-      rr.qtype=i->first.d_type;
-      rr.qname=i->first.d_label;
-      rr.ttl=i->first.d_ttl;
-      rr.content=i->first.d_content->getZoneRepresentation();  // this should be the serialised form
-      rr.d_place=(DNSResourceRecord::Place) i->first.d_place;
+      rr.qtype=rec.d_type;
+      rr.qname.assign(label, sp.getLabel(rec.d_labelpos, label, sizeof(label)));
+      rr.ttl=rec.d_ttl;
+      try {
+        rr.content=sp.getContent(rec)->getZoneRepresentation();  // this should be the serialised form
+      }
+      catch(MOADNSException&) {
+        if(sp.d_header.tc) // don't sweat it over truncated packets, like MOADNSParser
+          break;
+        throw;
+      }
+      rr.d_place=(DNSResourceRecord::Place) rec.d_place;
       lwr->d_result.push_back(rr);
     }
 
     EDNSOpts edo;
-    if(EDNS0Level > 1 && getEDNSOpts(mdp, &edo)) {
+    if(EDNS0Level > 1 && getEDNSOpts(sp, &edo)) {
       lwr->d_haveEDNS = true;
       for(vector<pair<uint16_t, string> >::const_iterator iter = edo.d_options.begin();
           iter != edo.d_options.end(); 
@@ -70,10 +70,12 @@ int writen2(int fd, const void *buf, size_t count)
 }
 
 
+//! safe to call from several threads at once, the bind backend reloads zones in parallel
 string nowTime()
 {
   time_t now=time(0);
-  string t=ctime(&now);
+  char buf[32];  // ctime_r wants at least 26
+  string t=ctime_r(&now, buf);
   boost::trim_right(t);
   return t;
 }
@@ -164,11 +166,7 @@ bool ciEqual(const string& a, const string& b)
   if(a.size()!=b.size())
     return false;
 
-  string::size_type pos=0, epos=a.size();
-  for(;pos < epos; ++pos)
-    if(dns_tolower(a[pos])!=dns_tolower(b[pos]))
-      return false;
-  return true;
+  return pdns_imismatch(a.c_str(), b.c_str(), a.size()) == a.size();
 }
 
 /** does domain end on suffix? Is smart about "wwwds9a.nl" "ds9a.nl" not matching */
@@ -180,16 +178,12 @@ bool endsOn(const string &domain, const string &suffix)
   if(domain.size()<=suffix.size())
     return false;
   
-  string::size_type dpos=domain.size()-suffix.size()-1, spos=0;
+  string::size_type dpos=domain.size()-suffix.size()-1;
 
   if(domain[dpos++]!='.')
     return false;
 
-  for(; dpos < domain.size(); ++dpos, ++spos)
-    if(dns_tolower(domain[dpos]) != dns_tolower(suffix[spos]))
-      return false;
-
-  return true;
+  return pdns_imismatch(domain.c_str() + dpos, suffix.c_str(), suffix.size()) == suffix.size();
 }
 
 /** does domain end on suffix? Is smart about "wwwds9a.nl" "ds9a.nl" not matching */
@@ -201,16 +195,199 @@ bool dottedEndsOn(const string &domain, const string &suffix)
   if(domain.size()<=suffix.size())
     return false;
   
-  string::size_type dpos=domain.size()-suffix.size()-1, spos=0;
+  string::size_type dpos=domain.size()-suffix.size()-1;
 
   if(domain[dpos++]!='.')
     return false;
 
-  for(; dpos < domain.size(); ++dpos, ++spos)
-    if(dns_tolower(domain[dpos]) != dns_tolower(suffix[spos]))
-      return false;
+  return pdns_imismatch(domain.c_str() + dpos, suffix.c_str(), suffix.size()) == suffix.size();
+}
 
-  return true;
+/* The case insensitive kernels behind pdns_imismatch(), pdns_tolower() and pdns_ihash(). Uppercase letters are found
+   with two signed compares per vector, bytes from 0x80 upwards count as negative and are therefore never folded, exactly
+   like dns_tolower(). SSE2 is part of x86_64, AVX2 is used if the CPU turns out to have it. The function pointers start
+   out at resolvers, which pick an implementation on first use and point all three at it. Doing it this way instead of
+   from a static initializer means other static initializers can use these safely too. */
+
+#if !defined(__SSE2__)
+static size_t imismatchScalar(const char* a, const char* b, size_t len)
+{
+  size_t n = 0;
+  while(n < len && dns_tolower(a[n]) == dns_tolower(b[n]))
+    ++n;
+  return n;
+}
+
+static void tolowerScalar(char* dst, const char* src, size_t len)
+{
+  for(size_t n = 0; n < len; ++n)
+    dst[n] = dns_tolower(src[n]);
+}
+#endif
+
+static uint32_t ihashScalar(const char* data, size_t len, uint32_t hash)
+{
+  for(size_t n = 0; n < len; ++n) {
+    hash ^= (unsigned char)dns_tolower(data[n]);
+    hash *= 16777619U;
+  }
+  return hash;
+}
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+
+static inline __m128i foldSSE2(__m128i x)
+{
+  __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(x, _mm_set1_epi8('A' - 1)), _mm_cmplt_epi8(x, _mm_set1_epi8('Z' + 1)));
+  return _mm_or_si128(x, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+}
+
+static inline unsigned int diffSSE2(const char* a, const char* b)
+{
+  __m128i x = foldSSE2(_mm_loadu_si128((const __m128i*)a)), y = foldSSE2(_mm_loadu_si128((const __m128i*)b));
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) ^ 0xffff;
+}
+
+// the bytes before n are known to match. Only called with len >= 16, so the last block can simply overlap the one before it
+static inline size_t imismatchSSE2From(const char* a, const char* b, size_t n, size_t len)
+{
+  unsigned int mask;
+  for(; n + 16 <= len; n += 16)
+    if((mask = diffSSE2(a + n, b + n)))
+      return n + __builtin_ctz(mask);
+  if(n < len && (mask = diffSSE2(a + len - 16, b + len - 16)))
+    return len - 16 + __builtin_ctz(mask);
+  return len;
+}
+
+static size_t imismatchSSE2(const char* a, const char* b, size_t len)
+{
+  return imismatchSSE2From(a, b, 0, len);
+}
+
+static inline void foldStoreSSE2(char* dst, const char* src)
+{
+  _mm_storeu_si128((__m128i*)dst, foldSSE2(_mm_loadu_si128((const __m128i*)src)));
+}
+
+// only called with len >= 16. Folding twice does no harm, so the last block overlaps the one before it, even if dst == src
+static void tolowerSSE2(char* dst, const char* src, size_t len)
+{
+  size_t n = 0;
+  for(; n + 16 <= len; n += 16)
+    foldStoreSSE2(dst + n, src + n);
+  if(n < len)
+    foldStoreSSE2(dst + len - 16, src + len - 16);
+}
+
+// FNV-1a is one long chain of multiplications, so only the folding can be done 16 bytes at a time
+static uint32_t ihashSSE2(const char* data, size_t len, uint32_t hash)
+{
+  unsigned char buf[16];
+  size_t n = 0;
+  for(; n + 16 <= len; n += 16) {
+    _mm_storeu_si128((__m128i*)buf, foldSSE2(_mm_loadu_si128((const __m128i*)(data + n))));
+    for(unsigned int i = 0; i < 16; ++i) {
+      hash ^= buf[i];
+      hash *= 16777619U;
+    }
+  }
+  return ihashScalar(data + n, len - n, hash);
+}
+
+#if defined(__x86_64__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define PDNS_AVX2_KERNELS
+#include <immintrin.h>
+
+__attribute__((target("avx2"))) static inline __m256i foldAVX2(__m256i x)
+{
+  __m256i upper = _mm256_and_si256(_mm256_cmpgt_epi8(x, _mm256_set1_epi8('A' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('Z' + 1), x));
+  return _mm256_or_si256(x, _mm256_and_si256(upper, _mm256_set1_epi8(0x20)));
+}
+
+__attribute__((target("avx2"))) static size_t imismatchAVX2(const char* a, const char* b, size_t len)
+{
+  unsigned int mask;
+  size_t n = 0;
+  for(; n + 32 <= len; n += 32) {
+    __m256i x = foldAVX2(_mm256_loadu_si256((const __m256i*)(a + n))), y = foldAVX2(_mm256_loadu_si256((const __m256i*)(b + n)));
+    if((mask = ~(unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y))))
+      return n + __builtin_ctz(mask);
+  }
+  return imismatchSSE2From(a, b, n, len);
+}
+
+// everything stays in this function, calling the SSE2 code would mix in instructions that are slow after AVX ones
+__attribute__((target("avx2"))) static void tolowerAVX2(char* dst, const char* src, size_t len)
+{
+  if(len < 32) {
+    foldStoreSSE2(dst, src);
+    foldStoreSSE2(dst + len - 16, src + len - 16);
+    return;
+  }
+  size_t n = 0;
+  for(; n + 32 <= len; n += 32)
+    _mm256_storeu_si256((__m256i*)(dst + n), foldAVX2(_mm256_loadu_si256((const __m256i*)(src + n))));
+  if(n < len)
+    _mm256_storeu_si256((__m256i*)(dst + len - 32), foldAVX2(_mm256_loadu_si256((const __m256i*)(src + len - 32))));
+}
+#endif
+#endif
+
+static const char* s_ikernel = "scalar";
+
+static void pickIKernels()
+{
+#if defined(__SSE2__)
+#ifdef PDNS_AVX2_KERNELS
+  __builtin_cpu_init(); // we might be called before the constructors have run
+  if(__builtin_cpu_supports("avx2")) {
+    pdns_imismatch_long = imismatchAVX2;
+    pdns_tolower_long = tolowerAVX2;
+    pdns_ihash_long = ihashSSE2; // wider vectors do not help a serial hash
+    s_ikernel = "avx2";
+    return;
+  }
+#endif
+  pdns_imismatch_long = imismatchSSE2;
+  pdns_tolower_long = tolowerSSE2;
+  pdns_ihash_long = ihashSSE2;
+  s_ikernel = "sse2";
+#else
+  pdns_imismatch_long = imismatchScalar;
+  pdns_tolower_long = tolowerScalar;
+  pdns_ihash_long = ihashScalar;
+#endif
+}
+
+static size_t imismatchResolve(const char* a, const char* b, size_t len)
+{
+  pickIKernels();
+  return pdns_imismatch_long(a, b, len);
+}
+
+static void tolowerResolve(char* dst, const char* src, size_t len)
+{
+  pickIKernels();
+  pdns_tolower_long(dst, src, len);
+}
+
+static uint32_t ihashResolve(const char* data, size_t len, uint32_t init)
+{
+  pickIKernels();
+  return pdns_ihash_long(data, len, init);
+}
+
+size_t (*pdns_imismatch_long)(const char* a, const char* b, size_t len) = imismatchResolve;
+void (*pdns_tolower_long)(char* dst, const char* src, size_t len) = tolowerResolve;
+uint32_t (*pdns_ihash_long)(const char* data, size_t len, uint32_t init) = ihashResolve;
+
+const char* pdns_ikernel()
+{
+  if(pdns_imismatch_long == imismatchResolve)
+    pickIKernels();
+  return s_ikernel;
 }
 
 int sendData(const char *buffer, int replen, int outsock)
@@ -227,20 +227,44 @@ inline bool dns_isspace(char c)
 
 inline char dns_tolower(char c)
 {
-  if(c>='A' && c<='Z')
-    c+='a'-'A';
-  return c;
+  return c + (((unsigned char)(c - 'A') < 26) << 5); // no branch, as names mix cases unpredictably
+}
+
+/** Case insensitive helpers that work on 16 or 32 bytes at a time with SSE2 or AVX2, whichever the CPU has, with a
+    plain C++ version for other platforms. The choice is made at runtime, see misc.cc. Inputs shorter than a vector are
+    handled inline, where setting up the vectors would cost more than it saves. */
+extern size_t (*pdns_imismatch_long)(const char* a, const char* b, size_t len);
+extern void (*pdns_tolower_long)(char* dst, const char* src, size_t len);
+extern uint32_t (*pdns_ihash_long)(const char* data, size_t len, uint32_t init);
+const char* pdns_ikernel(); //!< the name of the implementation in use, for speedtest
+
+//! position of the first byte where a and b differ when ignoring case, len if they do not
+inline size_t pdns_imismatch(const char* a, const char* b, size_t len)
+{
+  if(len >= 16)
+    return pdns_imismatch_long(a, b, len);
+  size_t n = 0;
+  while(n < len && dns_tolower(a[n]) == dns_tolower(b[n]))
+    ++n;
+  return n;
+}
+
+//! copies len bytes from src to dst, lowercasing A-Z on the way. dst and src may be the same
+inline void pdns_tolower(char* dst, const char* src, size_t len)
+{
+  if(len >= 16) {
+    pdns_tolower_long(dst, src, len);
+    return;
+  }
+  for(size_t n = 0; n < len; ++n)
+    dst[n] = dns_tolower(src[n]);
 }
 
 inline const string toLower(const string &upper)
 {
   string reply(upper);
-  char c;
-  for(unsigned int i = 0; i < reply.length(); i++) {
-    c = dns_tolower(upper[i]);
-    if( c != upper[i])
-      reply[i] = c;
-  }
+  if(!reply.empty())
+    pdns_tolower(&reply[0], upper.c_str(), upper.length());
   return reply;
 }
 
@@ -307,34 +331,41 @@ inline bool operator<(const struct timeval& lhs, const struct timeval& rhs)
 inline bool pdns_ilexicographical_compare(const std::string& a, const std::string& b)  __attribute__((pure));
 inline bool pdns_ilexicographical_compare(const std::string& a, const std::string& b) 
 {
-  string::size_type aLen = a.length(), bLen = b.length(), n;
-  const unsigned char *aPtr = (const unsigned char*)a.c_str(), *bPtr = (const unsigned char*)b.c_str();
-  int result;
+  string::size_type aLen = a.length(), bLen = b.length(), len = min(aLen, bLen);
+  const char *aPtr = a.c_str(), *bPtr = b.c_str();
   
-  for(n = 0 ; n < aLen && n < bLen ; ++n) {
-      if((result = dns_tolower(*aPtr++) - dns_tolower(*bPtr++))) {
-        return result < 0;
-      }
-  }
-  if(n == aLen && n == bLen) // strings are equal (in length)
-    return 0; 
-  if(n == aLen) // first string was shorter
-    return true; 
-  return false;
+  string::size_type n = pdns_imismatch(aPtr, bPtr, len);
+  if(n < len)
+    return dns_tolower(aPtr[n]) < dns_tolower(bPtr[n]);
+  return aLen < bLen; // first string was shorter
 }
 
 inline bool pdns_iequals(const std::string& a, const std::string& b) __attribute__((pure));
 
 inline bool pdns_iequals(const std::string& a, const std::string& b) 
 {
-  string::size_type aLen = a.length(), bLen = b.length(), n;
-  const char *aPtr = a.c_str(), *bPtr = b.c_str();
-  
-  for(n = 0 ; n < aLen && n < bLen ; ++n) {
-      if(dns_tolower(*aPtr++) != dns_tolower(*bPtr++))
-        return false;
+  string::size_type len = a.length();
+  return len == b.length() && pdns_imismatch(a.c_str(), b.c_str(), len) == len;
+}
+
+/** case insensitive FNV-1a over a name, so 'PowerDNS.COM' and 'powerdns.com' hash the same */
+inline uint32_t pdns_ihash(const char* data, size_t len, uint32_t init=2166136261U) __attribute__((pure));
+
+inline uint32_t pdns_ihash(const char* data, size_t len, uint32_t init)
+{
+  if(len >= 32)
+    return pdns_ihash_long(data, len, init);
+  uint32_t hash = init;
+  for(size_t n = 0; n < len; ++n) {
+    hash ^= (unsigned char)dns_tolower(data[n]);
+    hash *= 16777619U;
   }
-  return aLen == bLen; // strings are equal (in length)
+  return hash;
+}
+
+inline uint32_t pdns_ihash(const std::string& a, uint32_t init=2166136261U)
+{
+  return pdns_ihash(a.c_str(), a.length(), init);
 }
 
 // lifted from boost, with thanks
@@ -403,6 +434,22 @@ struct CIStringCompare: public std::binary_function<string, string, bool>
   }
 };
 
+struct CIStringHash: public std::unary_function<string, size_t>
+{
+  size_t operator()(const string& a) const
+  {
+    return pdns_ihash(a);
+  }
+};
+
+struct CIStringEqual: public std::binary_function<string, string, bool>
+{
+  bool operator()(const string& a, const string& b) const
+  {
+    return pdns_iequals(a, b);
+  }
+};
+
 struct CIStringPairCompare: public std::binary_function<pair<string, uint16_t>, pair<string,uint16_t>, bool>  
 {
   bool operator()(const pair<string, uint16_t>& a, const pair<string, uint16_t>& b) const
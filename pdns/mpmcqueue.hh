@@ -0,0 +1,260 @@
+/*
+    PowerDNS Versatile Database Driven Nameserver
+    Copyright (C) 2013  PowerDNS.COM BV
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License version 2
+    as published by the Free Software Foundation
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#ifndef PDNS_MPMCQUEUE_HH
+#define PDNS_MPMCQUEUE_HH
+
+#include <vector>
+#include <boost/utility.hpp>
+#include "utility.hh"
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
+
+/** Bounded multi producer, multi consumer queue that does not take locks. Each slot carries a sequence number
+    which tells producers and consumers whose turn it is, so the only contended operations are a single
+    compare and swap on the head or tail position (after Dmitry Vyukov's design).
+
+    Capacity is rounded up to a power of two. push() returns false when the queue is full, pop() returns false when
+    it is empty. Neither ever blocks, pair this with a LightSemaphore to sleep when there is nothing to do. */
+template<typename T> class MPMCQueue : public boost::noncopyable
+{
+public:
+  explicit MPMCQueue(unsigned int capacity)
+  {
+    unsigned int size=2;
+    while(size < capacity)
+      size <<= 1;
+    d_mask = size - 1;
+    d_cells.resize(size);
+    for(unsigned int n = 0; n < size; ++n)
+      d_cells[n].seq = n;
+    d_enqueuePos = d_dequeuePos = 0;
+  }
+
+  bool push(const T& data)
+  {
+    Cell* cell;
+    unsigned int pos = d_enqueuePos;
+    for(;;) {
+      cell = &d_cells[pos & d_mask];
+      unsigned int seq = cell->seq;
+      __sync_synchronize();
+      int dif = (int)seq - (int)pos;
+      if(!dif) {
+        if(__sync_bool_compare_and_swap(&d_enqueuePos, pos, pos + 1))
+          break;
+        pos = d_enqueuePos;
+      }
+      else if(dif < 0)
+        return false; // full
+      else
+        pos = d_enqueuePos;
+    }
+    cell->data = data;
+    __sync_synchronize();
+    cell->seq = pos + 1;
+    return true;
+  }
+
+  bool pop(T* data)
+  {
+    Cell* cell;
+    unsigned int pos = d_dequeuePos;
+    for(;;) {
+      cell = &d_cells[pos & d_mask];
+      unsigned int seq = cell->seq;
+      __sync_synchronize();
+      int dif = (int)seq - (int)(pos + 1);
+      if(!dif) {
+        if(__sync_bool_compare_and_swap(&d_dequeuePos, pos, pos + 1))
+          break;
+        pos = d_dequeuePos;
+      }
+      else if(dif < 0)
+        return false; // empty
+      else
+        pos = d_dequeuePos;
+    }
+    *data = cell->data;
+    __sync_synchronize();
+    cell->seq = pos + d_mask + 1;
+    return true;
+  }
+
+  //! approximate number of queued items, without taking any lock
+  unsigned int size() const
+  {
+    int ret = (int)(d_enqueuePos - d_dequeuePos);
+    return ret > 0 ? ret : 0;
+  }
+
+  unsigned int capacity() const
+  {
+    return d_mask + 1;
+  }
+
+private:
+  struct Cell
+  {
+    volatile unsigned int seq;
+    T data;
+  };
+  std::vector<Cell> d_cells;
+  unsigned int d_mask;
+  char d_pad1[64];                    // keep producers and consumers off each other's cache line
+  volatile unsigned int d_enqueuePos;
+  char d_pad2[64];
+  volatile unsigned int d_dequeuePos;
+  char d_pad3[64];
+};
+
+/** Bounded single producer, single consumer ring. Cheaper than MPMCQueue as it needs no compare and swap at all: only the
+    producer moves d_head, only the consumer moves d_tail. Items are filled in and used where they sit in the ring, so large
+    items are not copied around.
+
+    The producer calls reserve() to get a free slot (0 if the ring is full), fills it in and then calls push(). The consumer calls
+    front() to get the oldest item (0 if the ring is empty) and pop() once it is done with it. push() tells if the consumer might
+    have seen an empty ring and gone to sleep, so the producer only needs to wake it up in that case. */
+template<typename T> class SPSCRing : public boost::noncopyable
+{
+public:
+  explicit SPSCRing(unsigned int capacity)
+  {
+    unsigned int size=2;
+    while(size < capacity)
+      size <<= 1;
+    d_mask = size - 1;
+    d_items.resize(size);
+    d_head = d_tail = 0;
+  }
+
+  T* reserve()
+  {
+    if(d_head - d_tail > d_mask)
+      return 0; // full
+    return &d_items[d_head & d_mask];
+  }
+
+  //! publishes the slot handed out by reserve(), returns true if the consumer may need waking up
+  bool push()
+  {
+    __sync_synchronize();
+    unsigned int head = ++d_head;
+    __sync_synchronize(); // pairs with the one in pop(), either we see the consumer catching up, or it sees our new item
+    return d_tail == head - 1;
+  }
+
+  T* front()
+  {
+    if(d_tail == d_head)
+      return 0; // empty
+    __sync_synchronize();
+    return &d_items[d_tail & d_mask];
+  }
+
+  void pop()
+  {
+    __sync_synchronize();
+    ++d_tail;
+    __sync_synchronize();
+  }
+
+private:
+  std::vector<T> d_items;
+  unsigned int d_mask;
+  char d_pad1[64];
+  volatile unsigned int d_head;
+  char d_pad2[64];
+  volatile unsigned int d_tail;
+  char d_pad3[64];
+};
+
+/** Counting semaphore that stays in userspace as long as nobody needs to sleep. post() and wait() are a single
+    atomic operation in the uncontended case, only a waiter that finds the count at zero goes to the kernel,
+    through a futex on Linux and through our regular Semaphore elsewhere. */
+class LightSemaphore : public boost::noncopyable
+{
+public:
+  LightSemaphore() : d_count(0)
+#ifdef __linux__
+                   , d_wakeups(0)
+#endif
+  {}
+
+  void post()
+  {
+    if(__sync_fetch_and_add(&d_count, 1) < 0) { // somebody is sleeping, or about to
+#ifdef __linux__
+      __sync_fetch_and_add(&d_wakeups, 1);
+      syscall(SYS_futex, &d_wakeups, FUTEX_WAKE_PRIVATE, 1, 0, 0, 0);
+#else
+      d_sem.post();
+#endif
+    }
+  }
+
+  void wait()
+  {
+    if(__sync_fetch_and_sub(&d_count, 1) > 0)
+      return;
+#ifdef __linux__
+    for(;;) {
+      int wakeups = d_wakeups;
+      if(wakeups > 0) {
+        if(__sync_bool_compare_and_swap(&d_wakeups, wakeups, wakeups - 1))
+          return;
+      }
+      else
+        syscall(SYS_futex, &d_wakeups, FUTEX_WAIT_PRIVATE, 0, 0, 0, 0); // returns at once if d_wakeups is no longer 0
+    }
+#else
+    d_sem.wait();
+#endif
+  }
+
+  //! takes one from the count if that does not involve waiting
+  bool tryWait()
+  {
+    int count = d_count;
+    while(count > 0) {
+      if(__sync_bool_compare_and_swap(&d_count, count, count - 1))
+        return true;
+      count = d_count;
+    }
+    return false;
+  }
+
+  int getValue() const
+  {
+    int count = d_count;
+    return count > 0 ? count : 0;
+  }
+
+private:
+  volatile int d_count; // negative: the number of sleepers
+#ifdef __linux__
+  volatile int d_wakeups;
+#else
+  Semaphore d_sem;
+#endif
+};
+
+#endif
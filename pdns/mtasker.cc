@@ -31,7 +31,7 @@
     code that would ordinarily require a statemachine, for which the author does not consider 
     himself smart enough.
 
-    This class does not perform any magic it only makes calls to makecontext() and swapcontext(). 
+    This class does not perform any magic it only makes calls to pdns_makecontext() and pdns_swapcontext(), see mtasker_context.hh. 
     Getting the details right however is complicated and MTasker does that for you.
 
     If preemptive multitasking or more advanced concepts such as semaphores, locks or mutexes
@@ -165,7 +165,7 @@ template<class EventKey, class EventVal>int MTasker<EventKey,EventVal>::waitEven
   }
 
   Waiter w;
-  w.context=new ucontext_t;
+  w.context=new pdns_ucontext_t;
   w.ttd.tv_sec = 0; w.ttd.tv_usec = 0;
   if(timeoutMsec) {
     struct timeval increment;
@@ -185,10 +185,7 @@ template<class EventKey, class EventVal>int MTasker<EventKey,EventVal>::waitEven
 
   d_waiters.insert(w);
   
-  if(swapcontext(d_waiters.find(key)->context,&d_kernel)) { // 'A' will return here when 'key' has arrived, hands over control to kernel first
-    perror("swapcontext");
-    exit(EXIT_FAILURE); // no way we can deal with this 
-  }
+  pdns_swapcontext(*d_waiters.find(key)->context, d_kernel); // 'A' will return here when 'key' has arrived, hands over control to kernel first
   if(val && d_waitstatus==Answer) 
     *val=d_waitval;
   d_tid=w.tid;
@@ -205,10 +202,7 @@ template<class EventKey, class EventVal>int MTasker<EventKey,EventVal>::waitEven
 template<class Key, class Val>void MTasker<Key,Val>::yield()
 {
   d_runQueue.push(d_tid);
-  if(swapcontext(d_threads[d_tid].context ,&d_kernel) < 0) { // give control to the kernel
-    perror("swapcontext in  yield");
-    exit(EXIT_FAILURE);
-  }
+  pdns_swapcontext(*d_threads[d_tid].context, d_kernel); // give control to the kernel
 }
 
 //! reports that an event took place for which threads may be waiting
@@ -232,29 +226,15 @@ template<class EventKey, class EventVal>int MTasker<EventKey,EventVal>::sendEven
   if(val)
     d_waitval=*val;
   
-  ucontext_t *userspace=waiter->context;
+  pdns_ucontext_t *userspace=waiter->context;
   d_tid=waiter->tid;         // set tid 
   d_eventkey=waiter->key;        // pass waitEvent the exact key it was woken for
   d_waiters.erase(waiter);             // removes the waitpoint 
-  if(swapcontext(&d_kernel,userspace)) { // swaps back to the above point 'A'
-    perror("swapcontext in sendEvent");
-    exit(EXIT_FAILURE);
-  }
+  pdns_swapcontext(d_kernel, *userspace); // swaps back to the above point 'A'
   delete userspace;
   return 1;
 }
 
-inline pair<uint32_t, uint32_t> splitPointer(void *ptr)
-{
-  uint64_t ll = (uint64_t) ptr;
-  return make_pair(ll >> 32, ll & 0xffffffff);
-}
-
-inline void* joinPtr(uint32_t val1, uint32_t val2)
-{
-  return (void*)(((uint64_t)val1 << 32) | (uint64_t)val2);
-}
-
 //! launches a new thread
 /** The kernel can call this to make a new thread, which starts at the function start and gets passed the val void pointer.
     \param start Pointer to the function which will form the start of the thread
@@ -262,22 +242,57 @@ inline void* joinPtr(uint32_t val1, uint32_t val2)
 */
 template<class Key, class Val>void MTasker<Key,Val>::makeThread(tfunc_t *start, void* val)
 {
-  ucontext_t *uc=new ucontext_t;
-  getcontext(uc);
-  
+  char* stack=getStack();
+  pdns_ucontext_t *uc=new pdns_ucontext_t;
   uc->uc_link = &d_kernel; // come back to kernel after dying
-  uc->uc_stack.ss_sp = new char[d_stacksize];
-  
-  uc->uc_stack.ss_size = d_stacksize;
-  pair<uint32_t, uint32_t> valpair = splitPointer(val);
-  pair<uint32_t, uint32_t> thispair = splitPointer(this);
+  ThreadInfo& ti=d_threads[d_maxtid];
+  ti.context = uc;
+  ti.stack = stack;
+  ti.start = start;
+  ti.startVal = val;
+  pdns_makecontext(*uc, ti.stack, d_stacksize, threadWrapper, this);
+  d_runQueue.push(d_maxtid++); // will run at next schedule invocation
+}
 
-  makecontext (uc, (void (*)(void))threadWrapper, 6, thispair.first, thispair.second, start, d_maxtid, valpair.first, valpair.second);
 
-  d_threads[d_maxtid].context = uc;
-  d_runQueue.push(d_maxtid++); // will run at next schedule invocation
+//! hands out a stack for a new thread, from the pool if possible
+template<class Key, class Val>char* MTasker<Key,Val>::getStack()
+{
+  if(!d_freeStacks.empty()) {
+    char* stack=d_freeStacks.back();
+    d_freeStacks.pop_back();
+    return stack;
+  }
+  char* mem=(char*)mmap(0, d_pagesize + d_stacksize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(mem == MAP_FAILED)
+    throw std::bad_alloc();
+  if(mprotect(mem, d_pagesize, PROT_NONE) < 0) { // stacks grow down, so the guard goes below
+    munmap(mem, d_pagesize + d_stacksize);
+    throw std::bad_alloc();
+  }
+  return mem + d_pagesize;
 }
 
+//! takes back the stack of a finished thread
+/** Stacks are kept for reuse, up to d_maxFreeStacks of them. Each one is handed back to the kernel with madvise(), so an idle
+    stack costs no memory, and it comes back zeroed. Every so often a stack is first checked for how deep it was ever used:
+    since it started out zeroed, the lowest byte that is not zero is as far as any thread ever got.
+*/
+template<class Key, class Val>void MTasker<Key,Val>::releaseStack(char* stack)
+{
+  if(d_maxFreeStacks && d_freeStacks.size() >= d_maxFreeStacks) {
+    munmap(stack - d_pagesize, d_pagesize + d_stacksize);
+    return;
+  }
+  if(!(d_stackReleases++ % 64)) {
+    char* p=stack;
+    while(p < stack + d_stacksize && !*p)
+      ++p;
+    d_stackHighWater=max(d_stackHighWater, (size_t)(stack + d_stacksize - p));
+  }
+  madvise(stack, d_stacksize, MADV_DONTNEED);
+  d_freeStacks.push_back(stack);
+}
 
 //! needs to be called periodically so threads can run and housekeeping can be performed
 /** The kernel should call this function every once in a while. It makes sense
@@ -293,16 +308,13 @@ template<class Key, class Val>bool MTasker<Key,Val>::schedule(struct timeval*  n
 {
   if(!d_runQueue.empty()) {
     d_tid=d_runQueue.front();
-    if(swapcontext(&d_kernel, d_threads[d_tid].context)) {
-      perror("swapcontext in schedule");
-      exit(EXIT_FAILURE);
-    }
+    pdns_swapcontext(d_kernel, *d_threads[d_tid].context);
       
     d_runQueue.pop();
     return true;
   }
   if(!d_zombiesQueue.empty()) {
-    delete[] (char *)d_threads[d_zombiesQueue.front()].context->uc_stack.ss_sp;
+    releaseStack(d_threads[d_zombiesQueue.front()].stack);
     delete d_threads[d_zombiesQueue.front()].context;
     d_threads.erase(d_zombiesQueue.front());
     d_zombiesQueue.pop();
@@ -323,13 +335,10 @@ template<class Key, class Val>bool MTasker<Key,Val>::schedule(struct timeval*  n
       if(i->ttd.tv_sec && i->ttd < rnow) {
         d_waitstatus=TimeOut;
         d_eventkey=i->key;        // pass waitEvent the exact key it was woken for
-        ucontext_t* uc = i->context;
+        pdns_ucontext_t* uc = i->context;
         ttdindex.erase(i++);                  // removes the waitpoint 
 
-        if(swapcontext(&d_kernel, uc)) { // swaps back to the above point 'A'
-          perror("swapcontext in schedule2");
-          exit(EXIT_FAILURE);
-        }
+        pdns_swapcontext(d_kernel, *uc); // swaps back to the above point 'A'
         delete uc;
       }
       else if(i->ttd.tv_sec)
@@ -372,14 +381,14 @@ template<class Key, class Val>void MTasker<Key,Val>::getEvents(std::vector<Key>&
   }
 }
 
-template<class Key, class Val>void MTasker<Key,Val>::threadWrapper(uint32_t self1, uint32_t self2, tfunc_t *tf, int tid, uint32_t val1, uint32_t val2)
+template<class Key, class Val>void MTasker<Key,Val>::threadWrapper(void* p)
 {
-  void* val = joinPtr(val1, val2); 
-  MTasker* self = (MTasker*) joinPtr(self1, self2);
-  self->d_threads[self->d_tid].startOfStack = self->d_threads[self->d_tid].highestStackSeen = (char*)&val;
-  (*tf)(val);
+  MTasker* self = (MTasker*) p;
+  int tid = self->d_tid; // schedule() set this to us before switching here
+  ThreadInfo& ti = self->d_threads[tid];
+  ti.startOfStack = ti.highestStackSeen = (char*)&tid;
+  (*ti.start)(ti.startVal);
   self->d_zombiesQueue.push(tid);
-  
   // we now jump to &kernel, automatically
 }
 
@@ -398,3 +407,23 @@ template<class Key, class Val>unsigned int MTasker<Key,Val>::getMaxStackUsage()
 {
   return d_threads[d_tid].startOfStack - d_threads[d_tid].highestStackSeen;
 }
+
+//! Returns the deepest stack use seen so far, over all MThreads
+/** This is measured on a sample of the stacks of finished MThreads, so it lags behind a bit, but unlike getMaxStackUsage() it
+    also sees how deep a thread went between calls to waitEvent(). */
+template<class Key, class Val>size_t MTasker<Key,Val>::getStackHighWater()
+{
+  return d_stackHighWater;
+}
+
+//! Returns the number of stacks that are kept for reuse
+template<class Key, class Val>size_t MTasker<Key,Val>::numFreeStacks()
+{
+  return d_freeStacks.size();
+}
+
+template<class Key, class Val>MTasker<Key,Val>::~MTasker()
+{
+  for(typename std::vector<char*>::const_iterator i=d_freeStacks.begin(); i != d_freeStacks.end(); ++i)
+    munmap(*i - d_pagesize, d_pagesize + d_stacksize);
+}
@@ -24,14 +24,17 @@
 #else
 
 #include <signal.h>
-#include <ucontext.h>
 #include <queue>
 #include <vector> 
+#include <new>
 #include <map>
 #include <time.h>
+#include <sys/mman.h>
+#include <unistd.h>
 #include <boost/multi_index_container.hpp>
 #include <boost/multi_index/ordered_index.hpp>
 #include <boost/multi_index/key_extractors.hpp>
+#include "mtasker_context.hh"
 #include "namespaces.hh"
 using namespace ::boost::multi_index;
 
@@ -46,13 +49,16 @@ struct KeyTag {};
 template<class EventKey=int, class EventVal=int> class MTasker
 {
 private:
-  ucontext_t d_kernel;     
+  pdns_ucontext_t d_kernel;     
   std::queue<int> d_runQueue;
   std::queue<int> d_zombiesQueue;
 
   struct ThreadInfo
   {
-	ucontext_t* context;
+	pdns_ucontext_t* context;
+	char* stack;
+	void (*start)(void*);
+	void* startVal;
 	char* startOfStack;
 	char* highestStackSeen;
   };
@@ -62,6 +68,11 @@ private:
   int d_tid;
   int d_maxtid;
   size_t d_stacksize;
+  size_t d_pagesize;
+  std::vector<char*> d_freeStacks; //!< stacks of threads that are done, for reuse by the next ones
+  size_t d_maxFreeStacks;
+  unsigned int d_stackReleases;
+  size_t d_stackHighWater;
 
   EventVal d_waitval;
   enum waitstatusenum {Error=-1,TimeOut=0,Answer} d_waitstatus;
@@ -70,7 +81,7 @@ public:
   struct Waiter
   {
     EventKey key;
-    ucontext_t *context;
+    pdns_ucontext_t *context;
     struct timeval ttd;
     int tid;    
   };
@@ -90,10 +101,16 @@ public:
       This limit applies solely to the stack, the heap is not limited in any way. If threads need to allocate a lot of data,
       the use of new/delete is suggested. 
    */
-  MTasker(size_t stacksize=8192) : d_stacksize(stacksize)
+  /** Stacks are mmap()ed with a guard page below them, so overflowing one crashes right away instead of scribbling over memory.
+      Up to maxFreeStacks stacks of finished threads are kept for reuse by new threads, 0 means no limit.
+   */
+  MTasker(size_t stacksize=8192, size_t maxFreeStacks=0) : d_maxFreeStacks(maxFreeStacks), d_stackReleases(0), d_stackHighWater(0)
   {
     d_maxtid=0;
+    d_pagesize=sysconf(_SC_PAGESIZE);
+    d_stacksize=(stacksize + d_pagesize - 1) / d_pagesize * d_pagesize;
   }
+  ~MTasker();
 
   typedef void tfunc_t(void *); //!< type of the pointer that starts a thread 
   int waitEvent(EventKey &key, EventVal *val=0, unsigned int timeoutMsec=0, struct timeval* now=0);
@@ -106,9 +123,13 @@ public:
   unsigned int numProcesses();
   int getTid(); 
   unsigned int getMaxStackUsage();
+  size_t getStackHighWater();
+  size_t numFreeStacks();
 
 private:
-  static void threadWrapper(uint32_t self1, uint32_t self2, tfunc_t *tf, int tid, uint32_t val1, uint32_t val2);
+  char* getStack();
+  void releaseStack(char* stack);
+  static void threadWrapper(void* self);
   EventKey d_eventkey;   // for waitEvent, contains exact key it was awoken for
 };
 #include "mtasker.cc"
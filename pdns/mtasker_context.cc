@@ -0,0 +1,95 @@
+/*
+    PowerDNS Versatile Database Driven Nameserver
+    Copyright (C) 2013  PowerDNS.COM BV
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License version 2
+    as published by the Free Software Foundation
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#include "mtasker_context.hh"
+
+#ifdef MTASKER_FCONTEXT
+
+/* pdns_jump_fcontext(void** save, void* next) pushes the registers a called function has to preserve, plus the SSE and x87
+   control words, stores the resulting stack pointer in *save, and then does the reverse on the stack next points to. A new
+   context starts out with a stack that looks like it was saved here, with pdns_fcontext_trampoline as return address. */
+__asm__(
+  ".text\n"
+  ".globl pdns_jump_fcontext\n"
+  ".type pdns_jump_fcontext,@function\n"
+  ".align 16\n"
+  "pdns_jump_fcontext:\n"
+  "  pushq %rbp\n"
+  "  pushq %rbx\n"
+  "  pushq %r12\n"
+  "  pushq %r13\n"
+  "  pushq %r14\n"
+  "  pushq %r15\n"
+  "  subq $8, %rsp\n"
+  "  stmxcsr (%rsp)\n"
+  "  fnstcw 4(%rsp)\n"
+  "  movq %rsp, (%rdi)\n"
+  "  movq %rsi, %rsp\n"
+  "  ldmxcsr (%rsp)\n"
+  "  fldcw 4(%rsp)\n"
+  "  addq $8, %rsp\n"
+  "  popq %r15\n"
+  "  popq %r14\n"
+  "  popq %r13\n"
+  "  popq %r12\n"
+  "  popq %rbx\n"
+  "  popq %rbp\n"
+  "  ret\n"
+  ".size pdns_jump_fcontext,.-pdns_jump_fcontext\n"
+
+  ".globl pdns_fcontext_trampoline\n"
+  ".type pdns_fcontext_trampoline,@function\n"
+  ".align 16\n"
+  "pdns_fcontext_trampoline:\n"
+  "  movq %r12, %rdi\n"
+  "  call pdns_fcontext_run\n"
+  "  ud2\n"
+  ".size pdns_fcontext_trampoline,.-pdns_fcontext_trampoline\n"
+);
+
+extern "C" void pdns_fcontext_trampoline();
+
+//! runs the function of a new context, and moves on to uc_link when it returns
+extern "C" void pdns_fcontext_run(pdns_ucontext_t* ctx)
+{
+  ctx->d_func(ctx->d_arg);
+  void* dummy;
+  pdns_jump_fcontext(&dummy, ctx->uc_link->d_sp); // we never come back here
+  abort();
+}
+
+//! sets up ctx to call func(arg) on the given stack, and continue with ctx.uc_link once that returns
+void pdns_makecontext(pdns_ucontext_t& ctx, char* stack, size_t size, pdns_ctxfunc_t* func, void* arg)
+{
+  ctx.d_func = func;
+  ctx.d_arg = arg;
+
+  // the return address goes where the stack is 16 byte aligned after 'ret', as the ABI wants it when calling a function
+  uint64_t* top = (uint64_t*)((uintptr_t)(stack + size) & ~(uintptr_t)15);
+  uint64_t* sp = top - 3;
+  *sp = (uint64_t)pdns_fcontext_trampoline;
+  *--sp = 0;                  // rbp
+  *--sp = 0;                  // rbx
+  *--sp = (uint64_t)&ctx;     // r12, passed to pdns_fcontext_run by the trampoline
+  *--sp = 0;                  // r13
+  *--sp = 0;                  // r14
+  *--sp = 0;                  // r15
+  *--sp = 0x037FULL << 32 | 0x1F80; // x87 control word and MXCSR, their defaults
+  ctx.d_sp = sp;
+}
+
+#endif
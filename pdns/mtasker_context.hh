@@ -0,0 +1,107 @@
+/*
+    PowerDNS Versatile Database Driven Nameserver
+    Copyright (C) 2013  PowerDNS.COM BV
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License version 2
+    as published by the Free Software Foundation
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#ifndef MTASKER_CONTEXT_HH
+#define MTASKER_CONTEXT_HH
+
+/** Context switching for MTasker. swapcontext() saves and restores the signal mask on every switch, which costs a
+    rt_sigprocmask system call in each direction. On x86_64 we therefore switch with a few lines of assembly (in
+    mtasker_context.cc) that only save the registers the ABI says a function call preserves, and never enter the kernel.
+    Compile with -DMTASKER_UCONTEXT to use ucontext anyhow, which is also what other platforms get. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <utility>
+
+#if !defined(MTASKER_UCONTEXT) && defined(__x86_64__) && defined(__ELF__) && defined(__GNUC__)
+#define MTASKER_FCONTEXT
+#else
+#include <ucontext.h>
+#endif
+
+typedef void pdns_ctxfunc_t(void*);
+
+struct pdns_ucontext_t
+{
+  pdns_ucontext_t() : uc_link(0)
+#ifdef MTASKER_FCONTEXT
+                    , d_sp(0), d_func(0), d_arg(0)
+#endif
+  {}
+  pdns_ucontext_t* uc_link; //!< where to continue once the function of a context returns
+#ifdef MTASKER_FCONTEXT
+  void* d_sp;               //!< stack pointer, the registers are saved on the stack itself
+  pdns_ctxfunc_t* d_func;
+  void* d_arg;
+#else
+  ucontext_t d_uc;
+#endif
+};
+
+#ifdef MTASKER_FCONTEXT
+extern "C" void pdns_jump_fcontext(void** save, void* next);
+void pdns_makecontext(pdns_ucontext_t& ctx, char* stack, size_t size, pdns_ctxfunc_t* func, void* arg);
+
+//! saves the current context in save, and continues with next
+inline void pdns_swapcontext(pdns_ucontext_t& save, const pdns_ucontext_t& next)
+{
+  pdns_jump_fcontext(&save.d_sp, next.d_sp);
+}
+
+#else
+
+inline std::pair<uint32_t, uint32_t> splitPointer(void *ptr)
+{
+  uint64_t ll = (uint64_t) ptr;
+  return std::make_pair(ll >> 32, ll & 0xffffffff);
+}
+
+inline void* joinPtr(uint32_t val1, uint32_t val2)
+{
+  return (void*)(((uint64_t)val1 << 32) | (uint64_t)val2);
+}
+
+inline void pdns_ucontext_start(uint32_t func1, uint32_t func2, uint32_t arg1, uint32_t arg2)
+{
+  ((pdns_ctxfunc_t*)joinPtr(func1, func2))(joinPtr(arg1, arg2));
+}
+
+//! sets up ctx to call func(arg) on the given stack, and continue with ctx.uc_link once that returns
+inline void pdns_makecontext(pdns_ucontext_t& ctx, char* stack, size_t size, pdns_ctxfunc_t* func, void* arg)
+{
+  getcontext(&ctx.d_uc);
+  ctx.d_uc.uc_link = ctx.uc_link ? &ctx.uc_link->d_uc : 0;
+  ctx.d_uc.uc_stack.ss_sp = stack;
+  ctx.d_uc.uc_stack.ss_size = size;
+  std::pair<uint32_t, uint32_t> funcpair = splitPointer((void*)func);
+  std::pair<uint32_t, uint32_t> argpair = splitPointer(arg);
+  // makecontext only passes ints, so pointers are handed over in two halves
+  makecontext(&ctx.d_uc, (void (*)(void))pdns_ucontext_start, 4, funcpair.first, funcpair.second, argpair.first, argpair.second);
+}
+
+//! saves the current context in save, and continues with next
+inline void pdns_swapcontext(pdns_ucontext_t& save, const pdns_ucontext_t& next)
+{
+  if(swapcontext(&save.d_uc, &next.d_uc)) {
+    perror("swapcontext");
+    exit(EXIT_FAILURE); // no way we can deal with this
+  }
+}
+#endif
+
+#endif
@@ -84,6 +84,21 @@ extern StatBag S;
 #endif
 
 
+/* with reuseport, every receiver thread gets a UDPNameserver of its own, all bound to the same addresses, and
+   the kernel spreads incoming queries over them. This needs the option on each of the sockets. */
+void UDPNameserver::setReusePort(int s)
+{
+  if(!::arg().mustDo("reuseport"))
+    return;
+#ifdef SO_REUSEPORT
+  int tmp=1;
+  if(setsockopt(s, SOL_SOCKET, SO_REUSEPORT, (char*)&tmp, static_cast<unsigned>(sizeof tmp)) < 0)
+    throw AhuException("Unable to set SO_REUSEPORT on UDP socket: "+stringerror());
+#else
+  throw AhuException("reuseport was requested, but this platform does not support SO_REUSEPORT");
+#endif
+}
+
 void UDPNameserver::bindIPv4()
 {
   vector<string>locals;
@@ -107,6 +122,8 @@ void UDPNameserver::bindIPv4()
     if(locals.size() > 1 && !Utility::setNonBlocking(s))
       throw AhuException("Unable to set UDP socket to non-blocking: "+stringerror());
   
+    setReusePort(s);
+
     memset(&locala,0,sizeof(locala));
     locala.sin_family=AF_INET;
 
@@ -170,6 +187,8 @@ void UDPNameserver::bindIPv6()
 
     Utility::setCloseOnExec(s);
 
+    setReusePort(s);
+
     ComboAddress locala(localname, ::arg().asNum("local-port"));
     
     if(IsAnyAddress(locala)) {
@@ -194,7 +213,6 @@ void UDPNameserver::bindIPv6()
   }
 #endif // WIN32
 }
-
 UDPNameserver::UDPNameserver()
 {
   if(!::arg()["local-address"].empty())
@@ -205,80 +223,182 @@ UDPNameserver::UDPNameserver()
   if(::arg()["local-address"].empty() && ::arg()["local-ipv6"].empty()) 
     L<<Logger::Critical<<"PDNS is deaf and mute! Not listening on any interfaces"<<endl;    
 }
-void UDPNameserver::send(DNSPacket *p)
+
+/* fills out msgh so it will send buffer to remote. If anyLocal is set, the answer is sent from that address,
+   which matters when we are bound to the any address. cbuf must be able to hold the control message */
+static void fillMSGHdr(struct msghdr* msgh, struct iovec* iov, char* cbuf, const char *buffer, unsigned int len, 
+                       const ComboAddress& remote, const boost::optional<ComboAddress>& anyLocal)
 {
-  const string& buffer=p->getString();
-  
-  struct msghdr msgh;
   struct cmsghdr *cmsg;
-  struct iovec iov;
-  char cbuf[256];
-  
-  /* Set up iov and msgh structures. */
-  memset(&msgh, 0, sizeof(struct msghdr));
-  iov.iov_base = (void*)buffer.c_str();
-  iov.iov_len = buffer.length();
-  msgh.msg_iov = &iov;
-  msgh.msg_iovlen = 1;
-  msgh.msg_name = (struct sockaddr*)&p->d_remote;
-  msgh.msg_namelen = p->d_remote.getSocklen();
 
-  if(p->d_anyLocal) {
-    if(p->d_anyLocal->sin4.sin_family == AF_INET6) {
+  memset(msgh, 0, sizeof(struct msghdr));
+  iov->iov_base = (void*)buffer;
+  iov->iov_len = len;
+  msgh->msg_iov = iov;
+  msgh->msg_iovlen = 1;
+  msgh->msg_name = (struct sockaddr*)&remote;
+  msgh->msg_namelen = remote.getSocklen();
+
+  if(anyLocal) {
+    if(anyLocal->sin4.sin_family == AF_INET6) {
       struct in6_pktinfo *pkt;
           
-      msgh.msg_control = cbuf;
-      msgh.msg_controllen = CMSG_SPACE(sizeof(*pkt));
+      msgh->msg_control = cbuf;
+      msgh->msg_controllen = CMSG_SPACE(sizeof(*pkt));
                   
-      cmsg = CMSG_FIRSTHDR(&msgh);
+      cmsg = CMSG_FIRSTHDR(msgh);
       cmsg->cmsg_level = IPPROTO_IPV6;
       cmsg->cmsg_type = IPV6_PKTINFO;
       cmsg->cmsg_len = CMSG_LEN(sizeof(*pkt));
                                   
       pkt = (struct in6_pktinfo *) CMSG_DATA(cmsg);
       memset(pkt, 0, sizeof(*pkt));
-      pkt->ipi6_addr = p->d_anyLocal->sin6.sin6_addr;
-      msgh.msg_controllen = cmsg->cmsg_len; // makes valgrind happy and is slightly better style
+      pkt->ipi6_addr = anyLocal->sin6.sin6_addr;
+      msgh->msg_controllen = cmsg->cmsg_len; // makes valgrind happy and is slightly better style
     }
     else {
 #ifdef IP_PKTINFO
       struct in_pktinfo *pkt;
-      msgh.msg_control = cbuf;
-      msgh.msg_controllen = CMSG_SPACE(sizeof(*pkt));
+      msgh->msg_control = cbuf;
+      msgh->msg_controllen = CMSG_SPACE(sizeof(*pkt));
 
-      cmsg = CMSG_FIRSTHDR(&msgh);
+      cmsg = CMSG_FIRSTHDR(msgh);
       cmsg->cmsg_level = IPPROTO_IP;
       cmsg->cmsg_type = IP_PKTINFO;
       cmsg->cmsg_len = CMSG_LEN(sizeof(*pkt));
 
       pkt = (struct in_pktinfo *) CMSG_DATA(cmsg);
       memset(pkt, 0, sizeof(*pkt));
-      pkt->ipi_spec_dst = p->d_anyLocal->sin4.sin_addr;
+      pkt->ipi_spec_dst = anyLocal->sin4.sin_addr;
 #endif
 #ifdef IP_SENDSRCADDR
       struct in_addr *in;
     
-      msgh.msg_control = cbuf;
-      msgh.msg_controllen = CMSG_SPACE(sizeof(*in));
+      msgh->msg_control = cbuf;
+      msgh->msg_controllen = CMSG_SPACE(sizeof(*in));
             
-      cmsg = CMSG_FIRSTHDR(&msgh);
+      cmsg = CMSG_FIRSTHDR(msgh);
       cmsg->cmsg_level = IPPROTO_IP;
       cmsg->cmsg_type = IP_SENDSRCADDR;
       cmsg->cmsg_len = CMSG_LEN(sizeof(*in));
                             
       in = (struct in_addr *) CMSG_DATA(cmsg);
-      *in = p->d_anyLocal->sin4.sin_addr;
+      *in = anyLocal->sin4.sin_addr;
 #endif
-      msgh.msg_controllen = cmsg->cmsg_len;
+      msgh->msg_controllen = cmsg->cmsg_len;
     }
   }
+}
+
+void UDPNameserver::send(DNSPacket *p)
+{
+  const string& buffer=p->getString();
   DLOG(L<<Logger::Notice<<"Sending a packet to "<< p->getRemote() <<" ("<< buffer.length()<<" octets)"<<endl);
   if(buffer.length() > p->getMaxReplyLen()) {
     cerr<<"Weird, trying to send a message that needs truncation, "<< buffer.length()<<" > "<<p->getMaxReplyLen()<<endl;
   }
-  if(sendmsg(p->getSocket(), &msgh, 0) < 0)
-    L<<Logger::Error<<"Error sending reply with sendto (socket="<<p->getSocket()<<"): "<<strerror(errno)<<endl;
+  send(buffer.c_str(), buffer.length(), p->getSocket(), p->d_remote, p->d_anyLocal);
+}
+
+void UDPNameserver::send(const char *buffer, unsigned int len, int sock, const ComboAddress& remote, const boost::optional<ComboAddress>& anyLocal)
+{
+  struct msghdr msgh;
+  struct iovec iov;
+  char cbuf[256];
+  
+  fillMSGHdr(&msgh, &iov, cbuf, buffer, len, remote, anyLocal);
+  if(sendmsg(sock, &msgh, 0) < 0)
+    L<<Logger::Error<<"Error sending reply with sendto (socket="<<sock<<"): "<<strerror(errno)<<endl;
+}
+
+UDPNameserver::Batch::Batch(unsigned int size, unsigned int flushusec) : d_size(size ? size : 1), d_flushusec(flushusec)
+{
+#ifdef HAVE_RECVMMSG
+  d_rmsgs.resize(d_size);
+  d_riovs.resize(d_size);
+  d_rremotes.resize(d_size);
+  d_rbufs.resize(d_size * 512);
+  d_rcbufs.resize(d_size * 256);
+  for(unsigned int n = 0; n < d_size; ++n) {
+    d_riovs[n].iov_base = &d_rbufs[n * 512];
+    d_riovs[n].iov_len = 512;
+  }
+#endif
+  d_rpos = d_rcount = 0;
+  d_rsock = -1;
+}
+
+void UDPNameserver::send(Batch *batch, const char *buffer, unsigned int len, int sock, const ComboAddress& remote, const boost::optional<ComboAddress>& anyLocal)
+{
+#ifdef HAVE_SENDMMSG
+  if(!batch || batch->d_size == 1) {
+    send(buffer, len, sock, remote, anyLocal);
+    return;
+  }
+
+  Batch::SendQueue& sq = batch->d_squeues[sock];
+  if(sq.d_msgs.empty()) {
+    sq.d_msgs.resize(batch->d_size);
+    sq.d_iovs.resize(batch->d_size);
+    sq.d_remotes.resize(batch->d_size);
+    sq.d_bufs.resize(batch->d_size);
+    sq.d_cbufs.resize(batch->d_size * 256);
+    sq.d_count = 0;
+  }
+  if(!sq.d_count) 
+    Utility::gettimeofday(&sq.d_oldest, 0);
+
+  unsigned int n = sq.d_count++;
+  sq.d_bufs[n].assign(buffer, len);      // capacity is retained, so this stops allocating after warmup
+  sq.d_remotes[n] = remote;
+  fillMSGHdr(&sq.d_msgs[n].msg_hdr, &sq.d_iovs[n], &sq.d_cbufs[n * 256], sq.d_bufs[n].c_str(), len, sq.d_remotes[n], anyLocal);
+
+  if(sq.d_count == batch->d_size)
+    flush(sock, sq);
+  else
+    flush(batch, false);
+#else
+  send(buffer, len, sock, remote, anyLocal);
+#endif
+}
+
+//! sends out queued answers, all of them if 'all' is set, otherwise only those queues past their flush deadline
+void UDPNameserver::flush(Batch *batch, bool all)
+{
+#ifdef HAVE_SENDMMSG
+  if(!batch)
+    return;
+
+  struct timeval now;
+  if(!all)
+    Utility::gettimeofday(&now, 0);
+
+  for(Batch::squeues_t::iterator i = batch->d_squeues.begin(); i != batch->d_squeues.end(); ++i) {
+    if(!i->second.d_count)
+      continue;
+    if(all || (now.tv_sec - i->second.d_oldest.tv_sec) * 1000000 + (now.tv_usec - i->second.d_oldest.tv_usec) >= (int)batch->d_flushusec)
+      flush(i->first, i->second);
+  }
+#endif
+}
+
+#ifdef HAVE_SENDMMSG
+void UDPNameserver::flush(int sock, Batch::SendQueue& sq)
+{
+  unsigned int sent = 0;
+  while(sent < sq.d_count) {
+    int ret = sendmmsg(sock, &sq.d_msgs[sent], sq.d_count - sent, 0);
+    if(ret < 0) {
+      if(errno == EINTR)
+        continue;
+      L<<Logger::Error<<"Error sending "<<sq.d_count - sent<<" replies with sendmmsg (socket="<<sock<<"): "<<strerror(errno)<<endl;
+      break;
+    }
+    sent += ret;
+  }
+  sq.d_count = 0;
 }
+#endif
 
 static bool HarvestDestinationAddress(struct msghdr* msgh, ComboAddress* destination)
 {
@@ -312,10 +432,65 @@ static bool HarvestDestinationAddress(struct msghdr* msgh, ComboAddress* destina
   return false;
 }
 
-DNSPacket *UDPNameserver::receive(DNSPacket *prefilled)
+//! returns the socket that has data waiting, polling if we have more than one
+int UDPNameserver::waitForSocket()
 {
+  if(d_sockets.size()==1)
+    return d_sockets[0];
+
+  vector<struct pollfd> rfds= d_rfds;
+  BOOST_FOREACH(struct pollfd &pfd, rfds) {
+    pfd.events = POLL_IN;
+    pfd.revents = 0;
+  }
+    
+  int err = poll(&rfds[0], rfds.size(), -1);
+  if(err < 0)
+    unixDie("Unable to poll for new UDP events");
+    
+  BOOST_FOREACH(struct pollfd &pfd, rfds) {
+    if(pfd.revents & POLL_IN) 
+      return pfd.fd;
+  }
+  throw AhuException("poll betrayed us! (should not happen)");
+}
+
+DNSPacket *UDPNameserver::receive(DNSPacket *prefilled, Batch *batch)
+{
+#ifdef HAVE_RECVMMSG
+  if(batch && batch->d_size > 1) {
+    if(batch->d_rpos == batch->d_rcount) {
+      flush(batch, true); // we are about to block, so nothing should be left waiting for us
+      batch->d_rpos = batch->d_rcount = 0;
+      batch->d_rsock = waitForSocket();
+
+      for(unsigned int n = 0; n < batch->d_size; ++n) {
+        struct msghdr& msgh = batch->d_rmsgs[n].msg_hdr;
+        memset(&msgh, 0, sizeof(struct msghdr));
+        msgh.msg_control = &batch->d_rcbufs[n * 256];
+        msgh.msg_controllen = 256;
+        msgh.msg_name = &batch->d_rremotes[n];
+        msgh.msg_namelen = sizeof(batch->d_rremotes[n]);
+        msgh.msg_iov = &batch->d_riovs[n];
+        msgh.msg_iovlen = 1;
+      }
+
+      int ret = recvmmsg(batch->d_rsock, &batch->d_rmsgs[0], batch->d_size, MSG_WAITFORONE, 0);
+      if(ret < 0) {
+        if(errno != EAGAIN)
+          L<<Logger::Error<<"recvmmsg gave error, ignoring: "<<strerror(errno)<<endl;
+        return 0;
+      }
+      batch->d_rcount = ret;
+    }
+    else
+      flush(batch, false);
+
+    unsigned int n = batch->d_rpos++;
+    return makePacket(prefilled, &batch->d_rbufs[n * 512], batch->d_rmsgs[n].msg_len, batch->d_rsock, batch->d_rremotes[n], &batch->d_rmsgs[n].msg_hdr);
+  }
+#endif
   ComboAddress remote;
-  extern StatBag S;
   int len=-1;
   char mesg[512];
   Utility::sock_t sock=-1;
@@ -337,44 +512,19 @@ DNSPacket *UDPNameserver::receive(DNSPacket *prefilled)
   msgh.msg_iovlen = 1;
   msgh.msg_flags = 0;
   
-  int err;
-  vector<struct pollfd> rfds= d_rfds;
-  if(d_sockets.size()>1) {
-    BOOST_FOREACH(struct pollfd &pfd, rfds) {
-      pfd.events = POLL_IN;
-      pfd.revents = 0;
-    }
-    
-    err = poll(&rfds[0], rfds.size(), -1);
-    if(err < 0)
-      unixDie("Unable to poll for new UDP events");
-    
-    BOOST_FOREACH(struct pollfd &pfd, rfds) {
-      if(pfd.revents & POLL_IN) {
-        sock=pfd.fd;        
-        len=0;
-        
-        if((len=recvmsg(sock, &msgh, 0)) < 0 ) {
-           if(errno != EAGAIN)
-            L<<Logger::Error<<"recvfrom gave error, ignoring: "<<strerror(errno)<<endl;
-          return 0;
-        }
-        break;
-      }
-    }
-    if(sock==-1)
-      throw AhuException("poll betrayed us! (should not happen)");
-  }
-  else {
-    sock=d_sockets[0];
-
-    if((len=recvmsg(sock, &msgh, 0)) < 0 ) {
-      if(errno != EAGAIN)
-        L<<Logger::Error<<"recvfrom gave error, ignoring: "<<strerror(errno)<<endl;
-      return 0;
-    }
+  sock=waitForSocket();
+  if((len=recvmsg(sock, &msgh, 0)) < 0 ) {
+    if(errno != EAGAIN)
+      L<<Logger::Error<<"recvfrom gave error, ignoring: "<<strerror(errno)<<endl;
+    return 0;
   }
   
+  return makePacket(prefilled, mesg, len, sock, remote, &msgh);
+}
+
+DNSPacket *UDPNameserver::makePacket(DNSPacket *prefilled, const char *mesg, int len, int sock, const ComboAddress& remote, struct msghdr* msgh)
+{
+  extern StatBag S;
   
   DLOG(L<<"Received a packet " << len <<" bytes long from "<< remote.toString()<<endl);
   
@@ -388,7 +538,7 @@ DNSPacket *UDPNameserver::receive(DNSPacket *prefilled)
   packet->setRemote(&remote);
 
   ComboAddress dest;
-  if(HarvestDestinationAddress(&msgh, &dest)) {
+  if(HarvestDestinationAddress(msgh, &dest)) {
 //    cerr<<"Setting d_anyLocal to '"<<dest.toString()<<"'"<<endl;
     packet->d_anyLocal = dest;
   }  	  
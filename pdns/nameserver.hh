@@ -31,8 +31,12 @@
 #endif // WIN32
 
 #include <vector>
+#include <map>
 #include <boost/foreach.hpp>
+#include <boost/optional.hpp>
+#include "config.h"
 #include "statbag.hh"
+#include "iputils.hh"
 #include "namespaces.hh"
 
 /** This is the main class. It opens a socket on udp port 53 and waits for packets. Those packets can 
@@ -72,14 +76,59 @@
 class UDPNameserver
 {
 public:
-  UDPNameserver();  //!< Opens the socket
-  DNSPacket *receive(DNSPacket *prefilled=0); //!< call this in a while or for(;;) loop to get packets
+  /** State for batched operation, one per receiver thread. With a size larger than 1, receive() pulls up to 'size' 
+      datagrams per recvmmsg() call, and answers passed to send() with a Batch are queued per socket and written with sendmmsg(). 
+      A queue is flushed when it is full, when it is older than 'flushusec' microseconds, or when receive() is about to block,
+      so batching never holds back an answer when there is no more work waiting. */
+  struct Batch
+  {
+    Batch(unsigned int size, unsigned int flushusec);
+
+#ifdef HAVE_SENDMMSG
+    struct SendQueue
+    {
+      vector<struct mmsghdr> d_msgs;
+      vector<struct iovec> d_iovs;
+      vector<ComboAddress> d_remotes;
+      vector<string> d_bufs;
+      vector<char> d_cbufs;
+      unsigned int d_count;
+      struct timeval d_oldest;
+    };
+    typedef map<int, SendQueue> squeues_t;
+    squeues_t d_squeues;
+#endif
+
+    unsigned int d_size;
+    unsigned int d_flushusec;
+#ifdef HAVE_RECVMMSG
+    vector<struct mmsghdr> d_rmsgs;
+    vector<struct iovec> d_riovs;
+    vector<ComboAddress> d_rremotes;
+    vector<char> d_rbufs;
+    vector<char> d_rcbufs;
+#endif
+    unsigned int d_rpos, d_rcount;
+    int d_rsock;
+  };
+
+  UDPNameserver();  //!< Opens the socket, with SO_REUSEPORT set if the reuseport setting asks for it
+  DNSPacket *receive(DNSPacket *prefilled=0, Batch *batch=0); //!< call this in a while or for(;;) loop to get packets
   static void send(DNSPacket *); //!< send a DNSPacket. Will call DNSPacket::truncate() if over 512 bytes
+  static void send(const char *buffer, unsigned int len, int sock, const ComboAddress& remote, const boost::optional<ComboAddress>& anyLocal); //!< send raw wire bytes, like a PacketCache hit
+  static void send(Batch *batch, const char *buffer, unsigned int len, int sock, const ComboAddress& remote, const boost::optional<ComboAddress>& anyLocal); //!< queue raw wire bytes in batch, if batching is available and enabled
+  static void flush(Batch *batch, bool all=true); //!< send out answers queued in batch
   
 private:
   vector<int> d_sockets;
   void bindIPv4();
   void bindIPv6();
+  void setReusePort(int s);
+  int waitForSocket();
+  DNSPacket *makePacket(DNSPacket *prefilled, const char *mesg, int len, int sock, const ComboAddress& remote, struct msghdr* msgh);
+#ifdef HAVE_SENDMMSG
+  static void flush(int sock, Batch::SendQueue& sq);
+#endif
   vector<pollfd> d_rfds;
 };
 
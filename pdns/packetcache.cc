@@ -27,7 +27,6 @@ extern StatBag S;
 
 PacketCache::PacketCache()
 {
-  pthread_rwlock_init(&d_mut, 0);
   // d_ops = 0;
 
   d_ttl=-1;
@@ -44,13 +43,13 @@ PacketCache::PacketCache()
 
 PacketCache::~PacketCache()
 {
-  WriteLock l(&d_mut);
+  for(unsigned int n = 0; n < s_shards; ++n)
+    WriteLock l(&d_maps[n].d_mut);
 }
 
-int PacketCache::get(DNSPacket *p, DNSPacket *cached)
+/** checks that are common to both packet lookups, returns false if p can't be answered from the cache anyhow */
+bool PacketCache::mayLookup(DNSPacket *p)
 {
-  extern StatBag S;
-
   if(d_ttl<0) 
     getTTLS();
 
@@ -61,31 +60,76 @@ int PacketCache::get(DNSPacket *p, DNSPacket *cached)
   if(d_doRecursion && p->d.rd) { // wants recursion
     if(!d_recursivettl) {
       (*d_statnummiss)++;
-      return 0;
+      return false;
     }
   }
   else { // does not
     if(!d_ttl) {
       (*d_statnummiss)++;
-      return 0;
+      return false;
     }
   }
     
-  bool packetMeritsRecursion=d_doRecursion && p->d.rd;
   if(ntohs(p->d.qdcount)!=1) // we get confused by packets with more than one question
+    return false;
+
+  return true;
+}
+
+// length of the uncompressed qname starting at offset 12, 0 if it can't be walked
+static unsigned int getQNameLength(const char *packet, unsigned int len)
+{
+  unsigned int pos=12;
+  while(pos < len) {
+    unsigned char labellen=packet[pos];
+    if(!labellen)
+      return pos + 1 - 12;
+    if(labellen & 0xc0)
+      return 0;
+    pos+=labellen+1;
+  }
+  return 0;
+}
+
+// the qname of p, straight from the question on the wire if we can, which saves parsing p->qdomain
+static bool getQName(DNSPacket *p, DNSName* qname)
+{
+  const string& packet=p->getString(); // still the packet as we received it
+  unsigned int qlen=getQNameLength(packet.c_str(), packet.size());
+  try {
+    *qname = qlen ? DNSName(packet.c_str() + 12, qlen) : DNSName(p->qdomain);
+  }
+  catch(AhuException& ae) {
+    return false;
+  }
+  return true;
+}
+
+int PacketCache::get(DNSPacket *p, DNSPacket *cached)
+{
+  extern StatBag S;
+
+  if(!mayLookup(p))
     return 0;
 
+  bool packetMeritsRecursion=d_doRecursion && p->d.rd;
   string value;
   bool haveSomething;
   {
-    TryReadLock l(&d_mut); // take a readlock here
+    DNSName qname;
+    if(!getQName(p, &qname)) {
+      (*d_statnummiss)++;
+      return 0;
+    }
+    MapCombo& mc=getMap(qname, p->qtype.getCode(), PacketCache::PACKETCACHE, -1);
+    TryReadLock l(&mc.d_mut); // take a readlock here
     if(!l.gotIt()) {
       S.inc("deferred-cache-lookup");
       return 0;
     }
 
     uint16_t maxReplyLen = p->d_tcp ? 0xffff : p->getMaxReplyLen();
-    haveSomething=getEntryLocked(p->qdomain, p->qtype, PacketCache::PACKETCACHE, value, -1, packetMeritsRecursion, maxReplyLen, p->d_dnssecOk, p->hasEDNS());
+    haveSomething=getEntryLocked(mc.d_map, qname, p->qtype, PacketCache::PACKETCACHE, value, -1, packetMeritsRecursion, maxReplyLen, p->d_dnssecOk, p->hasEDNS());
   }
   if(haveSomething) {
     (*d_statnumhit)++;
@@ -127,12 +171,15 @@ void PacketCache::insert(DNSPacket *q, DNSPacket *r, unsigned int maxttl)
   unsigned int ourttl = packetMeritsRecursion ? d_recursivettl : d_ttl;
   if(maxttl<ourttl)
     ourttl=maxttl;
-  insert(q->qdomain, q->qtype, PacketCache::PACKETCACHE, r->getString(), ourttl, -1, packetMeritsRecursion,
+  DNSName qname;
+  if(!getQName(q, &qname))
+    return;
+  insert(qname, q->qtype, PacketCache::PACKETCACHE, r->getString(), ourttl, -1, packetMeritsRecursion,
     maxReplyLen, q->d_dnssecOk, q->hasEDNS());
 }
 
 // universal key appears to be: qname, qtype, kind (packet, query cache), optionally zoneid, meritsRecursion
-void PacketCache::insert(const string &qname, const QType& qtype, CacheEntryType cet, const string& value, unsigned int ttl, int zoneID, 
+void PacketCache::insert(const DNSName &qname, const QType& qtype, CacheEntryType cet, const string& value, unsigned int ttl, int zoneID, 
   bool meritsRecursion, unsigned int maxReplyLen, bool dnssecOk, bool EDNS)
 {
   if(!((++d_ops) % 300000)) {
@@ -144,8 +191,8 @@ void PacketCache::insert(const string &qname, const QType& qtype, CacheEntryType
   
   //cerr<<"Inserting qname '"<<qname<<"', cet: "<<(int)cet<<", qtype: "<<qtype.getName()<<", ttl: "<<ttl<<", maxreplylen: "<<maxReplyLen<<", hasEDNS: "<<EDNS<<endl;
   CacheEntry val;
-  val.ttd=time(0)+ttl;
   val.qname=qname;
+  val.ttd=time(0)+ttl;
   val.qtype=qtype.getCode();
   val.value=value;
   val.ctype=cet;
@@ -155,14 +202,15 @@ void PacketCache::insert(const string &qname, const QType& qtype, CacheEntryType
   val.zoneID = zoneID;
   val.hasEDNS = EDNS;
   
-  TryWriteLock l(&d_mut);
+  MapCombo& mc=getMap(val.qname, val.qtype, val.ctype, val.zoneID);
+  TryWriteLock l(&mc.d_mut);
   if(l.gotIt()) { 
     bool success;
     cmap_t::iterator place;
-    tie(place, success)=d_map.insert(val);
+    tie(place, success)=mc.d_map.insert(val);
     //    cerr<<"Insert succeeded: "<<success<<endl;
     if(!success)
-      d_map.replace(place, val);
+      mc.d_map.replace(place, val);
     
   }
   else 
@@ -172,9 +220,12 @@ void PacketCache::insert(const string &qname, const QType& qtype, CacheEntryType
 /* clears the entire packetcache. */
 int PacketCache::purge()
 {
-  WriteLock l(&d_mut);
-  int delcount=d_map.size();
-  d_map.clear();
+  int delcount=0;
+  for(unsigned int n = 0; n < s_shards; ++n) {
+    WriteLock l(&d_maps[n].d_mut);
+    delcount+=d_maps[n].d_map.size();
+    d_maps[n].d_map.clear();
+  }
   *d_statnumentries=0;
   return delcount;
 }
@@ -182,7 +233,6 @@ int PacketCache::purge()
 /* purges entries from the packetcache. If match ends on a $, it is treated as a suffix */
 int PacketCache::purge(const string &match)
 {
-  WriteLock l(&d_mut);
   int delcount=0;
 
   /* ok, the suffix delete plan. We want to be able to delete everything that 
@@ -227,34 +277,117 @@ int PacketCache::purge(const string &match)
      'powerdnsiscool.com'
      'www.userpowerdns.com'
 
+     Comparing label by label from the right, which is the canonical DNSName order, does all of this for us:
+     'powerdns.com' comes right before everything below it, and 'powerdnsiscool.com' sorts after all of those.
   */
-  if(ends_with(match, "$")) {
-    string suffix(match);
-    suffix.resize(suffix.size()-1);
+  /* Entries for one name are spread over the shards by qtype and friends, so both kinds of purge visit every shard,
+     using the ordered qname index that each shard keeps just for this purpose. */
+  bool suffix=ends_with(match, "$");
+  DNSName name;
+  try {
+    name=DNSName(suffix ? match.substr(0, match.size()-1) : match);
+  }
+  catch(AhuException& ae) {
+    return 0;
+  }
 
-    cmap_t::const_iterator iter = d_map.lower_bound(tie(suffix));
-    cmap_t::const_iterator start=iter;
-    string dotsuffix = "."+suffix;
+  unsigned int size=0;
+  for(unsigned int n = 0; n < s_shards; ++n) {
+    delcount+=purgeMap(d_maps[n], name, suffix, &size);
+  }
+  *d_statnumentries=size;
+  return delcount;
+}
+
+unsigned int PacketCache::purgeMap(MapCombo& mc, const DNSName& match, bool suffix, unsigned int* size)
+{
+  WriteLock l(&mc.d_mut);
+  typedef cmap_t::index<QNameTag>::type qname_t;
+  qname_t& qidx=mc.d_map.get<QNameTag>();
+  unsigned int delcount=0;
+
+  if(suffix) {
+    qname_t::iterator iter = qidx.lower_bound(match);
+    qname_t::iterator start=iter;
 
-    for(; iter != d_map.end(); ++iter) {
-      if(!pdns_iequals(iter->qname, suffix) && !iends_with(iter->qname, dotsuffix)) {
+    for(; iter != qidx.end(); ++iter) {
+      if(!iter->qname.isPartOf(match)) {
         //	cerr<<"Stopping!"<<endl;
         break;
       }
       delcount++;
     }
-    d_map.erase(start, iter);
+    qidx.erase(start, iter);
   }
   else {
-    delcount=d_map.count(tie(match));
-    pair<cmap_t::iterator, cmap_t::iterator> range = d_map.equal_range(tie(match));
-    d_map.erase(range.first, range.second);
+    pair<qname_t::iterator, qname_t::iterator> range = qidx.equal_range(match);
+    for(qname_t::iterator iter = range.first; iter != range.second; ++iter)
+      delcount++;
+    qidx.erase(range.first, range.second);
   }
-  *d_statnumentries=d_map.size();
+  *size+=mc.d_map.size();
   return delcount;
 }
+
+/* The raw hit path. The stored answer is copied straight into the caller's buffer, after which we patch in the
+   id, the RD bit and the exact case of the question from the query as it came off the wire. This saves building and
+   parsing a second DNSPacket for every cache hit. */
+int PacketCache::get(DNSPacket *p, char *buffer, unsigned int size)
+{
+  extern StatBag S;
+
+  if(!mayLookup(p))
+    return 0;
+
+  const string& query=p->getString(); // still the packet as we received it
+  unsigned int qlen=getQNameLength(query.c_str(), query.size());
+  if(!qlen) {
+    (*d_statnummiss)++;
+    return 0;
+  }
+
+  bool packetMeritsRecursion=d_doRecursion && p->d.rd;
+  unsigned int len=0;
+  {
+    DNSName qname;
+    try {
+      qname=DNSName(query.c_str() + 12, qlen); // straight from the question, no need to parse p->qdomain again
+    }
+    catch(AhuException& ae) {
+      (*d_statnummiss)++;
+      return 0;
+    }
+    MapCombo& mc=getMap(qname, p->qtype.getCode(), PacketCache::PACKETCACHE, -1);
+    TryReadLock l(&mc.d_mut); // take a readlock here
+    if(!l.gotIt()) {
+      S.inc("deferred-cache-lookup");
+      return 0;
+    }
+
+    uint16_t maxReplyLen = p->d_tcp ? 0xffff : p->getMaxReplyLen();
+    const CacheEntry* ce=findEntryLocked(mc.d_map, qname, p->qtype.getCode(), PacketCache::PACKETCACHE, -1, packetMeritsRecursion, maxReplyLen, p->d_dnssecOk, p->hasEDNS());
+    if(ce && ce->value.size() >= 12 && ce->value.size() <= size) {
+      len=ce->value.size();
+      memcpy(buffer, ce->value.c_str(), len);
+    }
+  }
+  if(!len) {
+    (*d_statnummiss)++;
+    return 0;
+  }
+  (*d_statnumhit)++;
+
+  memcpy(buffer, query.c_str(), 2); // id
+  buffer[2] = (buffer[2] & ~0x01) | (query[2] & 0x01); // recursion desired
+
+  if(qlen == getQNameLength(buffer, len))
+    memcpy(buffer + 12, query.c_str() + 12, qlen); // for correct case
+
+  return len;
+}
+
 // called from ueberbackend
-bool PacketCache::getEntry(const string &qname, const QType& qtype, CacheEntryType cet, string& value, int zoneID, bool meritsRecursion, 
+bool PacketCache::getEntry(const DNSName &qname, const QType& qtype, CacheEntryType cet, string& value, int zoneID, bool meritsRecursion, 
   unsigned int maxReplyLen, bool dnssecOk, bool hasEDNS)
 {
   if(d_ttl<0) 
@@ -264,48 +397,58 @@ bool PacketCache::getEntry(const string &qname, const QType& qtype, CacheEntryTy
     cleanup();
   }
 
-  TryReadLock l(&d_mut); // take a readlock here
+  MapCombo& mc=getMap(qname, qtype.getCode(), cet, zoneID);
+  TryReadLock l(&mc.d_mut); // take a readlock here
   if(!l.gotIt()) {
     S.inc( "deferred-cache-lookup");
     return false;
   }
 
-  return getEntryLocked(qname, qtype, cet, value, zoneID, meritsRecursion, maxReplyLen, dnssecOk, hasEDNS);
+  return getEntryLocked(mc.d_map, qname, qtype, cet, value, zoneID, meritsRecursion, maxReplyLen, dnssecOk, hasEDNS);
 }
 
 
-bool PacketCache::getEntryLocked(const string &qname, const QType& qtype, CacheEntryType cet, string& value, int zoneID, bool meritsRecursion,
+bool PacketCache::getEntryLocked(cmap_t& map, const DNSName &qname, const QType& qtype, CacheEntryType cet, string& value, int zoneID, bool meritsRecursion,
+  unsigned int maxReplyLen, bool dnssecOK, bool hasEDNS)
+{
+  const CacheEntry* ce=findEntryLocked(map, qname, qtype.getCode(), cet, zoneID, meritsRecursion, maxReplyLen, dnssecOK, hasEDNS);
+  if(ce)
+    value = ce->value;
+  
+  return ce != 0;
+}
+
+const PacketCache::CacheEntry* PacketCache::findEntryLocked(const cmap_t& map, const DNSName &qname, uint16_t qt, CacheEntryType cet, int zoneID, bool meritsRecursion,
   unsigned int maxReplyLen, bool dnssecOK, bool hasEDNS)
 {
-  uint16_t qt = qtype.getCode();
   //cerr<<"Lookup for maxReplyLen: "<<maxReplyLen<<endl;
-  cmap_t::const_iterator i=d_map.find(tie(qname, qt, cet, zoneID, meritsRecursion, maxReplyLen, dnssecOK, hasEDNS));
+  cmap_t::const_iterator i=map.find(tie(qname, qt, cet, zoneID, meritsRecursion, maxReplyLen, dnssecOK, hasEDNS));
   time_t now=time(0);
-  bool ret=(i!=d_map.end() && i->ttd > now);
-  if(ret)
-    value = i->value;
-  
-  return ret;
+  if(i!=map.end() && i->ttd > now)
+    return &*i;
+  return 0;
 }
 
 map<char,int> PacketCache::getCounts()
 {
-  ReadLock l(&d_mut);
-
   map<char,int>ret;
   int recursivePackets=0, nonRecursivePackets=0, queryCacheEntries=0, negQueryCacheEntries=0;
 
-  for(cmap_t::const_iterator iter = d_map.begin() ; iter != d_map.end(); ++iter) {
-    if(iter->ctype == PACKETCACHE)
-      if(iter->meritsRecursion)
-        recursivePackets++;
-      else
-        nonRecursivePackets++;
-    else if(iter->ctype == QUERYCACHE) {
-      if(iter->value.empty())
-        negQueryCacheEntries++;
-      else
-        queryCacheEntries++;
+  for(unsigned int n = 0; n < s_shards; ++n) {
+    ReadLock l(&d_maps[n].d_mut);
+    const cmap_t& map=d_maps[n].d_map;
+    for(cmap_t::const_iterator iter = map.begin() ; iter != map.end(); ++iter) {
+      if(iter->ctype == PACKETCACHE)
+        if(iter->meritsRecursion)
+          recursivePackets++;
+        else
+          nonRecursivePackets++;
+      else if(iter->ctype == QUERYCACHE) {
+        if(iter->value.empty())
+          negQueryCacheEntries++;
+        else
+          queryCacheEntries++;
+      }
     }
   }
   ret['!']=negQueryCacheEntries;
@@ -317,21 +460,38 @@ map<char,int> PacketCache::getCounts()
 
 int PacketCache::size()
 {
-  ReadLock l(&d_mut);
-  return d_map.size();
+  int ret=0;
+  for(unsigned int n = 0; n < s_shards; ++n) {
+    ReadLock l(&d_maps[n].d_mut);
+    ret+=d_maps[n].d_map.size();
+  }
+  return ret;
 }
 
-/** readlock for figuring out which iterators to delete, upgrade to writelock when actually cleaning */
+/** cleans each shard in turn, so only one shard is write locked at any time */
 void PacketCache::cleanup()
 {
-  WriteLock l(&d_mut);
+  unsigned int maxCached=::arg().asNum("max-cache-entries");
+  time_t now=time(0);
 
-  *d_statnumentries=d_map.size();
+  DLOG(L<<"Starting cache clean"<<endl);
+  if(maxCached)
+    maxCached=max(maxCached / s_shards, 1U);
+
+  unsigned int size=0;
+  for(unsigned int n = 0; n < s_shards; ++n)
+    size+=cleanupMap(d_maps[n], maxCached, now);
+  *d_statnumentries=size;
+  DLOG(L<<"Done with cache clean"<<endl);
+}
+
+unsigned int PacketCache::cleanupMap(MapCombo& mc, unsigned int maxCached, time_t now)
+{
+  WriteLock l(&mc.d_mut);
 
-  unsigned int maxCached=::arg().asNum("max-cache-entries");
   unsigned int toTrim=0;
   
-  unsigned int cacheSize=*d_statnumentries;
+  unsigned int cacheSize=mc.d_map.size();
 
   if(maxCached && cacheSize > maxCached) {
     toTrim = cacheSize - maxCached;
@@ -346,14 +506,11 @@ void PacketCache::cleanup()
     lookAt=cacheSize/10;
 
   //  cerr<<"cacheSize: "<<cacheSize<<", lookAt: "<<lookAt<<", toTrim: "<<toTrim<<endl;
-  time_t now=time(0);
+  if(mc.d_map.empty())
+    return 0; // clean
 
-  DLOG(L<<"Starting cache clean"<<endl);
-  if(d_map.empty())
-    return; // clean
-
-  typedef cmap_t::nth_index<1>::type sequence_t;
-  sequence_t& sidx=d_map.get<1>();
+  typedef cmap_t::index<SequenceTag>::type sequence_t;
+  sequence_t& sidx=mc.d_map.get<SequenceTag>();
   unsigned int erased=0, lookedAt=0;
   for(sequence_t::iterator i=sidx.begin(); i != sidx.end(); lookedAt++) {
     if(i->ttd < now) {
@@ -370,6 +527,5 @@ void PacketCache::cleanup()
       break;
   }
   //  cerr<<"erased: "<<erased<<endl;
-  *d_statnumentries=d_map.size();
-  DLOG(L<<"Done with cache clean"<<endl);
+  return mc.d_map.size();
 }
@@ -25,11 +25,14 @@
 #include <map>
 #include "dns.hh"
 #include <boost/version.hpp>
+#include <boost/functional/hash.hpp>
+#include <boost/multi_index/hashed_index.hpp>
 #include "namespaces.hh"
 using namespace ::boost::multi_index;
 
 #include "namespaces.hh"
 #include "dnspacket.hh"
+#include "dnsname.hh"
 #include "lock.hh"
 #include "statbag.hh"
 
@@ -40,27 +43,14 @@ using namespace ::boost::multi_index;
 
     Locking! 
 
-    The cache itself is protected by a read/write lock. Because deleting is a two step process, which 
-    first marks and then sweeps, a second lock is present to prevent simultaneous inserts and deletes.
-*/
-
-struct CIBackwardsStringCompare: public std::binary_function<string, string, bool>  
-{
-  bool operator()(const string& str_a, const string& str_b) const
-  {
-    string::const_reverse_iterator ra, rb;
-    char a=0, b=0;
-    for(ra = str_a.rbegin(), rb = str_b.rbegin();
-        ra < str_a.rend() && rb < str_b.rend() && (a=dns_tolower(*ra)) == (b=dns_tolower(*rb));
-        ra++, rb++);
-    
-    if (ra < str_a.rend() && rb==str_b.rend()) { a=*(ra++); b=0; return false; } // we are at the beginning of b -> b smaller
-    if (rb < str_b.rend() && ra==str_a.rend()) { b=*(rb++); a=0; return true; } // we are at the beginning of a -> a smaller
-    // if BOTH are at their ends, a and b will be equal, and we should return false, which we will
-    return a < b;
-  }
-};
+    The cache is split into s_shards independent shards, each protected by its own read/write lock.
+    The shard for an entry is picked by hashing its (lowercased) qname together with the other key 
+    fields, so threads looking up different names rarely touch the same lock. Within a shard, lookups 
+    go through a hashed index, the ordered qname index is only there for suffix purges.
 
+    Names are kept as DNSName, which carries its own case insensitive hash and sorts in canonical order,
+    so a zone and everything below it are next to each other in the ordered index.
+*/
 
 class PacketCache : public boost::noncopyable
 {
@@ -71,11 +61,12 @@ public:
 
   void insert(DNSPacket *q, DNSPacket *r, unsigned int maxttl=UINT_MAX);  //!< We copy the contents of *p into our cache. Do not needlessly call this to insert questions already in the cache as it wastes resources
 
-  void insert(const string &qname, const QType& qtype, CacheEntryType cet, const string& value, unsigned int ttl, int zoneID=-1, bool meritsRecursion=false,
+  void insert(const DNSName &qname, const QType& qtype, CacheEntryType cet, const string& value, unsigned int ttl, int zoneID=-1, bool meritsRecursion=false,
     unsigned int maxReplyLen=512, bool dnssecOk=false, bool EDNS=false);
 
   int get(DNSPacket *p, DNSPacket *q); //!< We return a dynamically allocated copy out of our cache. You need to delete it. You also need to spoof in the right ID with the DNSPacket.spoofID() method.
-  bool getEntry(const string &content, const QType& qtype, CacheEntryType cet, string& entry, int zoneID=-1, 
+  int get(DNSPacket *p, char *buffer, unsigned int size); //!< Copies the cached answer into buffer with id, RD and question case of p already patched in. Returns its length, 0 on a miss
+  bool getEntry(const DNSName &qname, const QType& qtype, CacheEntryType cet, string& entry, int zoneID=-1, 
     bool meritsRecursion=false, unsigned int maxReplyLen=512, bool dnssecOk=false, bool hasEDNS=false);
 
   int size(); //!< number of entries in the cache
@@ -85,13 +76,11 @@ public:
 
   map<char,int> getCounts();
 private:
-  bool getEntryLocked(const string &content, const QType& qtype, CacheEntryType cet, string& entry, int zoneID=-1, 
-    bool meritsRecursion=false, unsigned int maxReplyLen=512, bool dnssecOk=false, bool hasEDNS=false);
   struct CacheEntry
   {
     CacheEntry() { qtype = ctype = 0; zoneID = -1; meritsRecursion=false; dnssecOk=false; hasEDNS=false;}
 
-    string qname;
+    DNSName qname;
     uint16_t qtype;
     uint16_t ctype;
     int zoneID;
@@ -104,14 +93,17 @@ private:
   };
 
   void getTTLS();
+  bool mayLookup(DNSPacket *p);
 
+  struct QNameTag{};
+  struct SequenceTag{};
   typedef multi_index_container<
     CacheEntry,
     indexed_by <
-                ordered_unique<
+                hashed_unique<
                       composite_key< 
                         CacheEntry,
-                        member<CacheEntry,string,&CacheEntry::qname>,
+                        member<CacheEntry,DNSName,&CacheEntry::qname>,
                         member<CacheEntry,uint16_t,&CacheEntry::qtype>,
                         member<CacheEntry,uint16_t, &CacheEntry::ctype>,
                         member<CacheEntry,int, &CacheEntry::zoneID>,
@@ -120,17 +112,41 @@ private:
                         member<CacheEntry,bool, &CacheEntry::dnssecOk>,
                         member<CacheEntry,bool, &CacheEntry::hasEDNS>
                         >,
-                        composite_key_compare<CIBackwardsStringCompare, std::less<uint16_t>, std::less<uint16_t>, std::less<int>, std::less<bool>, 
-                          std::less<unsigned int>, std::less<bool>, std::less<bool> >
+                        composite_key_hash<boost::hash<DNSName>, boost::hash<uint16_t>, boost::hash<uint16_t>, boost::hash<int>, boost::hash<bool>, 
+                          boost::hash<unsigned int>, boost::hash<bool>, boost::hash<bool> >,
+                        composite_key_equal_to<std::equal_to<DNSName>, std::equal_to<uint16_t>, std::equal_to<uint16_t>, std::equal_to<int>, std::equal_to<bool>, 
+                          std::equal_to<unsigned int>, std::equal_to<bool>, std::equal_to<bool> >
                             >,
-                           sequenced<>
+                ordered_non_unique<tag<QNameTag>, member<CacheEntry,DNSName,&CacheEntry::qname> >,
+                sequenced<tag<SequenceTag> >
                            >
   > cmap_t;
 
+  struct MapCombo
+  {
+    MapCombo() { pthread_rwlock_init(&d_mut, 0); }
+    ~MapCombo() { pthread_rwlock_destroy(&d_mut); }
+    pthread_rwlock_t d_mut;
+    cmap_t d_map;
+  };
+
+  static const unsigned int s_shards = 1024;
 
-  cmap_t d_map;
+  MapCombo& getMap(const DNSName& qname, uint16_t qtype, uint16_t ctype, int zoneID)
+  {
+    uint32_t hash = qname.hash();
+    hash ^= (uint32_t)qtype * 2654435761U;
+    hash ^= ((uint32_t)ctype << 16) ^ (uint32_t)zoneID;
+    return d_maps[(hash ^ (hash >> 16)) % s_shards];
+  }
+  bool getEntryLocked(cmap_t& map, const DNSName &content, const QType& qtype, CacheEntryType cet, string& entry, int zoneID=-1, 
+    bool meritsRecursion=false, unsigned int maxReplyLen=512, bool dnssecOk=false, bool hasEDNS=false);
+  const CacheEntry* findEntryLocked(const cmap_t& map, const DNSName &qname, uint16_t qtype, CacheEntryType cet, int zoneID, 
+    bool meritsRecursion, unsigned int maxReplyLen, bool dnssecOk, bool hasEDNS);
+  unsigned int cleanupMap(MapCombo& mc, unsigned int maxCached, time_t now);
+  unsigned int purgeMap(MapCombo& mc, const DNSName& match, bool suffix, unsigned int* size);
 
-  pthread_rwlock_t d_mut;
+  MapCombo d_maps[s_shards];
 
   AtomicCounter d_ops;
   int d_ttl;
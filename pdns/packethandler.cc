@@ -381,27 +381,39 @@ int PacketHandler::doAdditionalProcessingAndDropAA(DNSPacket *p, DNSPacket *r, c
         r->setA(false);
         //	i->d_place=DNSResourceRecord::AUTHORITY; // XXX FIXME
       }
+    }
 
-      string content = stripDot(i->content);
-
-      QType qtypes[2];
-      qtypes[0]="A"; qtypes[1]="AAAA";
-      for(int n=0 ; n < d_doIPv6AdditionalProcessing + 1; ++n) {
-        if (i->qtype.getCode()==QType::SRV) {
-          vector<string>parts;
-          stringtok(parts, content);
-          if (parts.size() >= 3) {
-            B.lookup(qtypes[n],parts[2],p);
+    // submit all lookups first so a backend that can pipeline them needs only a single round trip
+    vector<const DNSResourceRecord*> owners;
+    QType qtypes[2];
+    qtypes[0]="A"; qtypes[1]="AAAA";
+    try {
+      for(vector<DNSResourceRecord>::const_iterator i=crrs.begin(); i!=crrs.end(); ++i) {
+        string content = stripDot(i->content);
+
+        for(int n=0 ; n < d_doIPv6AdditionalProcessing + 1; ++n) {
+          if (i->qtype.getCode()==QType::SRV) {
+            vector<string>parts;
+            stringtok(parts, content);
+            if (parts.size() >= 3) {
+              B.submitLookup(qtypes[n],parts[2],p);
+            }
+            else
+              continue;
           }
-          else
-            continue;
-        }
-        else {
-          B.lookup(qtypes[n], content, p);
+          else {
+            B.submitLookup(qtypes[n], content, p);
+          }
+          owners.push_back(&*i);
         }
-        while(B.get(rr)) {
-          if(rr.domain_id!=i->domain_id && ::arg()["out-of-zone-additional-processing"]=="no") {
-            DLOG(L<<Logger::Warning<<"Not including out-of-zone additional processing of "<<i->qname<<" ("<<rr.qname<<")"<<endl);
+      }
+
+      vector<DNSResourceRecord> rrs;
+      for(vector<const DNSResourceRecord*>::const_iterator i=owners.begin(); i!=owners.end() && B.harvestLookup(rrs); ++i) {
+        for(vector<DNSResourceRecord>::iterator j=rrs.begin(); j!=rrs.end(); ++j) {
+          rr=*j;
+          if(rr.domain_id!=(*i)->domain_id && ::arg()["out-of-zone-additional-processing"]=="no") {
+            DLOG(L<<Logger::Warning<<"Not including out-of-zone additional processing of "<<(*i)->qname<<" ("<<rr.qname<<")"<<endl);
             continue; // not adding out-of-zone additional data
           }
           if(rr.auth && !endsOn(rr.qname, soadata.qname)) // don't sign out of zone data using the main key 
@@ -411,6 +423,10 @@ int PacketHandler::doAdditionalProcessingAndDropAA(DNSPacket *p, DNSPacket *r, c
         }
       }
     }
+    catch(...) {
+      B.discardLookups();
+      throw;
+    }
   }
   return 1;
 }
@@ -29,6 +29,7 @@
 #include "json_ws.hh"
 #include <pthread.h>
 #include "recpacketcache.hh"
+#include "mpmcqueue.hh"
 #include "utility.hh" 
 #include "dns_random.hh"
 #include <iostream>
@@ -82,6 +83,15 @@ __thread shared_ptr<Regex>* t_traceRegex;
 
 RecursorControlChannel s_rcc; // only active in thread 0
 
+// a UDP question on its way from the thread that received it to the thread that will answer it
+struct QueuedQuestion
+{
+  ComboAddress fromaddr;
+  int fd;
+  unsigned int len;
+  char data[1500];
+};
+
 // for communicating with our threads
 struct ThreadPipeSet
 {
@@ -89,6 +99,9 @@ struct ThreadPipeSet
   int readToThread;
   int writeFromThread;
   int readFromThread;
+  int writeQueriesToThread; // with pdns-distributes-queries, wakes up the thread when its 'queries' ring was empty
+  int readQueriesToThread;
+  SPSCRing<QueuedQuestion>* queries;
 };
 
 vector<ThreadPipeSet> g_pipes; // effectively readonly after startup
@@ -98,11 +111,13 @@ SyncRes::domainmap_t* g_initialDomainMap; // new threads needs this to be setup
 #include "namespaces.hh"
 
 __thread MemRecursorCache* t_RC;
+shared_ptr<MemRecursorCache::SharedStore> g_sharedRC;
 __thread RecursorPacketCache* t_packetCache;
 RecursorStats g_stats;
 bool g_quiet;
 
 bool g_weDistributeQueries; // if true, only 1 thread listens on the incoming query sockets
+bool g_distributeByName; // if true, the thread a question is handed to depends on the name asked for
 
 static __thread NetmaskGroup* t_allowFrom;
 static NetmaskGroup* g_initialAllowFrom; // new thread needs to be setup with this
@@ -149,6 +164,7 @@ struct DNSComboWriter {
   bool d_tcp;
   int d_socket;
   shared_ptr<TCPConnection> d_tcpConnection;
+  RecursorPacketCache::QueryKey d_qkey; //!< where the answer goes in the packet cache
 };
 
 
@@ -182,28 +198,170 @@ int asendtcp(const string& data, Socket* sock)
   return ret;
 }
 
-void handleTCPClientReadable(int fd, FDMultiplexer::funcparam_t& var);
+ComboAddress getQueryLocalAddress(int family, uint16_t port);
 
-// -1 is error, 0 is timeout, 1 is success
-int arecvtcp(string& data, int len, Socket* sock) 
+/* outgoing TCP connections stay open for a while, so the next truncated answer from the same server does not cost another
+   handshake. Several queries can be out on a connection at the same time, answers are matched to them by id */
+struct TCPOutConnection : public boost::noncopyable
 {
-  data.clear();
-  PacketID pident;
-  pident.sock=sock;
-  pident.inNeeded=len;
-  t_fdm->addReadFD(sock->getHandle(), handleTCPClientReadable, pident);
+  explicit TCPOutConnection(const ComboAddress& remote_) : remote(remote_), lastUsed(g_now.tv_sec), closed(false)
+  {
+    sock=shared_ptr<Socket>(new Socket((AddressFamily)remote.sin4.sin_family, Stream));
+    sock->setNonBlocking();
+    sock->bind(getQueryLocalAddress(remote.sin4.sin_family, 0));
+    sock->connect(remote);
+  }
+
+  ComboAddress remote;
+  shared_ptr<Socket> sock;
+  time_t lastUsed;
+  bool closed;
+  string inBuf;                     //!< what we read so far of the next answer
+  map<uint16_t, PacketID> waiting;  //!< queries out on this connection, by id
+};
 
-  int ret=MT->waitEvent(pident,&data, g_networkTimeoutMsec);
-  if(!ret || ret==-1) { // timeout
-    t_fdm->removeReadFD(sock->getHandle());
+typedef std::multimap<ComboAddress, shared_ptr<TCPOutConnection> > tcpoutconns_t;
+static __thread tcpoutconns_t* t_tcpOutConns;
+unsigned int g_tcpOutIdleTimeout;
+
+//! takes conn out of the pool, and tells everybody still waiting for an answer on it that there won't be one
+static void closeTCPOutConnection(shared_ptr<TCPOutConnection> conn)
+{
+  if(conn->closed)
+    return;
+  conn->closed=true;
+  t_fdm->removeReadFD(conn->sock->getHandle());
+  pair<tcpoutconns_t::iterator, tcpoutconns_t::iterator> range=t_tcpOutConns->equal_range(conn->remote);
+  for(; range.first != range.second; ++range.first) {
+    if(range.first->second == conn) {
+      t_tcpOutConns->erase(range.first);
+      break;
+    }
   }
-  else if(data.empty()) {// error, EOF or other
-    return -1;
+  vector<PacketID> waiting;
+  for(map<uint16_t, PacketID>::const_iterator i=conn->waiting.begin(); i != conn->waiting.end(); ++i)
+    waiting.push_back(i->second);
+  conn->waiting.clear();
+  if(!waiting.empty())
+    wakeTasks(t_id, waiting); // with an empty answer, which conveys error status. We might be called from a task
+}
+
+static void handleTCPOutReadable(int fd, FDMultiplexer::funcparam_t& var)
+{
+  shared_ptr<TCPOutConnection> conn=any_cast<shared_ptr<TCPOutConnection> >(var);
+  char buffer[4096];
+  int ret=recv(fd, buffer, sizeof(buffer), 0);
+  if(ret <= 0) { // EOF, the server closed an idle connection, or error
+    closeTCPOutConnection(conn);
+    return;
   }
+  conn->inBuf.append(buffer, ret);
 
+  while(conn->inBuf.size() >= 2) {
+    unsigned int len=((unsigned char)conn->inBuf[0]) * 256 + (unsigned char)conn->inBuf[1];
+    if(conn->inBuf.size() < len + 2)
+      break;
+    string packet=conn->inBuf.substr(2, len);
+    conn->inBuf.erase(0, len + 2);
+    if(len < sizeof(dnsheader)) {
+      g_stats.serverParseError++;
+      continue;
+    }
+    dnsheader dh;
+    memcpy(&dh, packet.c_str(), sizeof(dh));
+    map<uint16_t, PacketID>::iterator iter=conn->waiting.find(dh.id);
+    if(iter == conn->waiting.end()) { // answer to a query that timed out
+      g_stats.unexpectedCount++;
+      continue;
+    }
+    PacketID pident=iter->second;
+    conn->waiting.erase(iter);
+    MT->sendEvent(pident, &packet); // lwres checks the question
+  }
+}
+
+//! returns a pooled connection to remote that does not have query id out already, if there is one
+static shared_ptr<TCPOutConnection> getTCPOutConnection(const ComboAddress& remote, uint16_t id)
+{
+  shared_ptr<TCPOutConnection> ret;
+  pair<tcpoutconns_t::iterator, tcpoutconns_t::iterator> range=t_tcpOutConns->equal_range(remote);
+  for(; range.first != range.second; ++range.first) {
+    if(!range.first->second->waiting.count(id) && (!ret || range.first->second->waiting.size() < ret->waiting.size()))
+      ret=range.first->second;
+  }
   return ret;
 }
 
+// -2 is OS error, -1 is error, 0 is timeout, 1 is success
+int asendrecvtcp(const ComboAddress& remote, const string& packet, uint16_t id, const string& domain, uint16_t qtype, string* answer)
+{
+  for(int attempt=0; attempt < 2; ++attempt) {
+    shared_ptr<TCPOutConnection> conn;
+    if(!attempt)
+      conn=getTCPOutConnection(remote, id);
+    bool reused=(conn.get()!=0);
+    if(reused) {
+      // a query fits in the socket buffer, unless the server is not reading
+      int ret=send(conn->sock->getHandle(), packet.c_str(), packet.size(), 0);
+      if(ret != (int)packet.size()) {
+        if(ret > 0)
+          closeTCPOutConnection(conn); // half a query on the stream, this connection is beyond saving
+        continue;
+      }
+      g_stats.tcpOutReuses++;
+    }
+    else {
+      try {
+        conn=shared_ptr<TCPOutConnection>(new TCPOutConnection(remote));
+      }
+      catch(NetworkError& ne) {
+        return -2; // OS limits error
+      }
+      int ret=asendtcp(packet, conn->sock.get()); // also waits for the connection to be made
+      if(!(ret > 0))
+        return ret;
+      t_fdm->addReadFD(conn->sock->getHandle(), handleTCPOutReadable, conn);
+      t_tcpOutConns->insert(make_pair(remote, conn));
+    }
+
+    PacketID pident;
+    pident.remote=remote;
+    pident.fd=conn->sock->getHandle();
+    pident.id=id;
+    pident.domain=domain;
+    pident.type=qtype;
+    conn->waiting[id]=pident;
+
+    int ret=MT->waitEvent(pident, answer, g_networkTimeoutMsec);
+    conn->waiting.erase(id);
+    if(ret <= 0) { // a connection that let a query time out is stalled, it must not be handed to the next one
+      closeTCPOutConnection(conn);
+      return ret;
+    }
+    if(answer->empty()) { // the connection broke
+      if(reused)
+        continue; // the server probably closed it while it was idle, try a new one
+      return -1;
+    }
+    conn->lastUsed=g_now.tv_sec;
+    if(!g_tcpOutIdleTimeout && conn->waiting.empty())
+      closeTCPOutConnection(conn);
+    return ret;
+  }
+  return -1;
+}
+
+//! closes outgoing TCP connections that have been idle for longer than outgoing-tcp-idle-timeout
+static void pruneTCPOutConnections(time_t now)
+{
+  vector<shared_ptr<TCPOutConnection> > idle;
+  for(tcpoutconns_t::const_iterator i=t_tcpOutConns->begin(); i != t_tcpOutConns->end(); ++i)
+    if(i->second->waiting.empty() && i->second->lastUsed + (time_t)g_tcpOutIdleTimeout < now)
+      idle.push_back(i->second);
+  for(vector<shared_ptr<TCPOutConnection> >::const_iterator i=idle.begin(); i != idle.end(); ++i)
+    closeTCPOutConnection(*i);
+}
+
 vector<ComboAddress> g_localQueryAddresses4, g_localQueryAddresses6; 
 const ComboAddress g_local4("0.0.0.0"), g_local6("::");
 
@@ -531,6 +689,8 @@ void startDoResolve(void *p)
     // if there is a RecursorLua active, and it 'took' the query in preResolve, we don't launch beginResolve
     if(!t_pdl->get() || !(*t_pdl)->preresolve(dc->d_remote, g_listenSocketsAddresses[dc->d_socket], dc->d_mdp.d_qname, QType(dc->d_mdp.d_qtype), ret, res, &variableAnswer)) {
        res = sr.beginResolve(dc->d_mdp.d_qname, QType(dc->d_mdp.d_qtype), dc->d_mdp.d_qclass, ret);
+       if(sr.wasStale())
+         variableAnswer=true; // keep stale answers out of the packet cache, the refresh will be in soon
 
       if(t_pdl->get()) {
         if(res == RCode::NoError) {
@@ -601,7 +761,7 @@ void startDoResolve(void *p)
     if(!dc->d_tcp) {
       sendto(dc->d_socket, (const char*)&*packet.begin(), packet.size(), 0, (struct sockaddr *)(&dc->d_remote), dc->d_remote.getSocklen());
       if(!SyncRes::s_nopacketcache && !variableAnswer ) {
-        t_packetCache->insertResponsePacket(string((const char*)&*packet.begin(), packet.size()), g_now.tv_sec, 
+        t_packetCache->insertResponsePacket(dc->d_qkey, string((const char*)&*packet.begin(), packet.size()), g_now.tv_sec, 
         				   min(minTTL, 
         				       (pw.getHeader()->rcode == RCode::ServFail) ? SyncRes::s_packetcacheservfailttl : SyncRes::s_packetcachettl
         				       ) 
@@ -687,6 +847,77 @@ void startDoResolve(void *p)
   }
   
   g_stats.maxMThreadStackUsage = max(MT->getMaxStackUsage(), g_stats.maxMThreadStackUsage);
+  g_stats.mthreadStackHighWater = max((unsigned int)MT->getStackHighWater(), g_stats.mthreadStackHighWater);
+}
+
+struct ThreadMSG
+{
+  pipefunc_t func;
+  bool wantAnswer;
+};
+
+typedef set<pair<string, uint16_t>, CIStringPairCompare> refreshing_t;
+static __thread refreshing_t* t_refreshing; // what this thread is refreshing right now, so we only do it once
+
+static void doRefresh(void* p)
+{
+  pair<string, uint16_t>* task=(pair<string, uint16_t>*)p;
+  try {
+    struct timeval now;
+    Utility::gettimeofday(&now, 0);
+    SyncRes sr(now);
+    sr.setId(MT->getTid());
+    sr.setRefresh();
+    vector<DNSResourceRecord> ret;
+    int res=sr.beginResolve(task->first, QType(task->second), 1, ret);
+    if(!g_quiet)
+      L<<Logger::Warning<<t_id<<" ["<<MT->getTid()<<"] refreshed '"<<task->first<<"|"<<QType(task->second).getName()<<"', took "
+       <<sr.d_outqueries<<" packets, rcode="<<res<<endl;
+  }
+  catch(AhuException &ae) {
+    L<<Logger::Error<<"Error refreshing '"<<task->first<<"': "<<ae.reason<<endl;
+  }
+  catch(std::exception& e) {
+    L<<Logger::Error<<"STL error refreshing '"<<task->first<<"': "<<e.what()<<endl;
+  }
+  t_refreshing->erase(*task);
+  delete task;
+}
+
+//! resolves qname|qtype again in the background, so it is back in the cache with a fresh TTL 
+void scheduleRefresh(const string& qname, const QType& qtype)
+{
+  if(MT->numProcesses() > g_maxMThreads) // client questions come first
+    return;
+  if(!t_refreshing->insert(make_pair(qname, qtype.getCode())).second)
+    return;
+  g_stats.cachePrefetches++;
+  MT->makeThread(doRefresh, new pair<string, uint16_t>(qname, qtype.getCode()));
+}
+
+static __thread vector<PacketID>* t_wakeups; // tasks of this thread waiting on something that is now there
+
+static void* wakeWaiters(vector<PacketID>* keys)
+{
+  string empty;
+  BOOST_FOREACH(const PacketID& key, *keys)
+    MT->sendEvent(key, &empty);
+  delete keys;
+  return 0;
+}
+
+//! wakes up tasks waiting on keys, from the main loop as sendEvent can't be called from within a task
+void wakeTasks(unsigned int threadId, const vector<PacketID>& keys)
+{
+  if(threadId == t_id) {
+    t_wakeups->insert(t_wakeups->end(), keys.begin(), keys.end());
+    return;
+  }
+  ThreadMSG* tmsg = new ThreadMSG();
+  tmsg->func = boost::bind(wakeWaiters, new vector<PacketID>(keys));
+  tmsg->wantAnswer = false;
+  if(write(g_pipes[threadId].writeToThread, &tmsg, sizeof(tmsg)) != sizeof(tmsg))
+    unixDie("write to thread pipe returned wrong size or error");
 }
 
 void makeControlChannelSocket(int processNum=-1)
@@ -839,9 +1070,10 @@ string* doProcessUDPQuestion(const std::string& question, const ComboAddress& fr
      g_stats.ipv6qcounter++;
 
   string response;
+  RecursorPacketCache::QueryKey qkey;
   try {
     uint32_t age;
-    if(!SyncRes::s_nopacketcache && t_packetCache->getResponsePacket(question, g_now.tv_sec, &response, &age)) {
+    if(!SyncRes::s_nopacketcache && t_packetCache->getResponsePacket(question, g_now.tv_sec, &response, &age, &qkey)) {
       if(!g_quiet)
 	L<<Logger::Error<<t_id<< " question answered from packet cache from "<<fromaddr.toString()<<endl;
 
@@ -872,12 +1104,80 @@ string* doProcessUDPQuestion(const std::string& question, const ComboAddress& fr
   DNSComboWriter* dc = new DNSComboWriter(question.c_str(), question.size(), g_now);
   dc->setSocket(fd);
   dc->setRemote(&fromaddr);
+  dc->d_qkey=qkey;
 
   dc->d_tcp=false;
   MT->makeThread(startDoResolve, (void*) dc); // deletes dc
   return 0;
 } 
  
+//! case insensitive hash over the name in the question section, returns false if the packet is too mangled to find it
+static bool hashQuestionName(const char* packet, unsigned int len, uint32_t* hash)
+{
+  uint32_t ret=2166136261U;
+  unsigned int pos=sizeof(dnsheader);
+  while(pos < len) {
+    unsigned int labellen=(unsigned char)packet[pos++];
+    if(!labellen) {
+      *hash=ret;
+      return true;
+    }
+    if(labellen > 63 || pos + labellen > len)
+      return false;
+    ret=pdns_ihash(packet+pos, labellen, ret);
+    pos+=labellen;
+  }
+  return false;
+}
+
+/* hands a question to one of the worker threads, through the ring of that thread. We only write to its pipe if it
+   might be asleep, so under load no system calls are needed at all */
+static void distributeUDPQuestion(const char* data, unsigned int len, const ComboAddress& fromaddr, int fd)
+{
+  static unsigned int counter;
+  uint32_t hash;
+  unsigned int target;
+  if(g_distributeByName && hashQuestionName(data, len, &hash))
+    target = 1 + (hash % (g_pipes.size()-1)); // so the same name always ends up in the same caches
+  else
+    target = 1 + (++counter % (g_pipes.size()-1));
+
+  ThreadPipeSet& tps = g_pipes[target];
+  QueuedQuestion* qq = tps.queries->reserve();
+  if(!qq) {
+    g_stats.overCapacityDrops++;
+    return;
+  }
+  qq->fromaddr=fromaddr;
+  qq->fd=fd;
+  qq->len=min(len, (unsigned int)sizeof(qq->data));
+  memcpy(qq->data, data, qq->len);
+
+  if(tps.queries->push()) {
+    char c=0;
+    if(write(tps.writeQueriesToThread, &c, 1) < 0 && errno != EAGAIN) // EAGAIN: plenty of wakeups pending already
+      unixDie("write to thread query pipe returned error");
+  }
+}
+
+// runs in a worker thread, answers everything the distributing thread queued for us
+static void handleQueuedQuestions(int fd, FDMultiplexer::funcparam_t& var)
+{
+  char buf[64];
+  while(read(fd, buf, sizeof(buf)) == sizeof(buf)) // read end is non-blocking
+    ;
+
+  SPSCRing<QueuedQuestion>& queries = *g_pipes[t_id].queries;
+  QueuedQuestion* qq;
+  while((qq = queries.front())) {
+    string question(qq->data, qq->len);
+    ComboAddress fromaddr=qq->fromaddr;
+    int qfd=qq->fd;
+    queries.pop();
+    doProcessUDPQuestion(question, fromaddr, qfd);
+  }
+}
+
 void handleNewUDPQuestion(int fd, FDMultiplexer::funcparam_t& var)
 {
   int len;
@@ -903,11 +1203,12 @@ void handleNewUDPQuestion(int fd, FDMultiplexer::funcparam_t& var)
           L<<Logger::Error<<"Ignoring answer from "<<fromaddr.toString()<<" on server socket!"<<endl;
       }
       else {
-	string question(data, len);
 	if(g_weDistributeQueries)
-	  distributeAsyncFunction(boost::bind(doProcessUDPQuestion, question, fromaddr, fd));
-	else
+	  distributeUDPQuestion(data, len, fromaddr, fd);
+	else {
+	  string question(data, len);
 	  doProcessUDPQuestion(question, fromaddr, fd);
+	}
       }
     }
     catch(MOADNSException& mde) {
@@ -1136,8 +1437,15 @@ try
     dt.setTimeval(now);
     t_RC->doPrune(); // this function is local to a thread, so fine anyhow
     t_packetCache->doPruneTo(::arg().asNum("max-packetcache-entries") / g_numThreads);
+    pruneTCPOutConnections(now.tv_sec);
     
     pruneCollection(t_sstorage->negcache, ::arg().asNum("max-cache-entries") / (g_numThreads * 10), 200);
+
+    for(SyncRes::negzonelimits_t::iterator i = t_sstorage->negZoneLimits.begin(); i != t_sstorage->negZoneLimits.end(); )
+      if(i->second.d_second < now.tv_sec - 1)
+        t_sstorage->negZoneLimits.erase(i++);
+      else
+        ++i;
     
     if(!((cleanCounter++)%40)) {  // this is a full scan!
       time_t limit=now.tv_sec-300;
@@ -1195,17 +1503,23 @@ void makeThreadPipes()
       unixDie("Creating pipe for inter-thread communications");
     tps.readFromThread = fd[0];
     tps.writeFromThread = fd[1];
+
+    tps.queries = 0;
+    tps.readQueriesToThread = tps.writeQueriesToThread = -1;
+    if(g_weDistributeQueries && n) { // thread 0 does the distributing
+      if(pipe(fd) < 0)
+        unixDie("Creating pipe for inter-thread communications");
+      tps.readQueriesToThread = fd[0];
+      tps.writeQueriesToThread = fd[1];
+      Utility::setNonBlocking(fd[0]);
+      Utility::setNonBlocking(fd[1]);
+      tps.queries = new SPSCRing<QueuedQuestion>(1024);
+    }
     
     g_pipes.push_back(tps);
   }
 }
 
-struct ThreadMSG
-{
-  pipefunc_t func;
-  bool wantAnswer;
-};
-
 void broadcastFunction(const pipefunc_t& func, bool skipSelf)
 {
   unsigned int n = 0;
@@ -1342,37 +1656,6 @@ void handleRCC(int fd, FDMultiplexer::funcparam_t& var)
   }
 }
 
-void handleTCPClientReadable(int fd, FDMultiplexer::funcparam_t& var)
-{
-  PacketID* pident=any_cast<PacketID>(&var);
-  //  cerr<<"handleTCPClientReadable called for fd "<<fd<<", pident->inNeeded: "<<pident->inNeeded<<", "<<pident->sock->getHandle()<<endl;
-
-  shared_array<char> buffer(new char[pident->inNeeded]);
-
-  int ret=recv(fd, buffer.get(), pident->inNeeded,0);
-  if(ret > 0) {
-    pident->inMSG.append(&buffer[0], &buffer[ret]);
-    pident->inNeeded-=ret;
-    if(!pident->inNeeded) {
-      //      cerr<<"Got entire load of "<<pident->inMSG.size()<<" bytes"<<endl;
-      PacketID pid=*pident;
-      string msg=pident->inMSG;
-      
-      t_fdm->removeReadFD(fd);
-      MT->sendEvent(pid, &msg); 
-    }
-    else {
-      //      cerr<<"Still have "<<pident->inNeeded<<" left to go"<<endl;
-    }
-  }
-  else {
-    PacketID tmp=*pident;
-    t_fdm->removeReadFD(fd); // pident might now be invalid (it isn't, but still)
-    string empty;
-    MT->sendEvent(tmp, &empty); // this conveys error status
-  }
-}
-
 void handleTCPClientWritable(int fd, FDMultiplexer::funcparam_t& var)
 {
   PacketID* pid=any_cast<PacketID>(&var);
@@ -1713,6 +1996,9 @@ int serviceMain(int argc, char*argv[])
   g_weDistributeQueries = ::arg().mustDo("pdns-distributes-queries");
   if(g_weDistributeQueries) {
       L<<Logger::Warning<<"PowerDNS Recursor itself will distribute queries over threads"<<endl;
+      g_distributeByName = ::arg().mustDo("distribute-by-qname");
+      if(g_distributeByName)
+        L<<Logger::Warning<<"Queries for the same name will be handled by the same thread"<<endl;
   }
   
   if(::arg()["trace"]=="fail") {
@@ -1757,11 +2043,17 @@ int serviceMain(int argc, char*argv[])
   SyncRes::s_noEDNS = ::arg().mustDo("disable-edns");
 
   SyncRes::s_nopacketcache = ::arg().mustDo("disable-packetcache");
+  SyncRes::s_aggressiveNXDomain = ::arg().mustDo("aggressive-nxdomain");
+  SyncRes::s_coalesceQueries = ::arg().mustDo("coalesce-queries");
+  SyncRes::s_hedgePercent = ::arg().asNum("hedge-percent");
+  SyncRes::s_negZoneQPS = ::arg().asNum("negative-zone-qps");
 
   SyncRes::s_maxnegttl=::arg().asNum("max-negative-ttl");
   SyncRes::s_maxcachettl=::arg().asNum("max-cache-ttl");
   SyncRes::s_packetcachettl=::arg().asNum("packetcache-ttl");
   SyncRes::s_packetcacheservfailttl=::arg().asNum("packetcache-servfail-ttl");
+  MemRecursorCache::s_prefetchHits=::arg().asNum("prefetch-hits");
+  MemRecursorCache::s_serveStale=::arg().asNum("serve-stale");
   SyncRes::s_serverID=::arg()["server-id"];
   if(SyncRes::s_serverID.empty()) {
     char tmp[128];
@@ -1818,10 +2110,15 @@ int serviceMain(int argc, char*argv[])
 
   Utility::dropPrivs(newuid, newgid);
   g_numThreads = ::arg().asNum("threads") + ::arg().mustDo("pdns-distributes-queries");
+  if(::arg().mustDo("shared-cache")) {
+    g_sharedRC=MemRecursorCache::makeSharedStore(::arg().asNum("cache-shards"));
+    L<<Logger::Warning<<"All threads share one record cache, in "<<::arg().asNum("cache-shards")<<" shards"<<endl;
+  }
   
   makeThreadPipes();
   
   g_tcpTimeout=::arg().asNum("client-tcp-timeout");
+  g_tcpOutIdleTimeout=::arg().asNum("outgoing-tcp-idle-timeout");
   g_maxTCPPerClient=::arg().asNum("max-tcp-per-client");
   g_maxMThreads=::arg().asNum("max-mthreads");
 
@@ -1852,6 +2149,9 @@ try
   t_allowFrom = g_initialAllowFrom;
   t_udpclientsocks = new UDPClientSocks();
   t_tcpClientCounts = new tcpClientCounts_t();
+  t_refreshing = new refreshing_t();
+  t_wakeups = new vector<PacketID>();
+  t_tcpOutConns = new tcpoutconns_t();
   primeHints();
   
   t_packetCache = new RecursorPacketCache();
@@ -1883,7 +2183,7 @@ try
     memset(&t_remotes->remotes[0], 0, t_remotes->remotes.size() * sizeof(RemoteKeeper::remotes_t::value_type));
   
   
-  MT=new MTasker<PacketID,string>(::arg().asNum("stack-size"));
+  MT=new MTasker<PacketID,string>(::arg().asNum("stack-size"), g_maxMThreads); // never more free stacks than we can have mthreads
   
   PacketID pident;
 
@@ -1897,6 +2197,8 @@ try
   }
 
   t_fdm->addReadFD(g_pipes[t_id].readToThread, handlePipeRequest);
+  if(g_pipes[t_id].queries)
+    t_fdm->addReadFD(g_pipes[t_id].readQueriesToThread, handleQueuedQuestions);
 
   if(!g_weDistributeQueries || !t_id)  // if we distribute queries, only t_id = 0 listens
     for(deferredAdd_t::const_iterator i=deferredAdd.begin(); i!=deferredAdd.end(); ++i) 
@@ -1913,6 +2215,11 @@ try
   counter=0; // used to periodically execute certain tasks
   for(;;) {
     while(MT->schedule(&g_now)); // MTasker letting the mthreads do their thing
+    while(!t_wakeups->empty()) {
+      vector<PacketID>* keys = new vector<PacketID>();
+      keys->swap(*t_wakeups);
+      wakeWaiters(keys);
+    }
       
     if(!(counter%500)) {
       MT->makeThread(houseKeeping, 0);
@@ -2051,10 +2358,19 @@ int main(int argc, char **argv)
     ::arg().set("client-tcp-timeout","Timeout in seconds when talking to TCP clients")="2";
     ::arg().set("max-mthreads", "Maximum number of simultaneous Mtasker threads")="2048";
     ::arg().set("max-tcp-clients","Maximum number of simultaneous TCP clients")="128";
+    ::arg().set("hedge-percent", "If set, also ask the next best server when the first has not answered in this percentage of its average response time")="0";
     ::arg().set("hint-file", "If set, load root hints from this file")="";
     ::arg().set("max-cache-entries", "If set, maximum number of entries in the main cache")="1000000";
+    ::arg().setSwitch("shared-cache", "If set, all threads share one record cache instead of each having their own")="no";
+    ::arg().set("cache-shards", "Number of separately locked parts of the shared record cache")="1024";
+    ::arg().set("prefetch-hits", "If set, refresh records hit this often before they expire, in the background")="0";
+    ::arg().set("serve-stale", "If set, answer with records that expired at most this many seconds ago while they are refreshed")="0";
     ::arg().set("max-negative-ttl", "maximum number of seconds to keep a negative cached entry in memory")="3600";
+    ::arg().setSwitch("aggressive-nxdomain", "If set, names below a name that is cached as not existing are answered with NXDOMAIN from the cache")="no";
+    ::arg().setSwitch("coalesce-queries", "If set, a question to an authoritative server that is already being asked is not sent again, but waits for the answer to the first one")="no";
+    ::arg().set("negative-zone-qps", "If set, maximum number of queries per second and thread for uncached names in a zone that recently denied names")="0";
     ::arg().set("max-cache-ttl", "maximum number of seconds to keep a cached entry in memory")="86400";
+    ::arg().set("outgoing-tcp-idle-timeout", "Seconds to keep an unused TCP connection to an authoritative server open for reuse, 0 to close it after each query")="10";
     ::arg().set("packetcache-ttl", "maximum number of seconds to keep a cached entry in packetcache")="3600";
     ::arg().set("max-packetcache-entries", "maximum number of entries to keep in the packetcache")="500000";
     ::arg().set("packetcache-servfail-ttl", "maximum number of seconds to keep a cached servfail entry in packetcache")="60";
@@ -2083,6 +2399,7 @@ int main(int argc, char **argv)
     ::arg().setSwitch( "disable-edns", "Disable EDNS" )= ""; 
     ::arg().setSwitch( "disable-packetcache", "Disable packetcache" )= "no"; 
     ::arg().setSwitch( "pdns-distributes-queries", "If PowerDNS itself should distribute queries over threads (EXPERIMENTAL)")="no";
+    ::arg().setSwitch( "distribute-by-qname", "With pdns-distributes-queries, always send queries for the same name to the same thread")="no";
     
 
     ::arg().setCmd("help","Provide a helpful message");
@@ -147,6 +147,8 @@ static uint64_t dumpNegCache(SyncRes::negcache_t& negcache, int fd)
 
 static uint64_t* pleaseDump(int fd)
 {
+  if(t_RC->isShared() && t_id) // thread 0 dumps the shared cache for everybody
+    return new uint64_t(dumpNegCache(t_sstorage->negcache, fd));
   return new uint64_t(t_RC->doDump(fd) + dumpNegCache(t_sstorage->negcache, fd));
 }
 
@@ -307,14 +309,24 @@ static uint64_t getConcurrentQueries()
   return broadcastAccFunction<uint64_t>(pleaseGetConcurrentQueries);
 }
 
+uint64_t* pleaseGetFreeStacks()
+{
+  return new uint64_t(MT->numFreeStacks());
+}
+
+static uint64_t getFreeStacks()
+{
+  return broadcastAccFunction<uint64_t>(pleaseGetFreeStacks);
+}
+
 uint64_t* pleaseGetCacheSize()
 {
-  return new uint64_t(t_RC->size());
+  return new uint64_t(t_RC->isShared() && t_id ? 0 : t_RC->size()); // a shared cache is counted once
 }
 
 uint64_t* pleaseGetCacheBytes()
 {
-  return new uint64_t(t_RC->bytes());
+  return new uint64_t(t_RC->isShared() && t_id ? 0 : t_RC->bytes());
 }
 
 
@@ -444,8 +456,16 @@ RecursorControlParser::RecursorControlParser()
   addGetStat("resource-limits", &g_stats.resourceLimits);
   addGetStat("over-capacity-drops", &g_stats.overCapacityDrops);
   addGetStat("no-packet-error", &g_stats.noPacketError);
+  addGetStat("cache-prefetches", &g_stats.cachePrefetches);
+  addGetStat("stale-answers", &g_stats.staleAnswers);
+  addGetStat("negative-zone-drops", &g_stats.negZoneDrops);
+  addGetStat("coalesced-outqueries", &g_stats.coalescedOutQueries);
+  addGetStat("hedged-outqueries", &g_stats.hedgedOutQueries);
+  addGetStat("hedge-wins", &g_stats.hedgeWins);
   addGetStat("dlg-only-drops", &SyncRes::s_nodelegated);
   addGetStat("max-mthread-stack", &g_stats.maxMThreadStackUsage);
+  addGetStat("mthread-stack-hwm", &g_stats.mthreadStackHighWater);
+  addGetStat("mthread-stacks-free", boost::bind(getFreeStacks));
   
   addGetStat("negcache-entries", boost::bind(getNegCacheSize));
   addGetStat("throttle-entries", boost::bind(getThrottleSize)); 
@@ -455,6 +475,7 @@ RecursorControlParser::RecursorControlParser()
   addGetStat("concurrent-queries", boost::bind(getConcurrentQueries)); 
   addGetStat("outgoing-timeouts", &SyncRes::s_outgoingtimeouts);
   addGetStat("tcp-outqueries", &SyncRes::s_tcpoutqueries);
+  addGetStat("tcp-out-reuses", &g_stats.tcpOutReuses);
   addGetStat("all-outqueries", &SyncRes::s_outqueries);
   addGetStat("ipv6-outqueries", &g_stats.ipv6queries);
   addGetStat("throttled-outqueries", &SyncRes::s_throttledqueries);
@@ -573,6 +573,11 @@ int main(int argc, char **argv)
     ::arg().parse(argc,argv);
     UeberBackend::go();
     N=new UDPNameserver; // this fails when we are not root, throws exception
+    if(::arg().mustDo("reuseport")) {
+      g_udpReceivers.push_back(N);
+      for(int n=1; n < ::arg().asNum("receiver-threads"); ++n)
+        g_udpReceivers.push_back(new UDPNameserver);
+    }
     
     if(!::arg().mustDo("disable-tcp"))
       TN=new TCPNameserver; 
@@ -1,8 +1,7 @@
 #include <iostream>
-#include <boost/foreach.hpp>
 #include "recpacketcache.hh"
-#include "cachecleaner.hh"
 #include "dns.hh"
+#include "misc.hh"
 #include "namespaces.hh"
 #include "lock.hh"
 
@@ -10,94 +9,256 @@
 RecursorPacketCache::RecursorPacketCache()
 {
   d_hits = d_misses = 0;
+  d_entries.resize(1);
+  d_entries[0].d_prev = d_entries[0].d_next = 0;
+  d_table.resize(1024, 0);
+  d_mask = d_table.size() - 1;
+  d_free = 0;
+  d_size = 0;
+}
+
+uint32_t RecursorPacketCache::hashQuestion(const char* packet, unsigned int qlen, uint8_t flags, uint16_t ednssize)
+{
+  uint32_t hash = pdns_ihash(packet + sizeof(struct dnsheader), (size_t)qlen);
+  return (hash ^ ((flags << 16) | ednssize)) * 16777619U;
+}
+
+// only plain queries with a single question, and at most an OPT record besides that, are cacheable
+bool RecursorPacketCache::getQueryKey(const char* packet, unsigned int len, QueryKey* key)
+{
+  key->qlen = 0;
+  if(len < sizeof(struct dnsheader))
+    return false;
+  struct dnsheader dh;
+  memcpy(&dh, packet, sizeof(dh));
+  if(ntohs(dh.qdcount) != 1 || dh.ancount || dh.nscount)
+    return false;
+
+  unsigned int pos = sizeof(dh);
+  unsigned char labellen;
+  while(pos < len && (labellen = packet[pos])) {
+    if(labellen & 0xc0)
+      return false;
+    pos += labellen + 1;
+  }
+  pos += 5; // root label, qtype, qclass
+  if(pos > len)
+    return false;
+
+  key->ednssize = 0;
+  if(dh.arcount) {
+    // the OPT record: root name, type, class holding the buffer size
+    if(ntohs(dh.arcount) != 1 || pos + 5 > len || packet[pos] || 
+       (unsigned char)packet[pos+1] * 256 + (unsigned char)packet[pos+2] != QType::OPT)
+      return false;
+    key->ednssize = (unsigned char)packet[pos+3] * 256 + (unsigned char)packet[pos+4];
+  }
+
+  key->flags = packet[2] & 0x79; // opcode and RD
+  key->hash = hashQuestion(packet, pos - sizeof(dh), key->flags, key->ednssize);
+  key->qlen = pos - sizeof(dh);
+  return true;
+}
+
+// packet can be the query or an answer to it, both hold the same question
+uint32_t RecursorPacketCache::find(const char* packet, const QueryKey& key) const
+{
+  for(uint32_t pos = key.hash & d_mask; d_table[pos]; pos = (pos + 1) & d_mask) {
+    const Entry& e = d_entries[d_table[pos]];
+    if(e.d_hash == key.hash && e.d_qlen == key.qlen && e.d_ednssize == key.ednssize && e.d_flags == key.flags &&
+       !memcmp(e.d_packet.c_str() + sizeof(struct dnsheader), packet + sizeof(struct dnsheader), key.qlen))
+      return d_table[pos];
+  }
+  return 0;
+}
+
+void RecursorPacketCache::tableInsert(uint32_t idx)
+{
+  uint32_t pos;
+  for(pos = d_entries[idx].d_hash & d_mask; d_table[pos]; pos = (pos + 1) & d_mask)
+    ;
+  d_table[pos] = idx;
+}
+
+void RecursorPacketCache::grow()
+{
+  d_table.clear();
+  d_table.resize((d_mask + 1) * 2, 0);
+  d_mask = d_table.size() - 1;
+  for(uint32_t idx = d_entries[0].d_next; idx; idx = d_entries[idx].d_next)
+    tableInsert(idx);
+}
+
+void RecursorPacketCache::unlink(uint32_t idx)
+{
+  Entry& e = d_entries[idx];
+  d_entries[e.d_prev].d_next = e.d_next;
+  d_entries[e.d_next].d_prev = e.d_prev;
+}
+
+void RecursorPacketCache::linkAtBack(uint32_t idx)
+{
+  Entry& e = d_entries[idx];
+  e.d_prev = d_entries[0].d_prev;
+  e.d_next = 0;
+  d_entries[e.d_prev].d_next = idx;
+  d_entries[0].d_prev = idx;
+}
+
+void RecursorPacketCache::linkAtFront(uint32_t idx)
+{
+  Entry& e = d_entries[idx];
+  e.d_next = d_entries[0].d_next;
+  e.d_prev = 0;
+  d_entries[e.d_next].d_prev = idx;
+  d_entries[0].d_next = idx;
+}
+
+void RecursorPacketCache::remove(uint32_t idx)
+{
+  Entry& e = d_entries[idx];
+  uint32_t hole;
+  for(hole = e.d_hash & d_mask; d_table[hole] != idx; hole = (hole + 1) & d_mask)
+    ;
+
+  // shift back anything further along the probe sequence that is allowed to move into the hole, so we need no tombstones
+  for(uint32_t pos = (hole + 1) & d_mask; d_table[pos]; pos = (pos + 1) & d_mask) {
+    uint32_t home = d_entries[d_table[pos]].d_hash & d_mask;
+    if(((pos - home) & d_mask) >= ((pos - hole) & d_mask)) {
+      d_table[hole] = d_table[pos];
+      hole = pos;
+    }
+  }
+  d_table[hole] = 0;
+
+  unlink(idx);
+  string().swap(e.d_packet);
+  e.d_next = d_free;
+  d_free = idx;
+  --d_size;
 }
 
 int RecursorPacketCache::doWipePacketCache(const string& name, uint16_t qtype)
 {
   int count=0;
-  for(packetCache_t::iterator iter = d_packetCache.begin(); iter != d_packetCache.end();)
-  {
-    const struct dnsheader* packet = reinterpret_cast<const struct dnsheader*>((*iter).d_packet.c_str());
-    if (packet->qdcount > 0) 
-    {
-	// find out type
-	const struct dnsrecordheader *header = reinterpret_cast<const struct dnsrecordheader*>((*iter).d_packet.c_str()+sizeof(struct dnsheader));
-	uint16_t type = header->d_type;
-	std::string domain=questionExpand((*iter).d_packet.c_str(), (*iter).d_packet.size(), type); 	
-	if (pdns_iequals(name,domain)) 
-	{ 
-  	  iter = d_packetCache.erase(iter);
-	  count++;
-	} else iter++;
+  for(uint32_t idx = d_entries[0].d_next; idx; ) {
+    const Entry& e = d_entries[idx];
+    uint32_t next = e.d_next;
+    uint16_t type;
+    std::string domain=questionExpand(e.d_packet.c_str(), e.d_packet.size(), type);
+    if((qtype == 0xffff || qtype == type) && pdns_iequals(name,domain)) {
+      remove(idx);
+      count++;
     }
+    idx = next;
   }
   return count;
 }
 
 bool RecursorPacketCache::getResponsePacket(const std::string& queryPacket, time_t now, 
-  std::string* responsePacket, uint32_t* age)
-{
-  struct Entry e;
-  e.d_packet=queryPacket;
-  
-  packetCache_t::const_iterator iter = d_packetCache.find(e);
-  
-  if(iter == d_packetCache.end()) {
+  std::string* responsePacket, uint32_t* age, QueryKey* key)
+{
+  uint32_t idx;
+  if(!getQueryKey(queryPacket.c_str(), queryPacket.length(), key) || !(idx = find(queryPacket.c_str(), *key))) {
     d_misses++;
     return false;
   }
-    
-  if((uint32_t)now < iter->d_ttd) { // it is fresh!
-//    cerr<<"Fresh for another "<<iter->d_ttd - now<<" seconds!"<<endl;
-    *age = now - iter->d_creation;
-    uint16_t id;
-    memcpy(&id, queryPacket.c_str(), 2); 
-    *responsePacket = iter->d_packet;
-    responsePacket->replace(0, 2, (char*)&id, 2);
-    d_hits++;
-    moveCacheItemToBack(d_packetCache, iter);
 
+  const Entry& e = d_entries[idx];
+  if((uint32_t)now < e.d_ttd) { // it is fresh!
+//    cerr<<"Fresh for another "<<e.d_ttd - now<<" seconds!"<<endl;
+    *age = now - e.d_creation;
+    *responsePacket = e.d_packet;
+    responsePacket->replace(0, 2, queryPacket.c_str(), 2);
+    d_hits++;
+    unlink(idx);
+    linkAtBack(idx);
     return true;
   }
-  moveCacheItemToFront(d_packetCache, iter);
+  unlink(idx);
+  linkAtFront(idx);
   d_misses++;
   return false;
 }
 
-void RecursorPacketCache::insertResponsePacket(const std::string& responsePacket, time_t now, uint32_t ttl)
+void RecursorPacketCache::insertResponsePacket(const QueryKey& key, const std::string& responsePacket, time_t now, uint32_t ttl)
 {
-  struct Entry e;
+  if(!key.qlen)
+    return;
+  // the answer has to echo the question, as that is what lookups compare against
+  if(responsePacket.length() < sizeof(struct dnsheader) + key.qlen ||
+     hashQuestion(responsePacket.c_str(), key.qlen, key.flags, key.ednssize) != key.hash)
+    return;
+
+  uint32_t idx = find(responsePacket.c_str(), key);
+  if(idx) {
+    Entry& e = d_entries[idx];
+    e.d_packet = responsePacket;
+    e.d_ttd = now + ttl;
+    e.d_creation = now;
+    return;
+  }
+
+  if((d_size + 1) * 2 > d_table.size())
+    grow();
+
+  if(d_free) {
+    idx = d_free;
+    d_free = d_entries[idx].d_next;
+  }
+  else {
+    idx = d_entries.size();
+    d_entries.push_back(Entry());
+  }
+  Entry& e = d_entries[idx];
   e.d_packet = responsePacket;
-  e.d_ttd = now+ttl;
+  e.d_hash = key.hash;
+  e.d_ttd = now + ttl;
   e.d_creation = now;
-  packetCache_t::iterator iter = d_packetCache.find(e);
-  
-  if(iter != d_packetCache.end()) {
-    iter->d_packet = responsePacket;
-    iter->d_ttd = now + ttl;
-    iter->d_creation = now;
-  }
-  else 
-    d_packetCache.insert(e);
+  e.d_qlen = key.qlen;
+  e.d_ednssize = key.ednssize;
+  e.d_flags = key.flags;
+  tableInsert(idx);
+  linkAtBack(idx);
+  ++d_size;
 }
 
 uint64_t RecursorPacketCache::size()
 {
-  return d_packetCache.size();
+  return d_size;
 }
 
 uint64_t RecursorPacketCache::bytes()
 {
-  uint64_t sum=0;
-  BOOST_FOREACH(const struct Entry& e, d_packetCache) {
-    sum += sizeof(e) + e.d_packet.length() + 4;
-  }
+  uint64_t sum = d_entries.capacity() * sizeof(Entry) + d_table.size() * sizeof(uint32_t);
+  for(uint32_t idx = d_entries[0].d_next; idx; idx = d_entries[idx].d_next)
+    sum += d_entries[idx].d_packet.length();
   return sum;
 }
 
-
+// like pruneCollection() in cachecleaner.hh: the oldest entries are at the front of the LRU list, on a hit we move an entry to
+// the back, on an expired hit to the front
 void RecursorPacketCache::doPruneTo(unsigned int maxCached)
 {
-  pruneCollection(d_packetCache, maxCached);
-}
+  uint32_t now=(uint32_t)time(0);
+  unsigned int toTrim = d_size > maxCached ? d_size - maxCached : 0;
+  unsigned int lookAt = toTrim ? 5*toTrim : d_size/1000;
+  unsigned int tried=0, erased=0;
 
+  for(uint32_t idx = d_entries[0].d_next; idx && tried < lookAt; ++tried) {
+    uint32_t next = d_entries[idx].d_next;
+    if(d_entries[idx].d_ttd < now) {
+      remove(idx);
+      erased++;
+    }
+    idx = next;
+    if(toTrim && erased > toTrim)
+      break;
+  }
+
+  if(erased >= toTrim) // done
+    return;
+
+  for(toTrim -= erased; toTrim && d_entries[0].d_next; --toTrim)
+    remove(d_entries[0].d_next);  // just lob it off from the beginning
+}
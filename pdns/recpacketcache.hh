@@ -1,26 +1,34 @@
 #ifndef PDNS_RECPACKETCACHE_HH
 #define PDNS_RECPACKETCACHE_HH
 #include <string>
-#include <set>
+#include <vector>
 #include <inttypes.h>
 #include "dns.hh"
 #include "namespaces.hh"
 #include <iostream>
-#include <boost/multi_index_container.hpp>
-#include <boost/multi_index/ordered_index.hpp>
-#include <boost/tuple/tuple_comparison.hpp>
-#include <boost/multi_index/sequenced_index.hpp>
 
+/** Stores whole packets, ready for lobbing back at the client. Not threadsafe.
 
-using namespace ::boost::multi_index;
-
-//! Stores whole packets, ready for lobbing back at the client. Not threadsafe.
+    Queries are hashed once on arrival over their (case folded) question, opcode, RD bit and EDNS buffer size. Entries live in a
+    flat vector and are found through an open addressing table of indices into it, with linear probing. A hit then costs one hash
+    and one memcmp of the question against the cached answer, which echoes it. The entries also form an intrusive LRU list, oldest
+    first, which is what doPruneTo() eats from. */
 class RecursorPacketCache
 {
 public:
+  //! what getResponsePacket() learned about a query, hand it to insertResponsePacket() along with the answer
+  struct QueryKey
+  {
+    QueryKey() : qlen(0) {}
+    uint32_t hash;
+    uint16_t qlen;     //!< length of the question, from the end of the header up to and including qclass. 0 if not cacheable
+    uint16_t ednssize; //!< 0 if the query had no OPT record
+    uint8_t flags;     //!< opcode and RD, as they sit in the header
+  };
+
   RecursorPacketCache();
-  bool getResponsePacket(const std::string& queryPacket, time_t now, std::string* responsePacket, uint32_t* age);
-  void insertResponsePacket(const std::string& responsePacket, time_t now, uint32_t ttd);
+  bool getResponsePacket(const std::string& queryPacket, time_t now, std::string* responsePacket, uint32_t* age, QueryKey* key);
+  void insertResponsePacket(const QueryKey& key, const std::string& responsePacket, time_t now, uint32_t ttl);
   void doPruneTo(unsigned int maxSize=250000);
   int doWipePacketCache(const string& name, uint16_t qtype=0xffff);
   
@@ -30,45 +38,33 @@ public:
   uint64_t bytes();
 
 private:
-
   struct Entry 
   {
-    mutable uint32_t d_ttd;
-    mutable uint32_t d_creation;
-    mutable std::string d_packet; // "I know what I am doing"
-
-    inline bool operator<(const struct Entry& rhs) const;
-    
-    uint32_t getTTD() const
-    {
-      return d_ttd;
-    }
+    std::string d_packet;
+    uint32_t d_hash;
+    uint32_t d_ttd;
+    uint32_t d_creation;
+    uint32_t d_prev, d_next; //!< LRU neighbours, d_next also links the free list
+    uint16_t d_qlen;
+    uint16_t d_ednssize;
+    uint8_t d_flags;
   };
- 
-  typedef multi_index_container<
-    Entry,
-    indexed_by  <
-                  ordered_unique<identity<Entry> >, 
-                  sequenced<> 
-               >
-  > packetCache_t;
-  
-   packetCache_t d_packetCache;
-};
-
-// needs to take into account: qname, qtype, opcode, rd, qdcount, EDNS size
-inline bool RecursorPacketCache::Entry::operator<(const struct RecursorPacketCache::Entry &rhs) const
-{
-  const struct dnsheader* 
-    dh=(const struct dnsheader*) d_packet.c_str(), 
-    *rhsdh=(const struct dnsheader*)rhs.d_packet.c_str();
-  if(make_tuple(dh->opcode, dh->rd, dh->qdcount) < 
-     make_tuple(rhsdh->opcode, rhsdh->rd, rhsdh->qdcount))
-    return true;
-
-  return dnspacketLessThan(d_packet, rhs.d_packet);
-}
 
+  static uint32_t hashQuestion(const char* packet, unsigned int qlen, uint8_t flags, uint16_t ednssize);
+  static bool getQueryKey(const char* packet, unsigned int len, QueryKey* key);
+  uint32_t find(const char* packet, const QueryKey& key) const;
+  void remove(uint32_t idx);
+  void unlink(uint32_t idx);
+  void linkAtBack(uint32_t idx);
+  void linkAtFront(uint32_t idx);
+  void tableInsert(uint32_t idx);
+  void grow();
 
+  vector<Entry> d_entries;  //!< d_entries[0] is the head of the LRU list, it never holds a packet
+  vector<uint32_t> d_table; //!< indices into d_entries, 0 is an empty slot
+  uint32_t d_mask;
+  uint32_t d_free;          //!< first unused entry, 0 if none
+  uint32_t d_size;
+};
 
 #endif
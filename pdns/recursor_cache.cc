@@ -7,6 +7,7 @@
 #include "syncres.hh"
 #include "recursor_cache.hh"
 #include "cachecleaner.hh"
+#include "lock.hh"
 
 #include "namespaces.hh"
 #include "namespaces.hh"
@@ -86,49 +87,141 @@ string DNSRR2String(const DNSResourceRecord& rr)
   }
 }
 
+struct MemRecursorCache::Shard : public boost::noncopyable
+{
+  Shard()
+  {
+    pthread_rwlock_init(&d_lock, 0);
+  }
+  ~Shard()
+  {
+    pthread_rwlock_destroy(&d_lock);
+  }
+  cache_t d_map;
+  pthread_rwlock_t d_lock;
+};
+
+struct MemRecursorCache::SharedStore : public boost::noncopyable
+{
+  explicit SharedStore(unsigned int shards) : d_shards(new Shard[shards]), d_numshards(shards), d_prunepos(0)
+  {}
+  ~SharedStore()
+  {
+    delete[] d_shards;
+  }
+  Shard* d_shards;
+  unsigned int d_numshards;
+  unsigned int d_prunepos; //!< next shard to prune, only touched atomically
+};
+
+shared_ptr<MemRecursorCache::SharedStore> MemRecursorCache::makeSharedStore(unsigned int shards)
+{
+  return shared_ptr<SharedStore>(new SharedStore(shards ? shards : 1));
+}
+
+MemRecursorCache::Shard& MemRecursorCache::getShard(const DNSName& qname)
+{
+  return d_store->d_shards[qname.hash() % d_store->d_numshards];
+}
+
 unsigned int MemRecursorCache::size()
 {
-  return (unsigned int)d_cache.size();
+  if(!d_store)
+    return (unsigned int)d_cache.size();
+
+  unsigned int ret=0;
+  for(unsigned int n=0; n < d_store->d_numshards; ++n) {
+    ReadLock rl(&d_store->d_shards[n].d_lock);
+    ret+=d_store->d_shards[n].d_map.size();
+  }
+  return ret;
 }
 
 unsigned int MemRecursorCache::bytes()
+{
+  if(!d_store)
+    return bytes(d_cache);
+
+  unsigned int ret=0;
+  for(unsigned int n=0; n < d_store->d_numshards; ++n) {
+    ReadLock rl(&d_store->d_shards[n].d_lock);
+    ret+=bytes(d_store->d_shards[n].d_map);
+  }
+  return ret;
+}
+
+unsigned int MemRecursorCache::bytes(const cache_t& cache)
 {
   unsigned int ret=0;
 
-  for(cache_t::const_iterator i=d_cache.begin(); i!=d_cache.end(); ++i) {
+  for(cache_t::const_iterator i=cache.begin(); i!=cache.end(); ++i) {
     ret+=sizeof(struct CacheEntry);
-    ret+=(unsigned int)i->d_qname.length();
+    ret+=(unsigned int)i->d_qname.getStorage().length();
     for(vector<StoredRecord>::const_iterator j=i->d_records.begin(); j!= i->d_records.end(); ++j)
       ret+=j->size();
   }
   return ret;
 }
 
-int MemRecursorCache::get(time_t now, const string &qname, const QType& qt, set<DNSResourceRecord>* res)
+/* SyncRes asks about the same name several times in a row, for its CNAME and then for the type it wants, and stores the
+   records of a name one type after another, so the last name parsed is remembered. A malformed name throws AhuException */
+const DNSName& MemRecursorCache::getName(const string& qname)
+{
+  if(qname != d_lastqname) {
+    d_lastname=DNSName(qname);
+    d_lastqname=qname;
+  }
+  return d_lastname;
+}
+
+unsigned int MemRecursorCache::s_prefetchHits;
+uint32_t MemRecursorCache::s_serveStale;
+
+/* if refresh is set, the hit is counted, and *refresh tells if the entry is popular and close enough to expiry that it
+   should be refreshed now (see prefetch-hits). With stale set, records that expired less than s_serveStale seconds ago are returned too, the 
+   caller has to look at their ttl to spot them */
+int MemRecursorCache::get(time_t now, const string &qname, const QType& qt, set<DNSResourceRecord>* res, bool* refresh, bool stale)
 {
-  unsigned int ttd=0;
   //  cerr<<"looking up "<< qname+"|"+qt.getName()<<"\n";
+  if(refresh)
+    *refresh=false;
+  const DNSName& name=getName(qname);
+  if(d_store) {
+    // a shared cache is only read here, so hits do not move entries to the back of the LRU. Expired records are skipped, not removed
+    Shard& shard=getShard(name);
+    ReadLock rl(&shard.d_lock);
+    return getRecords(now, qname, qt, res, shard.d_map, shard.d_map.equal_range(tie(name)), false, refresh, stale);
+  }
 
-  if(!d_cachecachevalid || !pdns_iequals(d_cachedqname, qname)) {
+  if(!d_cachecachevalid || d_cachedqname != name) {
     //    cerr<<"had cache cache miss"<<endl;
-    d_cachedqname=qname;
-    d_cachecache=d_cache.equal_range(tie(qname));
+    d_cachedqname=name;
+    d_cachecache=d_cache.equal_range(tie(name));
     d_cachecachevalid=true;
   }
   else
     //    cerr<<"had cache cache hit!"<<endl;
     ;
 
+  return getRecords(now, qname, qt, res, d_cache, d_cachecache, true, refresh, stale);
+}
+
+int MemRecursorCache::getRecords(time_t now, const string& qname, const QType& qt, set<DNSResourceRecord>* res, cache_t& cache, 
+                                 const pair<cache_t::iterator, cache_t::iterator>& range, bool touch, bool* refresh, bool stale)
+{
+  unsigned int ttd=0;
+  uint32_t oldest=stale ? (uint32_t)now - s_serveStale : (uint32_t)now; // records that expired before this are gone
+
   if(res)
     res->clear();
 
-  if(d_cachecache.first!=d_cachecache.second) { 
-    for(cache_t::const_iterator i=d_cachecache.first; i != d_cachecache.second; ++i) 
+  if(range.first!=range.second) { 
+    for(cache_t::iterator i=range.first; i != range.second; ++i) 
       if(i->d_qtype == qt.getCode() || qt.getCode()==QType::ANY || 
          (qt.getCode()==QType::ADDR && (i->d_qtype == QType::A || i->d_qtype == QType::AAAA) )
          ) {     
         for(vector<StoredRecord>::const_iterator k=i->d_records.begin(); k != i->d_records.end(); ++k) {
-          if(k->d_ttd < 1000000000 || k->d_ttd > (uint32_t) now) {  // FIXME what does the 100000000 number mean?
+          if(k->d_ttd < 1000000000 || k->d_ttd > oldest) {  // FIXME what does the 100000000 number mean?
             ttd=k->d_ttd;
             if(res) {
               DNSResourceRecord rr=String2DNSRR(qname, QType(i->d_qtype),  k->d_string, ttd); 
@@ -136,11 +229,19 @@ int MemRecursorCache::get(time_t now, const string &qname, const QType& qt, set<
             }
           }
         }
-        if(res) {
+        if(res && touch) {
           if(res->empty())
-            moveCacheItemToFront(d_cache, i);
+            moveCacheItemToFront(cache, i);
           else
-            moveCacheItemToBack(d_cache, i);
+            moveCacheItemToBack(cache, i);
+        }
+        if(refresh && s_prefetchHits && ttd > (uint32_t)now && i->d_stored && ttd > i->d_stored) {
+          // other threads may count hits on a shared cache at the same time
+          uint32_t hits = touch ? ++i->d_hits : __sync_add_and_fetch(&i->d_hits, 1);
+          if(hits >= s_prefetchHits && (ttd - now) * 10 <= ttd - i->d_stored) { // in the last 10% of its lifetime
+            i->d_hits=0;  // no new refresh until it has been popular again
+            *refresh=true;
+          }
         }
         if(qt.getCode()!=QType::ANY && qt.getCode()!=QType::ADDR) // normally if we have a hit, we are done
           break;
@@ -187,14 +288,26 @@ bool MemRecursorCache::attemptToRefreshNSTTL(const QType& qt, const set<DNSResou
    touched, but only given a new ttd */
 void MemRecursorCache::replace(time_t now, const string &qname, const QType& qt,  const set<DNSResourceRecord>& content, bool auth)
 {
+  const DNSName& name=getName(qname);
+  if(d_store) {
+    Shard& shard=getShard(name);
+    WriteLock wl(&shard.d_lock);
+    doReplace(shard.d_map, now, name, qt, content, auth);
+    return;
+  }
   d_cachecachevalid=false;
-  tuple<string, uint16_t> key=make_tuple(qname, qt.getCode());
-  cache_t::iterator stored=d_cache.find(key);
+  doReplace(d_cache, now, name, qt, content, auth);
+}
+
+void MemRecursorCache::doReplace(cache_t& cache, time_t now, const DNSName &qname, const QType& qt,  const set<DNSResourceRecord>& content, bool auth)
+{
+  tuple<DNSName, uint16_t> key=make_tuple(qname, qt.getCode());
+  cache_t::iterator stored=cache.find(key);
   uint32_t maxTTD=UINT_MAX;
 
   bool isNew=false;
-  if(stored == d_cache.end()) {
-    stored=d_cache.insert(CacheEntry(key,vector<StoredRecord>(), auth)).first;
+  if(stored == cache.end()) {
+    stored=cache.insert(CacheEntry(key,vector<StoredRecord>(), auth)).first;
     isNew=true;
   }
   pair<vector<StoredRecord>::iterator, vector<StoredRecord>::iterator> range;
@@ -224,7 +337,7 @@ void MemRecursorCache::replace(time_t now, const string &qname, const QType& qt,
   }
   
   // limit TTL of auth->auth NSset update if needed, except for root
-  if(ce.d_auth && auth && qt.getCode()==QType::NS && !((qname.length()==1 && qname[0]=='.'))) {
+  if(ce.d_auth && auth && qt.getCode()==QType::NS && !qname.isRoot()) {
     // cerr<<"\tLimiting TTL of auth->auth NS set replace"<<endl;
     vector<StoredRecord>::iterator j;
     for(j = ce.d_records.begin() ; j != ce.d_records.end(); ++j) {
@@ -233,7 +346,7 @@ void MemRecursorCache::replace(time_t now, const string &qname, const QType& qt,
   }
 
   // make sure that we CAN refresh the root
-  if(auth && ((qname.length()==1 && qname[0]=='.') || !attemptToRefreshNSTTL(qt, content, ce) ) ) {
+  if(auth && (qname.isRoot() || !attemptToRefreshNSTTL(qt, content, ce) ) ) {
     // cerr<<"\tGot auth data, and it was not refresh attempt of an unchanged NS set, nuking storage"<<endl;
     ce.d_records.clear(); // clear non-auth data
     ce.d_auth = true;
@@ -285,32 +398,67 @@ void MemRecursorCache::replace(time_t now, const string &qname, const QType& qt,
   
   if(ce.d_records.capacity() != ce.d_records.size())
     vector<StoredRecord>(ce.d_records).swap(ce.d_records);
+
+  ce.d_stored=now;
+  ce.d_hits=0;
   
-  d_cache.replace(stored, ce);
+  cache.replace(stored, ce);
 }
 
-int MemRecursorCache::doWipeCache(const string& name, uint16_t qtype)
+int MemRecursorCache::doWipeCache(const string& qname, uint16_t qtype)
 {
-  int count=0;
+  DNSName name;
+  try {
+    name=getName(qname);
+  }
+  catch(AhuException& ae) {
+    return 0; // this comes from the control channel, and a name that does not parse can't be in the cache
+  }
+  if(d_store) {
+    Shard& shard=getShard(name);
+    WriteLock wl(&shard.d_lock);
+    return doWipe(shard.d_map, name, qtype);
+  }
   d_cachecachevalid=false;
+  return doWipe(d_cache, name, qtype);
+}
+
+int MemRecursorCache::doWipe(cache_t& cache, const DNSName& name, uint16_t qtype)
+{
+  int count=0;
   pair<cache_t::iterator, cache_t::iterator> range;
   if(qtype==0xffff)
-    range=d_cache.equal_range(tie(name));
+    range=cache.equal_range(tie(name));
   else
-    range=d_cache.equal_range(tie(name, qtype));
+    range=cache.equal_range(tie(name, qtype));
 
   for(cache_t::const_iterator i=range.first; i != range.second; ) {
     count++;
-    d_cache.erase(i++);
+    cache.erase(i++);
   }
   return count;
 }
 
-bool MemRecursorCache::doAgeCache(time_t now, const string& name, uint16_t qtype, int32_t newTTL)
+bool MemRecursorCache::doAgeCache(time_t now, const string& qname, uint16_t qtype, int32_t newTTL)
+{
+  const DNSName& name=getName(qname);
+  if(d_store) {
+    Shard& shard=getShard(name);
+    WriteLock wl(&shard.d_lock);
+    return doAge(shard.d_map, now, name, qtype, newTTL);
+  }
+  if(doAge(d_cache, now, name, qtype, newTTL)) {
+    d_cachecachevalid=false;
+    return true;
+  }
+  return false;
+}
+
+bool MemRecursorCache::doAge(cache_t& cache, time_t now, const DNSName& name, uint16_t qtype, int32_t newTTL)
 {
-  cache_t::iterator iter = d_cache.find(tie(name, qtype));
+  cache_t::iterator iter = cache.find(tie(name, qtype));
   uint32_t maxTTD=std::numeric_limits<uint32_t>::min();
-  if(iter == d_cache.end()) {
+  if(iter == cache.end()) {
     return false;
   }
 
@@ -330,8 +478,6 @@ bool MemRecursorCache::doAgeCache(time_t now, const string& name, uint16_t qtype
     return false;  // would be dead anyhow
 
   if(maxTTL > newTTL) {
-    d_cachecachevalid=false;
-
     uint32_t newTTD = now + newTTL;
     
     for(vector<StoredRecord>::iterator j = ce.d_records.begin() ; j != ce.d_records.end(); ++j)  {
@@ -339,7 +485,7 @@ bool MemRecursorCache::doAgeCache(time_t now, const string& name, uint16_t qtype
         j->d_ttd = newTTD;
     }
     
-    d_cache.replace(iter, ce);
+    cache.replace(iter, ce);
     return true;
   }
   return false;
@@ -352,30 +498,58 @@ uint64_t MemRecursorCache::doDump(int fd)
   if(!fp) { // dup probably failed
     return 0;
   }
-  fprintf(fp, "; main record cache dump from thread follows\n;\n");
+  uint64_t count=0;
+  time_t now=time(0);
+  if(d_store) {
+    fprintf(fp, "; main record cache dump (shared by all threads) follows\n;\n");
+    for(unsigned int n=0; n < d_store->d_numshards; ++n) {
+      ReadLock rl(&d_store->d_shards[n].d_lock);
+      count+=doDump(d_store->d_shards[n].d_map, fp, now);
+    }
+  }
+  else {
+    fprintf(fp, "; main record cache dump from thread follows\n;\n");
+    count=doDump(d_cache, fp, now);
+  }
+  fclose(fp);
+  return count;
+}
+
+uint64_t MemRecursorCache::doDump(const cache_t& cache, FILE* fp, time_t now)
+{
   typedef cache_t::nth_index<1>::type sequence_t;
-  sequence_t& sidx=d_cache.get<1>();
+  const sequence_t& sidx=cache.get<1>();
 
   uint64_t count=0;
-  time_t now=time(0);
   for(sequence_t::const_iterator i=sidx.begin(); i != sidx.end(); ++i) {
     for(vector<StoredRecord>::const_iterator j=i->d_records.begin(); j != i->d_records.end(); ++j) {
       count++;
       try {
-        DNSResourceRecord rr=String2DNSRR(i->d_qname, QType(i->d_qtype), j->d_string, j->d_ttd - now);
+        DNSResourceRecord rr=String2DNSRR(i->d_qname.toString(), QType(i->d_qtype), j->d_string, j->d_ttd - now);
         fprintf(fp, "%s %d IN %s %s\n", rr.qname.c_str(), rr.ttl, rr.qtype.getName().c_str(), rr.content.c_str());
       }
       catch(...) {
-        fprintf(fp, "; error printing '%s'\n", i->d_qname.c_str());
+        fprintf(fp, "; error printing '%s'\n", i->d_qname.toString().c_str());
       }
     }
   }
-  fclose(fp);
   return count;
 }
 
 void MemRecursorCache::doPrune(void)
 {
+  if(d_store) {
+    // every thread calls this periodically, so each call only does its share of the shards
+    unsigned int maxCached=::arg().asNum("max-cache-entries") / d_store->d_numshards;
+    unsigned int todo=(d_store->d_numshards + g_numThreads - 1) / g_numThreads;
+    unsigned int first=__sync_fetch_and_add(&d_store->d_prunepos, todo);
+    for(unsigned int n=0; n < todo; ++n) {
+      Shard& shard=d_store->d_shards[(first + n) % d_store->d_numshards];
+      WriteLock wl(&shard.d_lock);
+      pruneCollection(shard.d_map, maxCached);
+    }
+    return;
+  }
   d_cachecachevalid=false;
 
   unsigned int maxCached=::arg().asNum("max-cache-entries") / g_numThreads;
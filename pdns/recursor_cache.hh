@@ -5,9 +5,12 @@
 #include "dns.hh"
 #include "qtype.hh"
 #include "misc.hh"
+#include "dnsname.hh"
 #include <iostream>
 
 #include <boost/utility.hpp>
+#include <boost/shared_ptr.hpp>
+#include <pthread.h>
 #undef L
 #include <boost/multi_index_container.hpp>
 #include <boost/multi_index/ordered_index.hpp>
@@ -22,16 +25,31 @@
 #include "namespaces.hh"
 using namespace ::boost::multi_index;
 
+/** The record cache. By default every thread has its own, which needs no locking at all. With shared-cache, the
+    MemRecursorCache of each thread is a view on one SharedStore, which is split in shards that are each locked separately.
+    A name always lives in the same shard, picked by the case insensitive hash its DNSName carries. */
 class MemRecursorCache : public boost::noncopyable //  : public RecursorCache
 {
 public:
+  struct SharedStore;
+
   MemRecursorCache() : d_followRFC2181(false), d_cachecachevalid(false)
   {
     cacheHits = cacheMisses = 0;
   }
+  explicit MemRecursorCache(shared_ptr<SharedStore> store) : d_followRFC2181(false), d_cachecachevalid(false), d_store(store)
+  {
+    cacheHits = cacheMisses = 0;
+  }
+  static shared_ptr<SharedStore> makeSharedStore(unsigned int shards);
+  bool isShared() const
+  {
+    return d_store.get() != 0;
+  }
+
   unsigned int size();
   unsigned int bytes();
-  int get(time_t, const string &qname, const QType& qt, set<DNSResourceRecord>* res);
+  int get(time_t, const string &qname, const QType& qt, set<DNSResourceRecord>* res, bool* refresh=0, bool stale=false);
 
   int getDirect(time_t now, const char* qname, const QType& qt, uint32_t ttd[10], char* data[10], uint16_t len[10]);
   void replace(time_t, const string &qname, const QType& qt,  const set<DNSResourceRecord>& content, bool auth);
@@ -40,9 +58,12 @@ public:
   uint64_t doDump(int fd);
   int doWipeCache(const string& name, uint16_t qtype=0xffff);
   bool doAgeCache(time_t now, const string& name, uint16_t qtype, int32_t newTTL);
-  uint64_t cacheHits, cacheMisses;
+  uint64_t cacheHits, cacheMisses; //!< always counted for this thread, even if the cache is shared
   bool d_followRFC2181;
 
+  static unsigned int s_prefetchHits; //!< an entry hit this often since it was stored is refreshed before it expires, 0 is never
+  static uint32_t s_serveStale;       //!< expired records are kept around this many seconds, for get() with stale set
+
 private:
   struct StoredRecord
   {
@@ -64,27 +85,44 @@ private:
 
   struct CacheEntry
   {
-    CacheEntry(const tuple<string, uint16_t>& key, const vector<StoredRecord>& records, bool auth) : 
-      d_qname(key.get<0>()), d_qtype(key.get<1>()), d_auth(auth), d_records(records)
+    CacheEntry(const tuple<DNSName, uint16_t>& key, const vector<StoredRecord>& records, bool auth) : 
+      d_qname(key.get<0>()), d_qtype(key.get<1>()), d_auth(auth), d_records(records), d_stored(0), d_hits(0)
     {}
 
     typedef vector<StoredRecord> records_t;
 
+    //! for pruneCollection(), which leaves us alone while we might still serve stale records
     uint32_t getTTD() const
     {
+      uint32_t earliest;
       if(d_records.size()==1)
-        return d_records.begin()->d_ttd;
-
-      uint32_t earliest=std::numeric_limits<uint32_t>::max();
-      for(records_t::const_iterator i=d_records.begin(); i != d_records.end(); ++i)
-        earliest=min(earliest, i->d_ttd);
-      return earliest;
+        earliest=d_records.begin()->d_ttd;
+      else {
+        earliest=std::numeric_limits<uint32_t>::max();
+        for(records_t::const_iterator i=d_records.begin(); i != d_records.end(); ++i)
+          earliest=min(earliest, i->d_ttd);
+      }
+      return earliest < std::numeric_limits<uint32_t>::max() - s_serveStale ? earliest + s_serveStale : earliest;
     }
 
-    string d_qname;
+    DNSName d_qname;
     uint16_t d_qtype;
     bool d_auth;
     records_t d_records;
+    uint32_t d_stored;       //!< when the records were last stored or refreshed
+    mutable uint32_t d_hits; //!< hits since then, only counted by lookups that might refresh
+  };
+
+  /* Entries only ever get looked up by their exact name, so they are ordered by hash first. That is a comparison of two
+     integers for nearly every step down the tree, the labels only get looked at when the hashes are equal. */
+  struct HashedNameLess
+  {
+    bool operator()(const DNSName& a, const DNSName& b) const
+    {
+      if(a.hash() != b.hash())
+        return a.hash() < b.hash();
+      return a.canonCompare(b) < 0;
+    }
   };
 
   typedef multi_index_container<
@@ -93,19 +131,34 @@ private:
                 ordered_unique<
                       composite_key< 
                         CacheEntry,
-                        member<CacheEntry,string,&CacheEntry::d_qname>,
+                        member<CacheEntry,DNSName,&CacheEntry::d_qname>,
                         member<CacheEntry,uint16_t,&CacheEntry::d_qtype>
                       >,
-                      composite_key_compare<CIStringCompare, std::less<uint16_t> >
+                      composite_key_compare<HashedNameLess, std::less<uint16_t> >
                 >,
                sequenced<>
                >
   > cache_t;
 
-  cache_t d_cache;
+  struct Shard;
+
+  cache_t d_cache;  // unused if d_store is set
   pair<cache_t::iterator, cache_t::iterator> d_cachecache;
-  string d_cachedqname;
+  DNSName d_cachedqname;
   bool d_cachecachevalid;
+  shared_ptr<SharedStore> d_store;
+  string d_lastqname;  //!< the text getName() last parsed, "" is the root like d_lastname starts out
+  DNSName d_lastname;
+
+  const DNSName& getName(const string& qname);
+  Shard& getShard(const DNSName& qname);
+  int getRecords(time_t now, const string& qname, const QType& qt, set<DNSResourceRecord>* res, cache_t& cache, 
+                 const pair<cache_t::iterator, cache_t::iterator>& range, bool touch, bool* refresh, bool stale);
+  void doReplace(cache_t& cache, time_t now, const DNSName &qname, const QType& qt,  const set<DNSResourceRecord>& content, bool auth);
+  static int doWipe(cache_t& cache, const DNSName& name, uint16_t qtype);
+  static bool doAge(cache_t& cache, time_t now, const DNSName& name, uint16_t qtype, int32_t newTTL);
+  static unsigned int bytes(const cache_t& cache);
+  static uint64_t doDump(const cache_t& cache, FILE* fp, time_t now);
   bool attemptToRefreshNSTTL(const QType& qt, const set<DNSResourceRecord>& content, const CacheEntry& stored);
 };
 string DNSRR2String(const DNSResourceRecord& rr);
@@ -27,7 +27,7 @@ void primeHints(void)
   // prime root cache
   set<DNSResourceRecord>nsset;
   if(!t_RC)
-    t_RC = new MemRecursorCache();
+    t_RC = g_sharedRC ? new MemRecursorCache(g_sharedRC) : new MemRecursorCache();
 
   if(::arg()["hint-file"].empty()) {
     static const char*ips[]={"198.41.0.4", "192.228.79.201", "192.33.4.12", "199.7.91.13", "192.203.230.10", "192.5.5.241", 
@@ -744,6 +744,100 @@ struct StrcasecmpTest
 };
 
 
+// the byte at a time versions of what misc.hh now does with SSE2 or AVX2, for comparison
+static inline char bytewiseLower(char c)
+{
+  if(c>='A' && c<='Z')
+    c+='a'-'A';
+  return c;
+}
+
+static bool bytewiseIEquals(const string& a, const string& b)
+{
+  if(a.length() != b.length())
+    return false;
+  for(string::size_type n = 0; n < a.length(); ++n)
+    if(bytewiseLower(a[n]) != bytewiseLower(b[n]))
+      return false;
+  return true;
+}
+
+static uint32_t bytewiseIHash(const string& a)
+{
+  uint32_t hash = 2166136261U;
+  for(string::size_type n = 0; n < a.length(); ++n) {
+    hash ^= (unsigned char)bytewiseLower(a[n]);
+    hash *= 16777619U;
+  }
+  return hash;
+}
+
+struct CIEqualsTest
+{
+  CIEqualsTest(const string& a, bool bytewise) : d_a(a), d_b(toUpper(a)), d_bytewise(bytewise)
+  {}
+
+  string getName() const
+  {
+    return (d_bytewise ? "bytewise" : "pdns_iequals") + string(" case insensitive equality of ")+lexical_cast<string>(d_a.length())+" bytes";
+  }
+
+  void operator()() const
+  {
+    g_ret = d_bytewise ? bytewiseIEquals(d_a, d_b) : pdns_iequals(d_a, d_b);
+  }
+
+  string d_a, d_b;
+  bool d_bytewise;
+};
+
+struct CIHashTest
+{
+  CIHashTest(const string& a, bool bytewise) : d_a(a), d_bytewise(bytewise)
+  {}
+
+  string getName() const
+  {
+    return (d_bytewise ? "bytewise" : "pdns_ihash") + string(" case insensitive hash of ")+lexical_cast<string>(d_a.length())+" bytes";
+  }
+
+  void operator()() const
+  {
+    g_ret = d_bytewise ? bytewiseIHash(d_a) : pdns_ihash(d_a);
+  }
+
+  string d_a;
+  bool d_bytewise;
+};
+
+struct ToLowerTest
+{
+  ToLowerTest(const string& a, bool bytewise) : d_a(a), d_bytewise(bytewise)
+  {
+    d_buf.resize(a.length());
+  }
+
+  string getName() const
+  {
+    return (d_bytewise ? "bytewise" : "pdns_tolower") + string(" lowercasing of ")+lexical_cast<string>(d_a.length())+" bytes";
+  }
+
+  void operator()() const
+  {
+    char* buf = const_cast<char*>(d_buf.c_str());
+    if(d_bytewise) {
+      for(string::size_type n = 0; n < d_a.length(); ++n)
+        buf[n] = bytewiseLower(d_a[n]);
+    }
+    else
+      pdns_tolower(buf, d_a.c_str(), d_a.length());
+    g_ret = buf[0];
+  }
+
+  string d_a, d_buf;
+  bool d_bytewise;
+};
+
 struct NOPTest
 {
   string getName() const
@@ -769,6 +863,18 @@ try
   doRun(MyIEqualsTest());
   doRun(StrcasecmpTest());
 
+  cerr<<"case insensitive kernels: "<<pdns_ikernel()<<endl;
+  const char* names[]={"www.powerdns.com", "a-rather-long-hostname.in.a.rather.long.subdomain.example.com",
+                       "_ldap._tcp.dc._msdcs.some-department.some-division.some-company.example.com.this.name.keeps.going.to.be.just.about.as.long.as.the.longest.names.we.see.in.the.wild.org"};
+  for(unsigned int n = 0; n < sizeof(names)/sizeof(names[0]); ++n) {
+    doRun(CIEqualsTest(names[n], true));
+    doRun(CIEqualsTest(names[n], false));
+    doRun(CIHashTest(names[n], true));
+    doRun(CIHashTest(names[n], false));
+    doRun(ToLowerTest(names[n], true));
+    doRun(ToLowerTest(names[n], false));
+  }
+
   doRun(StackMallocTest());
 
   vector<uint8_t> packet = makeRootReferral();
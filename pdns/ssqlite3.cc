@@ -155,6 +155,130 @@ bool SSQLite3::getRow( row_t & row )
 }
 
 
+class SSQLite3Statement : public SSqlStatement
+{
+public:
+  SSQLite3Statement( sqlite3 *db, const std::string & query, int nparams, const bool *dolog ) : m_pDB( db ), m_query( query ), m_nparams( nparams ), m_param( 0 ), m_rc( SQLITE_DONE ), m_dolog( dolog )
+  {
+    const char *pTail;
+#if SQLITE_VERSION_NUMBER >=  3003009
+    if ( sqlite3_prepare_v2( m_pDB, query.c_str(), -1, &m_pStmt, &pTail ) != SQLITE_OK )
+#else
+    if ( sqlite3_prepare( m_pDB, query.c_str(), -1, &m_pStmt, &pTail ) != SQLITE_OK )
+#endif
+      throw SSqlException( string("Unable to compile SQLite statement '")+query+"': "+sqlite3_errmsg( m_pDB ) );
+  }
+
+  ~SSQLite3Statement()
+  {
+    sqlite3_finalize( m_pStmt );
+  }
+
+  SSqlStatement* bind( const std::string & value )
+  {
+    abandon();
+    if ( sqlite3_bind_text( m_pStmt, ++m_param, value.c_str(), value.size(), SQLITE_TRANSIENT ) != SQLITE_OK ) {
+      string error = "Unable to bind SQLite parameter "+itoa( m_param )+": "+sqlite3_errmsg( m_pDB );
+      clear();
+      throw SSqlException( error );
+    }
+    return this;
+  }
+
+  SSqlStatement* bind( long value )
+  {
+    abandon();
+    if ( sqlite3_bind_int64( m_pStmt, ++m_param, value ) != SQLITE_OK ) {
+      string error = "Unable to bind SQLite parameter "+itoa( m_param )+": "+sqlite3_errmsg( m_pDB );
+      clear();
+      throw SSqlException( error );
+    }
+    return this;
+  }
+
+  // Runs the statement up to the first row, so commands take effect straight away.
+  SSqlStatement* execute()
+  {
+    abandon();
+    if ( m_param != m_nparams ) {
+      int got = m_param;
+      clear();
+      throw SSqlException( "SQLite statement '"+m_query+"' needs "+itoa( m_nparams )+" parameters, got "+itoa( got ));
+    }
+    if ( *m_dolog )
+      L<<Logger::Warning<<"Prepared query: "<<m_query<<endl;
+
+    m_rc = sqlite3_step( m_pStmt );
+    if ( m_rc != SQLITE_ROW && m_rc != SQLITE_DONE ) {
+      string error = sqlite3_errmsg( m_pDB );
+      clear();
+      throw SSqlException( "Error while executing SQLite statement: "+error );
+    }
+    if ( m_rc == SQLITE_DONE )
+      clear();
+    else
+      m_param = 0;
+    return this;
+  }
+
+  bool getRow( row_t & row )
+  {
+    row.clear();
+    if ( m_rc != SQLITE_ROW )
+      return false;
+
+    int numCols = sqlite3_column_count( m_pStmt );
+    for ( int i = 0; i < numCols; i++ )
+    {
+      const char *pData = (const char*) sqlite3_column_text( m_pStmt, i );
+      row.push_back( pData ? pData : "" ); // NULL value to "".
+    }
+
+    m_rc = sqlite3_step( m_pStmt );
+    if ( m_rc != SQLITE_ROW ) {
+      string error = sqlite3_errmsg( m_pDB );
+      int rc = m_rc;
+      clear();
+      if ( rc != SQLITE_DONE )
+        throw SSqlException( "Error while retrieving SQLite query results: "+error );
+    }
+    return true;
+  }
+
+private:
+  // Stops a previous execution whose rows were not all retrieved, keeping the bindings.
+  void abandon()
+  {
+    if ( m_rc == SQLITE_ROW ) {
+      sqlite3_reset( m_pStmt );
+      m_rc = SQLITE_DONE;
+    }
+  }
+
+  // Makes the statement ready for the next round of bind() calls.
+  void clear()
+  {
+    sqlite3_reset( m_pStmt );
+    sqlite3_clear_bindings( m_pStmt );
+    m_param = 0;
+    m_rc = SQLITE_DONE;
+  }
+
+  sqlite3 *m_pDB;
+  sqlite3_stmt *m_pStmt;
+  std::string m_query;
+  int m_nparams;
+  int m_param;
+  int m_rc;
+  const bool *m_dolog;
+};
+
+SSqlStatement* SSQLite3::prepare( const std::string & query, int nparams )
+{
+  return new SSQLite3Statement( m_pDB, query, nparams, &m_dolog );
+}
+
+
 // Escape a SQL query.
 std::string SSQLite3::escape( const std::string & name)
 {
@@ -46,6 +46,9 @@ public:
   //! Returns a row from a result set.
   bool getRow( row_t & row );
 
+  //! Compiles a statement once, to be executed many times.
+  SSqlStatement* prepare( const std::string & query, int nparams );
+
   //! Escapes the SQL query.
   std::string escape( const std::string & query );
 
@@ -55,6 +55,10 @@ unsigned int SyncRes::s_nodelegated;
 unsigned int SyncRes::s_unreachables;
 bool SyncRes::s_doIPv6;
 bool SyncRes::s_nopacketcache;
+bool SyncRes::s_aggressiveNXDomain;
+bool SyncRes::s_coalesceQueries;
+unsigned int SyncRes::s_hedgePercent;
+unsigned int SyncRes::s_negZoneQPS;
 
 string SyncRes::s_serverID;
 SyncRes::LogMode SyncRes::s_lm;
@@ -68,7 +72,7 @@ bool SyncRes::s_doAAAAAdditionalProcessing;
 
 SyncRes::SyncRes(const struct timeval& now) :  d_outqueries(0), d_tcpoutqueries(0), d_throttledqueries(0), d_timeouts(0), d_unreachables(0),
         					 d_now(now),
-        					 d_cacheonly(false), d_nocache(false),   d_doEDNS0(false), d_lm(s_lm)
+        					 d_cacheonly(false), d_nocache(false),   d_doEDNS0(false), d_refresh(false), d_wasStale(false), d_lm(s_lm)
         					 
 { 
   if(!t_sstorage) {
@@ -242,7 +246,146 @@ void SyncRes::doEDNSDumpAndClose(int fd)
   fclose(fp);
 }
 
+namespace {
+//! identifies an outgoing question
+struct InFlightKey
+{
+  InFlightKey(const ComboAddress& ip_, const string& domain_, int type_, bool doTCP_, bool sendRDQuery_) :
+    ip(ip_), domain(domain_), type(type_), doTCP(doTCP_), sendRDQuery(sendRDQuery_)
+  {}
+  ComboAddress ip;
+  string domain;
+  int type;
+  bool doTCP, sendRDQuery;
+
+  bool operator<(const InFlightKey& rhs) const
+  {
+    if(tie(ip, type, doTCP, sendRDQuery) < tie(rhs.ip, rhs.type, rhs.doTCP, rhs.sendRDQuery))
+      return true;
+    if(tie(rhs.ip, rhs.type, rhs.doTCP, rhs.sendRDQuery) < tie(ip, type, doTCP, sendRDQuery))
+      return false;
+    return pdns_ilexicographical_compare(domain, rhs.domain);
+  }
+};
+
+struct InFlightQuery
+{
+  InFlightQuery() : d_ret(-1), d_done(false) {}
+  typedef map<unsigned int, vector<PacketID> > waiters_t;
+  waiters_t d_waiters; //!< per thread, the MTasker keys of who is waiting for the answer
+  LWResult d_result;
+  int d_ret;
+  bool d_done;
+};
+
+typedef map<InFlightKey, shared_ptr<InFlightQuery> > inflight_t;
+inflight_t s_inflight;           // with shared-cache, questions are coalesced across threads, under s_inflightlock
+pthread_mutex_t s_inflightlock = PTHREAD_MUTEX_INITIALIZER;
+__thread inflight_t* t_inflight; // without it, the answer only ends up in the cache of one thread, so each thread has its own
+__thread uint16_t t_inflightid;
+
+inflight_t& getInFlight()
+{
+  if(g_sharedRC.get())
+    return s_inflight;
+  if(!t_inflight)
+    t_inflight=new inflight_t;
+  return *t_inflight;
+}
+
+//! takes s_inflightlock, but only if threads share s_inflight
+class InFlightLock : public boost::noncopyable
+{
+public:
+  InFlightLock() : d_locked(g_sharedRC.get()!=0)
+  {
+    if(d_locked)
+      pthread_mutex_lock(&s_inflightlock);
+  }
+  ~InFlightLock()
+  {
+    if(d_locked)
+      pthread_mutex_unlock(&s_inflightlock);
+  }
+private:
+  bool d_locked;
+};
+
+void finishInFlight(const InFlightKey& key, shared_ptr<InFlightQuery> ifq, int ret, const LWResult* res)
+{
+  InFlightQuery::waiters_t waiters;
+  {
+    InFlightLock l;
+    if(res)
+      ifq->d_result=*res;
+    ifq->d_ret=ret;
+    ifq->d_done=true;
+    getInFlight().erase(key);
+    waiters.swap(ifq->d_waiters);
+  }
+  for(InFlightQuery::waiters_t::const_iterator i=waiters.begin(); i != waiters.end(); ++i)
+    wakeTasks(i->first, i->second);
+}
+}
+
+/* with coalesce-queries, a question to a server that is the same as one that is already out waits for that one to be answered,
+   and then uses its answer. When the threads share a cache this also works across threads */
 int SyncRes::asyncresolveWrapper(const ComboAddress& ip, const string& domain, int type, bool doTCP, bool sendRDQuery, struct timeval* now, LWResult* res) 
+{
+  if(!s_coalesceQueries)
+    return doAsyncResolve(ip, domain, type, doTCP, sendRDQuery, now, res);
+
+  InFlightKey key(ip, domain, type, doTCP, sendRDQuery);
+  shared_ptr<InFlightQuery> ifq;
+  PacketID waitkey;
+  {
+    InFlightLock l;
+    inflight_t& inflight=getInFlight();
+    inflight_t::iterator iter=inflight.find(key);
+    if(iter == inflight.end()) {
+      ifq=shared_ptr<InFlightQuery>(new InFlightQuery());
+      inflight.insert(make_pair(key, ifq));
+    }
+    else {
+      ifq=iter->second;
+      waitkey.remote=ip;
+      waitkey.domain=domain;
+      waitkey.type=type;
+      waitkey.fd=-2; // never matches a real socket
+      waitkey.id=t_inflightid++;
+      ifq->d_waiters[t_id].push_back(waitkey);
+    }
+  }
+
+  if(waitkey.fd == -2) {
+    g_stats.coalescedOutQueries++;
+    string dummy;
+    // the query we wait for might go through all EDNS modes, each with its own timeout
+    int ret=MT->waitEvent(waitkey, &dummy, 4 * g_networkTimeoutMsec, now);
+    Utility::gettimeofday(now, 0);
+    if(ret > 0) {
+      InFlightLock l;
+      if(ifq->d_done) {
+        *res=ifq->d_result;
+        return ifq->d_ret;
+      }
+    }
+    return doAsyncResolve(ip, domain, type, doTCP, sendRDQuery, now, res); // no answer for us, try ourselves
+  }
+
+  int ret;
+  try {
+    ret=doAsyncResolve(ip, domain, type, doTCP, sendRDQuery, now, res);
+  }
+  catch(...) {
+    finishInFlight(key, ifq, -1, 0);
+    throw;
+  }
+  finishInFlight(key, ifq, ret, res);
+  return ret;
+}
+
+int SyncRes::doAsyncResolve(const ComboAddress& ip, const string& domain, int type, bool doTCP, bool sendRDQuery, struct timeval* now, LWResult* res) 
 {
   /* what is your QUEST?
      the goal is to get as many remotes as possible on the highest level of hipness: EDNS PING responders.
@@ -414,11 +557,16 @@ int SyncRes::doResolve(const string &qname, const QType &qtype, vector<DNSResour
       }
     }
 
-    if(doCNAMECacheCheck(qname,qtype,ret,depth,res)) // will reroute us if needed
-      return res;
+    if(d_refresh && !depth) { // the cache is what we are here to update
+      LOG(prefix<<qname<<": Refreshing '"<<qname<<"|"<<qtype.getName()<<"', not looking in the cache"<<endl);
+    }
+    else {
+      if(doCNAMECacheCheck(qname,qtype,ret,depth,res)) // will reroute us if needed
+        return res;
     
-    if(doCacheCheck(qname,qtype,ret,depth,res)) // we done
-      return res;
+      if(doCacheCheck(qname,qtype,ret,depth,res)) // we done
+        return res;
+    }
   }
 
   if(d_cacheonly)
@@ -608,11 +756,16 @@ bool SyncRes::doCNAMECacheCheck(const string &qname, const QType &qtype, vector<
   
   LOG(prefix<<qname<<": Looking for CNAME cache hit of '"<<(qname+"|CNAME")<<"'"<<endl);
   set<DNSResourceRecord> cset;
-  if(t_RC->get(d_now.tv_sec, qname,QType(QType::CNAME),&cset) > 0) {
+  bool refresh;
+  if(t_RC->get(d_now.tv_sec, qname,QType(QType::CNAME),&cset, &refresh) > 0) {
 
     for(set<DNSResourceRecord>::const_iterator j=cset.begin();j!=cset.end();++j) {
       if(j->ttl>(unsigned int) d_now.tv_sec) {
         LOG(prefix<<qname<<": Found cache CNAME hit for '"<< (qname+"|CNAME") <<"' to '"<<j->content<<"'"<<endl);    
+        if(refresh) {
+          LOG(prefix<<qname<<": CNAME is popular and about to expire, prefetching"<<endl);
+          scheduleRefresh(qname, qtype);
+        }
         DNSResourceRecord rr=*j;
         rr.ttl-=d_now.tv_sec;
         ret.push_back(rr);
@@ -677,10 +830,30 @@ bool SyncRes::doCacheCheck(const string &qname, const QType &qtype, vector<DNSRe
     }
   }
 
+  if(!giveNegative && s_aggressiveNXDomain) {
+    // there is nothing underneath a name that does not exist (RFC 8020), so a denial of a parent covers us too
+    string parent(qname);
+    while(chopOffDotted(parent) && !(parent.size()==1 && parent[0]=='.')) {
+      ni=t_sstorage->negcache.find(make_tuple(parent, QType(0)));
+      if(ni == t_sstorage->negcache.end() || (uint32_t)d_now.tv_sec >= ni->d_ttd)
+        continue;
+      sttl=ni->d_ttd - d_now.tv_sec;
+      LOG(prefix<<qname<<": parent '"<<parent<<"' does not exist according to '"<<ni->d_qname<<"' for another "<<sttl<<" seconds, so neither do we"<<endl);
+      res=RCode::NXDomain;
+      giveNegative=true;
+      sqname=ni->d_qname;
+      sqt=QType::SOA;
+      moveCacheItemToBack(t_sstorage->negcache, ni);
+      break;
+    }
+  }
+
   set<DNSResourceRecord> cset;
-  bool found=false, expired=false;
+  bool found=false, expired=false, refresh;
+  // only the answer to the client can be stale, never what we need along the way to it
+  bool stale=MemRecursorCache::s_serveStale && !depth && !giveNegative;
 
-  if(t_RC->get(d_now.tv_sec, sqname, sqt, &cset) > 0) {
+  if(t_RC->get(d_now.tv_sec, sqname, sqt, &cset, &refresh, stale) > 0 || (stale && !cset.empty())) {
     LOG(prefix<<sqname<<": Found cache hit for "<<sqt.getName()<<": ");
     for(set<DNSResourceRecord>::const_iterator j=cset.begin();j!=cset.end();++j) {
       LOG(j->content);
@@ -703,10 +876,27 @@ bool SyncRes::doCacheCheck(const string &qname, const QType &qtype, vector<DNSRe
   
     LOG(endl);
     if(found && !expired) {
+      if(refresh) {
+        LOG(prefix<<sqname<<": "<<sqt.getName()<<" is popular and about to expire, prefetching"<<endl);
+        scheduleRefresh(sqname, sqt);
+      }
       if(!giveNegative)
         res=0;
       return true;
     }
+    else if(stale && expired && !found) {
+      LOG(prefix<<qname<<": cache had only stale entries, serving those while they are refreshed"<<endl);
+      for(set<DNSResourceRecord>::const_iterator j=cset.begin();j!=cset.end();++j) {
+        DNSResourceRecord rr=*j;
+        rr.ttl=s_staleTTL;
+        ret.push_back(rr);
+      }
+      scheduleRefresh(sqname, sqt);
+      g_stats.staleAnswers++;
+      d_wasStale=true;
+      res=0;
+      return true;
+    }
     else
       LOG(prefix<<qname<<": cache had only stale entries"<<endl);
   }
@@ -714,6 +904,31 @@ bool SyncRes::doCacheCheck(const string &qname, const QType &qtype, vector<DNSRe
   return false;
 }
 
+/* random subdomain floods ask for a new name every time, so they never hit a cache. But they are aimed at a zone, and that zone
+   keeps denying the names, so if the zone we are about to ask has recent denials, we limit the questions we send it. A TLD or the
+   root denies names for everybody under it, limiting those would hit unrelated zones, so they are never limited */
+bool SyncRes::negZoneLimited(const string &zone)
+{
+  string::size_type dot=zone.find('.');
+  if(dot==string::npos || dot + 1 >= zone.size())
+    return false;
+
+  typedef negcache_t::index<NegZoneTag>::type negzones_t;
+  negzones_t& zones=t_sstorage->negcache.get<NegZoneTag>();
+  pair<negzones_t::const_iterator, negzones_t::const_iterator> range=zones.equal_range(zone);
+  for(negzones_t::const_iterator iter=range.first; iter != range.second; ++iter) {
+    if(iter->d_ttd > (uint32_t)d_now.tv_sec) {
+      NegZoneLimit& limit=t_sstorage->negZoneLimits[zone];
+      if(limit.d_second != d_now.tv_sec) {
+        limit.d_second=d_now.tv_sec;
+        limit.d_queries=0;
+      }
+      return ++limit.d_queries > s_negZoneQPS;
+    }
+  }
+  return false;
+}
+
 bool SyncRes::moreSpecificThan(const string& a, const string &b)
 {
   static string dot(".");
@@ -773,6 +988,157 @@ inline vector<SyncRes::typedns_t> SyncRes::shuffleInSpeedOrder(set<string, CIStr
   return rnameservers;
 }
 
+namespace {
+//! shared between a task that hedges a query and the tasks that do the actual queries for it
+struct HedgeState
+{
+  HedgeState() : d_pending(0), d_done(false), d_hedgeWon(false), d_ret(0) {}
+  PacketID d_key;         //!< what the hedging task waits on
+  unsigned int d_pending; //!< queries that are still out
+  bool d_done;            //!< the hedging task has its answer, or has given up
+  bool d_hedgeWon;
+  int d_ret;
+  LWResult d_result;
+};
+
+struct HedgedQuery
+{
+  shared_ptr<HedgeState> state;
+  SyncRes::typedns_t ns;
+  ComboAddress ip;
+  string qname;
+  uint16_t qtype;
+  bool sendRDQuery;
+  bool hedge;
+};
+
+__thread uint16_t t_hedgeid;
+
+/* sends one of the queries of a hedge. The first usable answer goes to the hedging task, which then accounts for it like for any
+   other answer. Answers that come in too late, or are not used, are accounted for here */
+void doHedgedQuery(void* p)
+{
+  HedgedQuery* hq=(HedgedQuery*)p;
+  HedgeState& st=*hq->state;
+  struct timeval now;
+  Utility::gettimeofday(&now, 0);
+  LWResult lwr;
+  int ret;
+  try {
+    SyncRes sr(now);
+    ret=sr.asyncresolveWrapper(hq->ip, hq->qname, hq->qtype, false, hq->sendRDQuery, &now, &lwr);
+  }
+  catch(...) {
+    ret=-2; // our problem, not that of the server
+  }
+  st.d_pending--;
+
+  bool usable = ret==1 && lwr.d_rcode!=RCode::ServFail && lwr.d_rcode!=RCode::Refused;
+  if(!st.d_done && (usable || !st.d_pending)) { // if nothing worked, the last one back speaks for the hedge
+    st.d_done=true;
+    st.d_hedgeWon=hq->hedge;
+    st.d_ret=ret;
+    st.d_result=lwr;
+    wakeTasks(t_id, vector<PacketID>(1, st.d_key));
+  }
+  else if(ret==1)
+    t_sstorage->nsSpeeds[hq->ns].submit(hq->ip, lwr.d_usec, &now);
+  else if(ret!=-2) {
+    t_sstorage->nsSpeeds[hq->ns].submit(hq->ip, 1000000, &now); // 1 sec
+    t_sstorage->throttle.throttle(now.tv_sec, make_tuple(hq->ip, hq->qname, hq->qtype), ret==-1 ? 60 : 10, ret==-1 ? 100 : 5);
+  }
+  delete hq;
+}
+}
+
+/** finds a server to hedge a query to: the next address of this nameserver, or an address we have in the cache for one of the next
+    nameservers. Servers that are throttled or that we may not query are skipped. */
+bool SyncRes::getHedgeCandidate(const vector<typedns_t>& rnameservers, vector<typedns_t>::const_iterator tns, const vector<ComboAddress>& remoteIPs,
+                                vector<ComboAddress>::const_iterator remoteIP, const string& qname, const QType& qtype, typedns_t* hedgeNS, ComboAddress* hedgeIP)
+{
+  extern NetmaskGroup* g_dontQuery;
+  for(++remoteIP; remoteIP != remoteIPs.end(); ++remoteIP) {
+    if(!t_sstorage->throttle.shouldThrottle(d_now.tv_sec, make_tuple(*remoteIP, qname, qtype.getCode()))) {
+      *hedgeNS=*tns;
+      *hedgeIP=*remoteIP;
+      return true;
+    }
+  }
+  if(!isCanonical(tns->first))
+    return false; // forwarders only hedge among their own addresses
+
+  for(++tns; tns != rnameservers.end(); ++tns) {
+    if(tns->first.empty() || !isCanonical(tns->first) || pdns_iequals(tns->first, qname))
+      continue;
+    set<DNSResourceRecord> res;
+    if(t_RC->get(d_now.tv_sec, tns->first, QType(tns->second), &res) <= 0)
+      continue;
+    BOOST_FOREACH(const DNSResourceRecord& rr, res) {
+      ComboAddress ip;
+      try {
+        ip=ComboAddress(rr.content, 53);
+      }
+      catch(...) {
+        continue;
+      }
+      if((g_dontQuery && g_dontQuery->match(&ip)) || t_sstorage->throttle.shouldThrottle(d_now.tv_sec, make_tuple(ip, qname, qtype.getCode())))
+        continue;
+      *hedgeNS=*tns;
+      *hedgeIP=ip;
+      return true;
+    }
+  }
+  return false;
+}
+
+/** sends qname|qtype to ip, and if that has not answered after delayMsec, also to hedgeIP. The first usable answer wins,
+    *hedgeWon tells which one that was. If neither answer is usable, the one that came back last is returned. */
+int SyncRes::hedgedResolve(const typedns_t& ns, const ComboAddress& ip, const typedns_t& hedgeNS, const ComboAddress& hedgeIP, unsigned int delayMsec,
+                           const string& qname, const QType& qtype, bool sendRDQuery, LWResult* lwr, bool* hedgeWon)
+{
+  shared_ptr<HedgeState> state(new HedgeState());
+  state->d_key.remote=ip;
+  state->d_key.domain=qname;
+  state->d_key.type=qtype.getCode();
+  state->d_key.fd=-3; // never matches a real socket, nor a coalesced query
+  state->d_key.id=t_hedgeid++;
+
+  HedgedQuery hq;
+  hq.state=state;
+  hq.ns=ns;
+  hq.ip=ip;
+  hq.qname=qname;
+  hq.qtype=qtype.getCode();
+  hq.sendRDQuery=sendRDQuery;
+  hq.hedge=false;
+  state->d_pending++;
+  MT->makeThread(doHedgedQuery, new HedgedQuery(hq));
+
+  string dummy;
+  MT->waitEvent(state->d_key, &dummy, delayMsec, &d_now);
+  if(!state->d_done) {
+    g_stats.hedgedOutQueries++;
+    s_outqueries++; d_outqueries++;
+    hq.ns=hedgeNS;
+    hq.ip=hedgeIP;
+    hq.hedge=true;
+    state->d_pending++;
+    MT->makeThread(doHedgedQuery, new HedgedQuery(hq));
+    MT->waitEvent(state->d_key, &dummy, 4 * g_networkTimeoutMsec, &d_now); // all EDNS modes might time out
+  }
+  Utility::gettimeofday(&d_now, 0);
+
+  if(!state->d_done) { // should not happen, the queries have their own timeouts
+    state->d_done=true;
+    return 0;
+  }
+  *hedgeWon=state->d_hedgeWon;
+  if(*hedgeWon)
+    g_stats.hedgeWins++;
+  *lwr=state->d_result;
+  return state->d_ret;
+}
+
 struct TCacheComp
 {
   bool operator()(const pair<string, QType>& a, const pair<string, QType>& b) const
@@ -807,6 +1173,12 @@ int SyncRes::doResolveAt(set<string, CIStringCompare> nameservers, string auth,
   LOG(prefix<<qname<<": Cache consultations done, have "<<(unsigned int)nameservers.size()<<" NS to contact"<<endl);
 
   for(;;) { // we may get more specific nameservers
+    if(s_negZoneQPS && !nameservers.count(string()) && negZoneLimited(auth)) { // auth is the closest zone cut we know of
+      LOG(prefix<<qname<<": too many queries for uncached names in '"<<auth<<"', which is denying names, not sending this one out"<<endl);
+      g_stats.negZoneDrops++;
+      return RCode::ServFail;
+    }
+
     vector<typedns_t > rnameservers = shuffleInSpeedOrder(nameservers, doLog() ? (prefix+qname+": ") : string() );
     
     for(vector<typedns_t >::const_iterator tns=rnameservers.begin();;++tns) { 
@@ -833,6 +1205,10 @@ int SyncRes::doResolveAt(set<string, CIStringCompare> nameservers, string auth,
       bool pierceDontQuery=false;
       bool sendRDQuery=false;
       LWResult lwr;
+      typedns_t usedNS, hedgeNS; // usedNS and usedIP are the server that gave us lwr, which is not *remoteIP if a hedge won
+      ComboAddress usedIP, hedgeIP;
+      unsigned int hedgeDelay;
+      bool hedgeWon;
       if(tns->first.empty()) {
         LOG(prefix<<qname<<": Domain is out-of-band"<<endl);
         doOOBResolve(qname, qtype, lwr.d_result, depth, lwr.d_rcode);
@@ -900,8 +1276,29 @@ int SyncRes::doResolveAt(set<string, CIStringCompare> nameservers, string auth,
               s_tcpoutqueries++; d_tcpoutqueries++;
             }
             
-            resolveret=asyncresolveWrapper(*remoteIP, qname,  qtype.getCode(), 
-        				   doTCP, sendRDQuery, &d_now, &lwr);    // <- we go out on the wire!
+            usedNS=*tns;
+            usedIP=*remoteIP;
+            hedgeDelay=0;
+            if(s_hedgePercent && !doTCP) {
+              double speed=t_sstorage->nsSpeeds[*tns].get(*remoteIP, &d_now); // usec, 0 if we never asked this server anything
+              hedgeDelay=max(10U, (unsigned int)(speed * s_hedgePercent / 100000));
+              if(!speed || hedgeDelay >= g_networkTimeoutMsec)
+                hedgeDelay=0;
+            }
+
+            if(hedgeDelay && getHedgeCandidate(rnameservers, tns, remoteIPs, remoteIP, qname, qtype, &hedgeNS, &hedgeIP)) {
+              LOG(prefix<<qname<<": will also ask "<<hedgeNS.first<<" ("<<hedgeIP.toStringWithPort()<<") if no answer within "<<hedgeDelay<<"ms"<<endl);
+              hedgeWon=false;
+              resolveret=hedgedResolve(*tns, *remoteIP, hedgeNS, hedgeIP, hedgeDelay, qname, qtype, sendRDQuery, &lwr, &hedgeWon);
+              if(hedgeWon) {
+                LOG(prefix<<qname<<": answer came from "<<hedgeIP.toStringWithPort()<<endl);
+                usedNS=hedgeNS;
+                usedIP=hedgeIP;
+              }
+            }
+            else
+              resolveret=asyncresolveWrapper(*remoteIP, qname,  qtype.getCode(), 
+        				     doTCP, sendRDQuery, &d_now, &lwr);    // <- we go out on the wire!
             if(resolveret != 1) {
               if(resolveret==0) {
         	LOG(prefix<<qname<<": timeout resolving "<< (doTCP ? "over TCP" : "")<<endl);
@@ -920,26 +1317,26 @@ int SyncRes::doResolveAt(set<string, CIStringCompare> nameservers, string auth,
               if(resolveret!=-2) { // don't account for resource limits, they are our own fault
         	{
         	  
-        	  t_sstorage->nsSpeeds[*tns].submit(*remoteIP, 1000000, &d_now); // 1 sec
+        	  t_sstorage->nsSpeeds[usedNS].submit(usedIP, 1000000, &d_now); // 1 sec
         	}
         	if(resolveret==-1)
-        	  t_sstorage->throttle.throttle(d_now.tv_sec, make_tuple(*remoteIP, qname, qtype.getCode()), 60, 100); // unreachable, 1 minute or 100 queries
+        	  t_sstorage->throttle.throttle(d_now.tv_sec, make_tuple(usedIP, qname, qtype.getCode()), 60, 100); // unreachable, 1 minute or 100 queries
         	else
-        	  t_sstorage->throttle.throttle(d_now.tv_sec, make_tuple(*remoteIP, qname, qtype.getCode()), 10, 5);  // timeout
+        	  t_sstorage->throttle.throttle(d_now.tv_sec, make_tuple(usedIP, qname, qtype.getCode()), 10, 5);  // timeout
               }
               continue;
             }
 
             if(lwr.d_rcode==RCode::ServFail || lwr.d_rcode==RCode::Refused) {
-              LOG(prefix<<qname<<": "<<tns->first<<" returned a "<< (lwr.d_rcode==RCode::ServFail ? "ServFail" : "Refused") << ", trying sibling IP or NS"<<endl);
-              t_sstorage->throttle.throttle(d_now.tv_sec,make_tuple(*remoteIP, qname, qtype.getCode()),60,3); // servfail or refused
+              LOG(prefix<<qname<<": "<<usedNS.first<<" returned a "<< (lwr.d_rcode==RCode::ServFail ? "ServFail" : "Refused") << ", trying sibling IP or NS"<<endl);
+              t_sstorage->throttle.throttle(d_now.tv_sec,make_tuple(usedIP, qname, qtype.getCode()),60,3); // servfail or refused
               continue;
             }
             
             break;  // this IP address worked!
           wasLame:; // well, it didn't
-            LOG(prefix<<qname<<": status=NS "<<tns->first<<" ("<< remoteIP->toString() <<") is lame for '"<<auth<<"', trying sibling IP or NS"<<endl);
-            t_sstorage->throttle.throttle(d_now.tv_sec, make_tuple(*remoteIP, qname, qtype.getCode()), 60, 100); // lame
+            LOG(prefix<<qname<<": status=NS "<<usedNS.first<<" ("<< usedIP.toString() <<") is lame for '"<<auth<<"', trying sibling IP or NS"<<endl);
+            t_sstorage->throttle.throttle(d_now.tv_sec, make_tuple(usedIP, qname, qtype.getCode()), 60, 100); // lame
           }
         }
         
@@ -956,7 +1353,7 @@ int SyncRes::doResolveAt(set<string, CIStringCompare> nameservers, string auth,
           return RCode::ServFail;
         }
         
-        LOG(prefix<<qname<<": Got "<<(unsigned int)lwr.d_result.size()<<" answers from "<<tns->first<<" ("<< remoteIP->toString() <<"), rcode="<<lwr.d_rcode<<", aa="<<lwr.d_aabit<<", in "<<lwr.d_usec/1000<<"ms"<<endl);
+        LOG(prefix<<qname<<": Got "<<(unsigned int)lwr.d_result.size()<<" answers from "<<usedNS.first<<" ("<< usedIP.toString() <<"), rcode="<<lwr.d_rcode<<", aa="<<lwr.d_aabit<<", in "<<lwr.d_usec/1000<<"ms"<<endl);
 
         /*  // for you IPv6 fanatics :-)
         if(remoteIP->sin4.sin_family==AF_INET6)
@@ -964,7 +1361,7 @@ int SyncRes::doResolveAt(set<string, CIStringCompare> nameservers, string auth,
         */
         //	cout<<"msec: "<<lwr.d_usec/1000.0<<", "<<g_avgLatency/1000.0<<'\n';
 
-        t_sstorage->nsSpeeds[*tns].submit(*remoteIP, lwr.d_usec, &d_now);
+        t_sstorage->nsSpeeds[usedNS].submit(usedIP, lwr.d_usec, &d_now);
       }
 
       typedef map<pair<string, QType>, set<DNSResourceRecord>, TCacheComp > tcache_t;
@@ -27,7 +27,7 @@ struct NegCacheEntry
 {
   string d_name;
   QType d_qtype;
-  string d_qname;
+  string d_qname;  //!< the zone the denial came from, the owner of its SOA
   uint32_t d_ttd;
   uint32_t getTTD() const
   {
@@ -35,6 +35,14 @@ struct NegCacheEntry
   }
 };
 
+//! how many queries went out this second for names in a zone that recently denied names, see negative-zone-qps
+struct NegZoneLimit
+{
+  NegZoneLimit() : d_second(0), d_queries(0) {}
+  time_t d_second;
+  unsigned int d_queries;
+};
+
 
 template<class Thing> class Throttle : public boost::noncopyable
 {
@@ -206,6 +214,18 @@ public:
     d_nocache=state;
   }
 
+  //! look past the cache for the question itself, to refresh what is cached for it
+  void setRefresh(bool state=true)
+  {
+    d_refresh=state;
+  }
+
+  //! if the answer contains expired records, because of serve-stale
+  bool wasStale() const
+  {
+    return d_wasStale;
+  }
+
   void setDoEDNS0(bool state=true)
   {
     d_doEDNS0=state;
@@ -239,6 +259,7 @@ public:
 
   //  typedef map<string,NegCacheEntry> negcache_t;
 
+  struct NegZoneTag{};
   typedef multi_index_container <
     NegCacheEntry,
     indexed_by <
@@ -250,9 +271,11 @@ public:
            >,
            composite_key_compare<CIStringCompare, std::less<QType> >
        >,
-       sequenced<> 
+       sequenced<>,
+       ordered_non_unique<tag<NegZoneTag>, member<NegCacheEntry, string, &NegCacheEntry::d_qname>, CIStringCompare>
     >
   > negcache_t;
+  typedef map<string, NegZoneLimit, CIStringCompare> negzonelimits_t;
   
   //! This represents a number of decaying Ewmas, used to store performance per nameserver-name. 
   /** Modelled to work mostly like the underlying DecayingEwma. After you've called get,
@@ -275,6 +298,15 @@ public:
       }
     }
 
+    //! the speed of one address, 0 if we know nothing about it
+    double get(const ComboAddress& remote, struct timeval* now)
+    {
+      for(collection_t::iterator pos=d_collection.begin(); pos != d_collection.end(); ++pos)
+        if(pos->first==remote)
+          return pos->second.get(now);
+      return 0;
+    }
+
     double get(struct timeval* now)
     {
       if(d_collection.empty())
@@ -351,11 +383,17 @@ public:
   static unsigned int s_packetcachettl;
   static unsigned int s_packetcacheservfailttl;
   static bool s_nopacketcache;
+  static bool s_aggressiveNXDomain;
+  static bool s_coalesceQueries;
+  static unsigned int s_hedgePercent;
+  static unsigned int s_negZoneQPS;
   static string s_serverID;
+  static const unsigned int s_staleTTL=30; //!< TTL we hand out on stale records, as suggested by draft-tale-dnsop-serve-stale
   
   
   struct StaticStorage {
     negcache_t negcache;    
+    negzonelimits_t negZoneLimits;
     nsspeeds_t nsSpeeds;
     ednsstatus_t ednsstatus;
     throttle_t throttle;
@@ -371,6 +409,12 @@ private:
   domainmap_t::const_iterator getBestAuthZone(string* qname);
   bool doCNAMECacheCheck(const string &qname, const QType &qtype, vector<DNSResourceRecord>&ret, int depth, int &res);
   bool doCacheCheck(const string &qname, const QType &qtype, vector<DNSResourceRecord>&ret, int depth, int &res);
+  bool negZoneLimited(const string &zone);
+  int doAsyncResolve(const ComboAddress& ip, const string& domain, int type, bool doTCP, bool sendRDQuery, struct timeval* now, LWResult* res);
+  bool getHedgeCandidate(const vector<typedns_t>& rnameservers, vector<typedns_t>::const_iterator tns, const vector<ComboAddress>& remoteIPs,
+                         vector<ComboAddress>::const_iterator remoteIP, const string& qname, const QType& qtype, typedns_t* hedgeNS, ComboAddress* hedgeIP);
+  int hedgedResolve(const typedns_t& ns, const ComboAddress& ip, const typedns_t& hedgeNS, const ComboAddress& hedgeIP, unsigned int delayMsec,
+                    const string& qname, const QType& qtype, bool sendRDQuery, LWResult* lwr, bool* hedgeWon);
   void getBestNSFromCache(const string &qname, set<DNSResourceRecord>&bestns, bool* flawedNSSet, int depth, set<GetBestNSAnswer>& beenthere);
   void addCruft(const string &qname, vector<DNSResourceRecord>& ret);
   string getBestNSNamesFromCache(const string &qname,set<string, CIStringCompare>& nsset, bool* flawedNSSet, int depth, set<GetBestNSAnswer>&beenthere);
@@ -386,6 +430,8 @@ private:
   bool d_cacheonly;
   bool d_nocache;
   bool d_doEDNS0;
+  bool d_refresh;
+  bool d_wasStale;
   static LogMode s_lm;
   LogMode d_lm;
 
@@ -409,7 +455,7 @@ extern __thread SyncRes::StaticStorage* t_sstorage;
 class Socket;
 /* external functions, opaque to us */
 int asendtcp(const string& data, Socket* sock);
-int arecvtcp(string& data, int len, Socket* sock);
+int asendrecvtcp(const ComboAddress& remote, const string& packet, uint16_t id, const string& domain, uint16_t qtype, string* answer);
 
 
 struct PacketID
@@ -469,6 +515,8 @@ struct PacketIDBirthdayCompare: public std::binary_function<PacketID, PacketID,
   }
 };
 extern __thread MemRecursorCache* t_RC;
+extern shared_ptr<MemRecursorCache::SharedStore> g_sharedRC; //!< set if all threads share one record cache
+extern __thread unsigned int t_id;
 extern __thread RecursorPacketCache* t_packetCache;
 typedef MTasker<PacketID,string> MT_t;
 extern __thread MT_t* MT;
@@ -502,8 +550,16 @@ struct RecursorStats
   uint64_t noPingOutQueries, noEdnsOutQueries;
   uint64_t packetCacheHits;
   uint64_t noPacketError;
+  uint64_t cachePrefetches;
+  uint64_t staleAnswers;
+  uint64_t negZoneDrops;
+  uint64_t coalescedOutQueries;
+  uint64_t hedgedOutQueries;
+  uint64_t hedgeWins;
+  uint64_t tcpOutReuses;
   time_t startupTime;
   unsigned int maxMThreadStackUsage;
+  unsigned int mthreadStackHighWater;
 };
 
 //! represents a running TCP/IP client session
@@ -549,12 +605,15 @@ string doTraceRegex(vector<string>::const_iterator begin, vector<string>::const_
 void parseACLs();
 extern RecursorStats g_stats;
 extern unsigned int g_numThreads;
+extern unsigned int g_networkTimeoutMsec;
 
 std::string reloadAuthAndForwards();
 ComboAddress parseIPAndPort(const std::string& input, uint16_t port);
 ComboAddress getQueryLocalAddress(int family, uint16_t port);
 typedef boost::function<void*(void)> pipefunc_t;
 void broadcastFunction(const pipefunc_t& func, bool skipSelf = false);
+void scheduleRefresh(const string& qname, const QType& qtype);
+void wakeTasks(unsigned int threadId, const vector<PacketID>& keys);
 void distributeAsyncFunction(const pipefunc_t& func);
 
 int directResolve(const std::string& qname, const QType& qtype, int qclass, vector<DNSResourceRecord>& ret);
@@ -219,9 +219,7 @@ void UeberBackend::getUpdatedMasters(vector<DomainInfo>* domains)
 /** special trick - if sd.db is set to -1, the cache is ignored */
 bool UeberBackend::getSOA(const string &domain, SOAData &sd, DNSPacket *p)
 {
-  d_question.qtype=QType::SOA;
-  d_question.qname=domain;
-  d_question.zoneId=-1;
+  d_question.set(QType(QType::SOA), domain, -1);
     
   if(sd.db!=(DNSBackend *)-1) {
     int cstat=cacheHas(d_question,d_answers);
@@ -304,6 +302,20 @@ void UeberBackend::cleanup()
   for_each(backends.begin(),backends.end(),del);
 }
 
+void UeberBackend::Question::set(const QType& qt, const string& name, int id)
+{
+  qtype=qt;
+  qname=name;
+  zoneId=id;
+  try {
+    cachename=DNSName(qname);
+    cacheable=true;
+  }
+  catch(AhuException& ae) {
+    cacheable=false;
+  }
+}
+
 // silly Solaris fix
 #undef PC
 
@@ -325,7 +337,11 @@ int UeberBackend::cacheHas(const Question &q, vector<DNSResourceRecord> &rrs)
   string content;
   //  L<<Logger::Warning<<"looking up: '"<<q.qname+"'|N|"+q.qtype.getName()+"|"+itoa(q.zoneId)<<endl;
 
-  bool ret=PC.getEntry(q.qname, q.qtype, PacketCache::QUERYCACHE, content, q.zoneId);   // think about lowercasing here
+  if(!q.cacheable) {
+    (*qcachemiss)++;
+    return -1;
+  }
+  bool ret=PC.getEntry(q.cachename, q.qtype, PacketCache::QUERYCACHE, content, q.zoneId);   // think about lowercasing here
   if(!ret) {
     (*qcachemiss)++;
     return -1;
@@ -345,18 +361,19 @@ void UeberBackend::addNegCache(const Question &q)
 {
   extern PacketCache PC;
   static int negqueryttl=::arg().asNum("negquery-cache-ttl");
-  if(!negqueryttl)
+  if(!negqueryttl || !q.cacheable)
     return;
-  PC.insert(q.qname, q.qtype, PacketCache::QUERYCACHE, "", negqueryttl, q.zoneId);
+  PC.insert(q.cachename, q.qtype, PacketCache::QUERYCACHE, "", negqueryttl, q.zoneId);
 }
 
-void UeberBackend::addCache(const Question &q, const vector<DNSResourceRecord> &rrs)
+//! also fills in the wire format content of rrs, so answers from the cache need no parsing in DNSPacket::wrapup()
+void UeberBackend::addCache(const Question &q, vector<DNSResourceRecord> &rrs)
 {
   extern PacketCache PC;
   static unsigned int queryttl=::arg().asNum("query-cache-ttl");
   unsigned int cachettl;
 
-  if(!queryttl)
+  if(!queryttl || !q.cacheable)
     return;
   
   //  L<<Logger::Warning<<"inserting: "<<q.qname+"|N|"+q.qtype.getName()+"|"+itoa(q.zoneId)<<endl;
@@ -364,13 +381,15 @@ void UeberBackend::addCache(const Question &q, const vector<DNSResourceRecord> &
   boost::archive::binary_oarchive boa(ostr, boost::archive::no_header);
 
   cachettl = queryttl;
-  BOOST_FOREACH(DNSResourceRecord rr, rrs) {
+  BOOST_FOREACH(DNSResourceRecord& rr, rrs) {
     if (rr.ttl < queryttl)
       cachettl = rr.ttl;
+    if(!rr.hasWireContent())
+      rr.setWireContent(makeWireContent(rr.qtype.getCode(), rr.content, rr.priority));
   }
 
   boa << rrs;
-  PC.insert(q.qname, q.qtype, PacketCache::QUERYCACHE, ostr.str(), cachettl, q.zoneId);
+  PC.insert(q.cachename, q.qtype, PacketCache::QUERYCACHE, ostr.str(), cachettl, q.zoneId);
 }
 
 void UeberBackend::alsoNotifies(const string &domain, set<string> *ips)
@@ -386,14 +405,13 @@ UeberBackend::~UeberBackend()
 }
 
 // this handle is more magic than most
-void UeberBackend::lookup(const QType &qtype,const string &qname, DNSPacket *pkt_p, int zoneId)
+void UeberBackend::waitUntilReady()
 {
   if(stale) {
     L<<Logger::Error<<"Stale ueberbackend received question, signalling that we want to be recycled"<<endl;
     throw AhuException("We are stale, please recycle");
   }
 
-  DLOG(L<<"UeberBackend received question for "<<qtype.getName()<<" of "<<qname<<endl);
   if(!d_go) {
     pthread_mutex_lock(&d_mut);
     while (d_go==false) {
@@ -403,6 +421,12 @@ void UeberBackend::lookup(const QType &qtype,const string &qname, DNSPacket *pkt
     }
     pthread_mutex_unlock(&d_mut);
   }
+}
+
+void UeberBackend::lookup(const QType &qtype,const string &qname, DNSPacket *pkt_p, int zoneId)
+{
+  DLOG(L<<"UeberBackend received question for "<<qtype.getName()<<" of "<<qname<<endl);
+  waitUntilReady();
 
   domain_id=zoneId;
 
@@ -418,9 +442,7 @@ void UeberBackend::lookup(const QType &qtype,const string &qname, DNSPacket *pkt
     throw AhuException("We are stale, please recycle");
   }
   else {
-    d_question.qtype=qtype;
-    d_question.qname=qname;
-    d_question.zoneId=zoneId;
+    d_question.set(qtype, qname, zoneId);
     int cstat=cacheHas(d_question, d_answers);
     if(cstat<0) { // nothing
       d_negcached=d_cached=false;
@@ -442,6 +464,79 @@ void UeberBackend::lookup(const QType &qtype,const string &qname, DNSPacket *pkt
   d_handle.parent=this;
 }
 
+/** Pipelined lookups only go to the first backend, that is the one that answers nearly everything. Should
+    it come back empty handed, the remaining backends are asked synchronously at harvest time, just like
+    handle::get() would have done */
+void UeberBackend::submitLookup(const QType &qtype, const string &qname, DNSPacket *pkt_p, int zoneId)
+{
+  waitUntilReady();
+  if(!backends.size()) {
+    L<<Logger::Error<<Logger::NTLog<<"No database backends available - unable to answer questions."<<endl;
+    stale=true; // please recycle us! 
+    throw AhuException("We are stale, please recycle");
+  }
+
+  PendingQuestion pq;
+  pq.q.set(qtype, qname, zoneId);
+  pq.pkt_p=pkt_p;
+  pq.cstat=cacheHas(pq.q, pq.rrs);
+  d_pendingQuestions.push_back(pq);
+
+  if(pq.cstat < 0) {
+    try {
+      backends[0]->submitLookup(qtype, qname, pkt_p, zoneId);
+    }
+    catch(...) {
+      discardLookups();
+      throw;
+    }
+  }
+}
+
+bool UeberBackend::harvestLookup(vector<DNSResourceRecord>& rrs)
+{
+  rrs.clear();
+  if(d_pendingQuestions.empty())
+    return false;
+
+  PendingQuestion pq;
+  pq.cstat=d_pendingQuestions.front().cstat;
+  pq.q=d_pendingQuestions.front().q;
+  pq.pkt_p=d_pendingQuestions.front().pkt_p;
+  rrs.swap(d_pendingQuestions.front().rrs);
+  d_pendingQuestions.pop_front();
+
+  if(pq.cstat >= 0)
+    return true;
+
+  try {
+    backends[0]->harvestLookup(rrs);
+    for(vector<DNSBackend*>::size_type n=1; rrs.empty() && n < backends.size(); ++n) {
+      DNSResourceRecord rr;
+      backends[n]->lookup(pq.q.qtype, pq.q.qname, pq.pkt_p, pq.q.zoneId);
+      while(backends[n]->get(rr))
+        rrs.push_back(rr);
+    }
+  }
+  catch(...) {
+    discardLookups();
+    throw;
+  }
+
+  if(rrs.empty())
+    addNegCache(pq.q);
+  else
+    addCache(pq.q, rrs);
+  return true;
+}
+
+void UeberBackend::discardLookups()
+{
+  d_pendingQuestions.clear();
+  if(!backends.empty())
+    backends[0]->discardLookups();
+}
+
 void UeberBackend::getAllDomains(vector<DomainInfo> *domains) {
   for (vector<DNSBackend*>::iterator i = backends.begin(); i != backends.end(); ++i )
   {
@@ -500,6 +595,7 @@ bool UeberBackend::handle::get(DNSResourceRecord &r)
 {
   DLOG(L << "Ueber get() was called for a "<<qtype.getName()<<" record" << endl);
   bool isMore=false;
+  r.wirecontent.clear(); // r may be reused, and only some backends fill this in
   while(d_hinterBackend && !(isMore=d_hinterBackend->get(r))) { // this backend out of answers
     if(i<parent->backends.size()) {
       DLOG(L<<"Backend #"<<i<<" of "<<parent->backends.size()
@@ -39,6 +39,7 @@
 #include <boost/utility.hpp>
 #include "dnspacket.hh"
 #include "dnsbackend.hh"
+#include "dnsname.hh"
 
 #include "namespaces.hh"
 
@@ -111,6 +112,9 @@ public:
   };
 
   void lookup(const QType &, const string &qdomain, DNSPacket *pkt_p=0,  int zoneId=-1);
+  void submitLookup(const QType &, const string &qdomain, DNSPacket *pkt_p=0, int zoneId=-1);
+  bool harvestLookup(vector<DNSResourceRecord>& rrs);
+  void discardLookups();
 
   bool getSOA(const string &domain, SOAData &sd, DNSPacket *p=0);
   bool list(const string &target, int domain_id);
@@ -146,16 +150,31 @@ private:
   bool d_cached;
   struct Question
   {
+    Question() : cacheable(false), zoneId(-1) {}
+    void set(const QType& qt, const string& name, int id); //!< also makes cachename, once per question
+
     QType qtype;
     string qname;
+    DNSName cachename; //!< what the query cache is keyed on
+    bool cacheable;    //!< false if qname is not a valid name, so it can't be in the query cache either
     int zoneId;
   }d_question;
   vector<DNSResourceRecord> d_answers;
   vector<DNSResourceRecord>::const_iterator d_cachehandleiter;
 
+  struct PendingQuestion
+  {
+    Question q;
+    DNSPacket *pkt_p;
+    int cstat; // as returned by cacheHas
+    vector<DNSResourceRecord> rrs;
+  };
+  deque<PendingQuestion> d_pendingQuestions;
+
+  void waitUntilReady();
   int cacheHas(const Question &q, vector<DNSResourceRecord> &rrs);
   void addNegCache(const Question &q);
-  void addCache(const Question &q, const vector<DNSResourceRecord> &rrs);
+  void addCache(const Question &q, vector<DNSResourceRecord> &rrs);
   
   static pthread_mutex_t d_mut;
   static pthread_cond_t d_cond;